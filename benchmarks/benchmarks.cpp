@@ -1,14 +1,46 @@
 #include "bakery.h"
+#include "fixtures.h"
+#include "metrics.h"
+#include "planner.h"
 #include "queries.h"
+#include "trace.h"
 
 #include <benchmark/benchmark.h>
 
+#include <cstdlib>
 #include <numeric>
 
+/// <summary>
+/// Exports whatever the query instrumentation recorded during the benchmark as counters. This only does
+/// something when the library was built with QUERY_METRICS, so it's safe to call unconditionally.
+/// </summary>
+static void ExportMetrics(benchmark::State& state)
+{
+    if constexpr (queries::metrics::kEnabled)
+    {
+        const queries::metrics::Snapshot snapshot = queries::metrics::TakeSnapshot();
+        const double iterations = static_cast<double>(state.iterations());
+
+        state.counters["rows_scanned"] = benchmark::Counter(snapshot.rowsScanned, benchmark::Counter::kIsRate);
+        state.counters["bytes_touched"] = benchmark::Counter(snapshot.bytesTouched, benchmark::Counter::kIsRate,
+                                                             benchmark::Counter::kIs1024);
+        state.counters["chunks"] = snapshot.chunks / iterations;
+        state.counters["chunking_us"] = snapshot.chunkingNanos / 1e3 / iterations;
+        state.counters["chunk_mean_us"] = snapshot.MeanChunkNanos() / 1e3;
+        state.counters["chunk_max_us"] = snapshot.maxChunkNanos / 1e3;
+        state.counters["queue_wait_us"] = snapshot.queueWaitNanos / 1e3 / iterations;
+        state.counters["future_wait_us"] = snapshot.futureWaitNanos / 1e3 / iterations;
+        state.counters["reduce_us"] = snapshot.reduceNanos / 1e3 / iterations;
+        state.counters["imbalance"] = snapshot.imbalance;
+        state.counters["cache_hit_ratio"] = snapshot.CacheHitRatio();
+    }
+}
+
 #ifdef BM_TRANSACTION_CREATION
 static void ParallelTransactionCreationBM(benchmark::State& state)
 {
     const std::size_t amount = std::pow(10, state.range(0));
+    queries::metrics::Reset();
 
     for (auto _ : state)
     {
@@ -23,11 +55,13 @@ static void ParallelTransactionCreationBM(benchmark::State& state)
     const std::size_t numItems = state.iterations() * amount;
     state.SetItemsProcessed(numItems);
     state.SetBytesProcessed(numItems * sizeof(bakery::Transaction));
+    ExportMetrics(state);
 }
 
 static void SequentialTransactionCreationBM(benchmark::State& state)
 {
     const std::size_t amount = std::pow(10, state.range(0));
+    queries::metrics::Reset();
 
     for (auto _ : state)
     {
@@ -42,6 +76,7 @@ static void SequentialTransactionCreationBM(benchmark::State& state)
     const std::size_t numItems = state.iterations() * amount;
     state.SetItemsProcessed(numItems);
     state.SetBytesProcessed(numItems * sizeof(bakery::Transaction));
+    ExportMetrics(state);
 }
 
 BENCHMARK(ParallelTransactionCreationBM)
@@ -53,44 +88,50 @@ BENCHMARK(SequentialTransactionCreationBM)
     ->UseManualTime()->Unit(benchmark::TimeUnit::kMillisecond);
 
 #else
-static const bakery::Database g_database{ 100'000'000, true };
-static const std::array<std::span<const bakery::Transaction>, 7> spans = []()
+// The span sizes the query benchmarks run over (the Span argument indexes into this).
+static const std::array<std::size_t, 7> kSpanSizes = {
+    std::thread::hardware_concurrency(), 1'000, 10'000, 100'000, 1'000'000, 10'000'000, 92'000'000
+};
+
+// The spans grow by a random number of transactions every iteration, so the database needs to hold more
+// than the span itself. Give an 8M element size buffer, because: Iterations = 1M and new elements / iteration = O(8).
+constexpr std::size_t kGrowthBuffer = 8'000'000;
+
+/// <summary>
+/// The database is only built (or read back from the on-disk cache) once a benchmark that needs it runs,
+/// and only as large as the largest span the selected benchmarks run over. Returns nothing while main is
+/// sizing it, when the benchmark has to return straight away.
+/// </summary>
+static const bakery::Database* GetDatabase(benchmark::State& state, std::size_t spanIndex)
 {
-    const auto& transactions = g_database.GetTransactions();
-    return std::array<std::span<const bakery::Transaction>, 7>{
-        std::span{ transactions.cbegin(), std::next(transactions.cbegin(), std::thread::hardware_concurrency()) },
-        std::span{ transactions.cbegin(), std::next(transactions.cbegin(), 1'000) },
-        std::span{ transactions.cbegin(), std::next(transactions.cbegin(), 10'000) },
-        std::span{ transactions.cbegin(), std::next(transactions.cbegin(), 100'000) },
-        std::span{ transactions.cbegin(), std::next(transactions.cbegin(), 1'000'000) },
-        std::span{ transactions.cbegin(), std::next(transactions.cbegin(), 10'000'000) },
-
-        // This span has a weird end range due to the randomly increased number of transactions
-        // in the incremental aggregation benchmarks. Give an 8M element size buffer, because:
-        // Iterations = 1M and new elements / iteration = O(8).
-        std::span{ transactions.cbegin(), std::next(transactions.cbegin(), 92'000'000) }
-    };
-}();
+    return fixtures::GetDatabase(state, kSpanSizes.at(spanIndex) + kGrowthBuffer);
+}
 
 template<typename Derived>
     requires std::derived_from< Derived, queries::QueryStrategies>
 void LeastAndGreatestBM(benchmark::State& state)
 {
-    Derived child{ g_database };
+    const bakery::Database* fixture = GetDatabase(state, state.range(0));
+    if (fixture == nullptr)
+        return;
+
+    const bakery::Database& database = *fixture;
+    Derived child{ database };
     queries::QueryStrategies& query = child;
 
     bakery::detail::Random random;
     std::size_t numTransactions = 0;
 
-    const auto fullSpan = std::span<const bakery::Transaction>(g_database.GetTransactions());
-    const auto& currentSpan = spans.at(state.range(0));
+    const auto fullSpan = std::span<const bakery::Transaction>(database.GetTransactions());
+    queries::metrics::Reset();
+    const std::size_t spanSize = kSpanSizes.at(state.range(0));
 
     for (auto _ : state)
     {
         state.PauseTiming();
 
         numTransactions += random.Value(4, 8);
-        const auto span = fullSpan.subspan(0, currentSpan.size() + numTransactions);
+        const auto span = fullSpan.subspan(0, spanSize + numTransactions);
 
         state.ResumeTiming();
 
@@ -102,29 +143,36 @@ void LeastAndGreatestBM(benchmark::State& state)
         state.SetIterationTime(elapsed.count());
     }
 
-    state.SetItemsProcessed(state.iterations() * currentSpan.size() + numTransactions);
-    state.counters["sample_size"] = currentSpan.size();
+    state.SetItemsProcessed(state.iterations() * spanSize + numTransactions);
+    state.counters["sample_size"] = spanSize;
+    ExportMetrics(state);
 }
 
 template<typename Derived>
     requires std::derived_from< Derived, queries::QueryStrategies>
 void LargestNumberOfPurchasesBM(benchmark::State& state)
 {
-    Derived child{ g_database };
+    const bakery::Database* fixture = GetDatabase(state, state.range(0));
+    if (fixture == nullptr)
+        return;
+
+    const bakery::Database& database = *fixture;
+    Derived child{ database };
     queries::QueryStrategies& query = child;
 
     bakery::detail::Random random;
     std::size_t numTransactions = 0;
 
-    const auto fullSpan = std::span<const bakery::Transaction>(g_database.GetTransactions());
-    const auto& currentSpan = spans.at(state.range(0));
+    const auto fullSpan = std::span<const bakery::Transaction>(database.GetTransactions());
+    queries::metrics::Reset();
+    const std::size_t spanSize = kSpanSizes.at(state.range(0));
 
     for (auto _ : state)
     {
         state.PauseTiming();
 
         numTransactions += random.Value(4, 8);
-        const auto span = fullSpan.subspan(0, currentSpan.size() + numTransactions);
+        const auto span = fullSpan.subspan(0, spanSize + numTransactions);
 
         state.ResumeTiming();
 
@@ -136,29 +184,36 @@ void LargestNumberOfPurchasesBM(benchmark::State& state)
         state.SetIterationTime(elapsed.count());       
     }
 
-    state.SetItemsProcessed(state.iterations() * currentSpan.size() + numTransactions);
-    state.counters["sample_size"] = currentSpan.size();
+    state.SetItemsProcessed(state.iterations() * spanSize + numTransactions);
+    state.counters["sample_size"] = spanSize;
+    ExportMetrics(state);
 }
 
 template<typename Derived>
     requires std::derived_from< Derived, queries::QueryStrategies>
 void NumberOfTransactionsOver15BM(benchmark::State& state)
 {
-    Derived child{ g_database };
+    const bakery::Database* fixture = GetDatabase(state, state.range(0));
+    if (fixture == nullptr)
+        return;
+
+    const bakery::Database& database = *fixture;
+    Derived child{ database };
     queries::QueryStrategies& query = child;
 
     bakery::detail::Random random;
     std::size_t numTransactions = 0;
 
-    const auto fullSpan = std::span<const bakery::Transaction>(g_database.GetTransactions());
-    const auto& currentSpan = spans.at(state.range(0));
+    const auto fullSpan = std::span<const bakery::Transaction>(database.GetTransactions());
+    queries::metrics::Reset();
+    const std::size_t spanSize = kSpanSizes.at(state.range(0));
 
     for (auto _ : state)
     {
         state.PauseTiming();
 
         numTransactions += random.Value(4, 8);
-        const auto span = fullSpan.subspan(0, currentSpan.size() + numTransactions);
+        const auto span = fullSpan.subspan(0, spanSize + numTransactions);
 
         state.ResumeTiming();
         const auto start = std::chrono::high_resolution_clock::now();
@@ -169,27 +224,34 @@ void NumberOfTransactionsOver15BM(benchmark::State& state)
         state.SetIterationTime(elapsed.count());
     }
 
-    state.SetItemsProcessed(state.iterations() * currentSpan.size() + numTransactions);
-    state.counters["sample_size"] = currentSpan.size();
+    state.SetItemsProcessed(state.iterations() * spanSize + numTransactions);
+    state.counters["sample_size"] = spanSize;
+    ExportMetrics(state);
 }
 
 #if defined(BM_CHUNK_SIZE)
 void ChunkSizeBM(benchmark::State& state)
 {
-    queries::MapReduceParallel query{ g_database };
+    const bakery::Database* fixture = GetDatabase(state, 6);
+    if (fixture == nullptr)
+        return;
+
+    const bakery::Database& database = *fixture;
+    queries::MapReduceParallel query{ database };
 
     bakery::detail::Random random;
     std::size_t numTransactions = 0;
 
-    const auto fullSpan = std::span<const bakery::Transaction>(g_database.GetTransactions());
-    const auto& currentSpan = spans.at(6);
+    const auto fullSpan = std::span<const bakery::Transaction>(database.GetTransactions());
+    queries::metrics::Reset();
+    const std::size_t spanSize = kSpanSizes.at(6);
 
     for (auto _ : state)
     {
         state.PauseTiming();
 
         numTransactions += random.Value(4, 8);
-        const auto span = fullSpan.subspan(0, currentSpan.size() + numTransactions);
+        const auto span = fullSpan.subspan(0, spanSize + numTransactions);
 
         state.ResumeTiming();
 
@@ -201,8 +263,9 @@ void ChunkSizeBM(benchmark::State& state)
         state.SetIterationTime(elapsed.count());
     }
 
-    state.SetItemsProcessed(state.iterations() * currentSpan.size() + numTransactions);
-    state.counters["sample_size"] = currentSpan.size();
+    state.SetItemsProcessed(state.iterations() * spanSize + numTransactions);
+    state.counters["sample_size"] = spanSize;
+    ExportMetrics(state);
 }
 
 BENCHMARK(ChunkSizeBM)
@@ -214,6 +277,7 @@ BENCHMARK(ChunkSizeBM)
 //#define BM_MAP_REDUCE_PARALLEL_STD
 #define BM_SEQUENTIAL
 #define BM_SEQUENTIAL_IA
+#define BM_PLANNER
 
 #   if defined(BM_MAP_REDUCE_PARALLEL)
 BENCHMARK_TEMPLATE(LeastAndGreatestBM, queries::MapReduceParallel)
@@ -279,6 +343,49 @@ BENCHMARK_TEMPLATE(NumberOfTransactionsOver15BM, queries::SequentialIA)
     ->UseManualTime()->Unit(benchmark::TimeUnit::kMillisecond)
     ->Iterations(1000000);
 #   endif
+
+#   if defined(BM_PLANNER)
+// The planner goes incremental on these growing spans too, so it's run for as many iterations as SequentialIA
+BENCHMARK_TEMPLATE(LeastAndGreatestBM, queries::Planner)
+    ->DenseRange(0, 6)->ArgName("Span")
+    ->UseManualTime()->Unit(benchmark::TimeUnit::kMillisecond)
+    ->Iterations(1000000);
+
+BENCHMARK_TEMPLATE(LargestNumberOfPurchasesBM, queries::Planner)
+    ->DenseRange(0, 6)->ArgName("Span")
+    ->UseManualTime()->Unit(benchmark::TimeUnit::kMillisecond)
+    ->Iterations(1000000);
+
+BENCHMARK_TEMPLATE(NumberOfTransactionsOver15BM, queries::Planner)
+    ->DenseRange(0, 6)->ArgName("Span")
+    ->UseManualTime()->Unit(benchmark::TimeUnit::kMillisecond)
+    ->Iterations(1000000);
+#   endif
+#endif
+
+int main(int argc, char** argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+#ifndef BM_TRANSACTION_CREATION
+    // Builds (or reads back) only the largest database the selected benchmarks need, once
+    fixtures::SizeSelectedBenchmarks();
 #endif
 
-BENCHMARK_MAIN();
+    // Record a timeline of the whole run when a trace path is given
+    const char* tracePath = std::getenv("MONOID_TRACE");
+    if (tracePath != nullptr)
+        queries::trace::Start();
+
+    benchmark::RunSpecifiedBenchmarks();
+
+    if (tracePath != nullptr)
+    {
+        queries::trace::Stop();
+        queries::trace::WriteChromeTrace(std::filesystem::path{ tracePath });
+    }
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include "fixtures.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+// Set while SizeSelectedBenchmarks runs, when benchmarks only record the database they'd ask for
+bool g_sizing = false;
+
+// The largest database the selected benchmarks ask for, which every request is rounded up to
+std::size_t g_plannedSize = 0;
+
+// Swallows the sizing run's output, which is nothing worth reading
+class SilentReporter : public benchmark::BenchmarkReporter
+{
+public:
+    SilentReporter() { SetOutputStream(&m_discard); SetErrorStream(&m_discard); }
+
+    virtual bool ReportContext(const Context&) override { return true; }
+    virtual void ReportRuns(const std::vector<Run>&) override {}
+
+private:
+    std::ostringstream m_discard;
+};
+
+std::filesystem::path GetSnapshotPath(std::size_t size)
+{
+    return fixtures::GetCacheDirectory() /
+        ("transactions-" + std::to_string(bakery::GetGenerationSeed()) + "-" + std::to_string(size) + ".bin");
+}
+
+/// <summary>
+/// Finds the smallest cached snapshot, generated with the current seed, that holds at least minimumSize transactions.
+/// </summary>
+std::optional<std::filesystem::path> FindSnapshot(std::size_t minimumSize)
+{
+    std::error_code error;
+    if (!std::filesystem::is_directory(fixtures::GetCacheDirectory(), error))
+        return std::nullopt;
+
+    const std::regex pattern{ "transactions-" + std::to_string(bakery::GetGenerationSeed()) + "-([0-9]+)\\.bin" };
+
+    std::optional<std::filesystem::path> best;
+    std::size_t bestSize = 0;
+
+    for (const auto& entry : std::filesystem::directory_iterator(fixtures::GetCacheDirectory(), error))
+    {
+        std::smatch match;
+        const std::string fileName = entry.path().filename().string();
+
+        if (!std::regex_match(fileName, match, pattern))
+            continue;
+
+        const std::size_t size = std::stoull(match[1].str());
+        if (size >= minimumSize && (!best || size < bestSize))
+        {
+            best = entry.path();
+            bestSize = size;
+        }
+    }
+
+    return best;
+}
+
+// Drops the cached snapshots smaller than the one just written, as they're all prefixes of it
+void RemoveSmallerSnapshots(std::size_t size)
+{
+    std::error_code error;
+    const std::regex pattern{ "transactions-" + std::to_string(bakery::GetGenerationSeed()) + "-([0-9]+)\\.bin" };
+
+    for (const auto& entry : std::filesystem::directory_iterator(fixtures::GetCacheDirectory(), error))
+    {
+        std::smatch match;
+        const std::string fileName = entry.path().filename().string();
+
+        if (std::regex_match(fileName, match, pattern) && std::stoull(match[1].str()) < size)
+            std::filesystem::remove(entry.path(), error);
+    }
+}
+} // end unnamed namespace
+
+namespace fixtures
+{
+std::filesystem::path GetCacheDirectory()
+{
+    if (const char* directory = std::getenv("MONOID_FIXTURE_DIR"))
+        return directory;
+
+    return std::filesystem::temp_directory_path() / "monoid-fixtures";
+}
+
+const bakery::Database& GetDatabase(std::size_t minimumSize)
+{
+    static std::unique_ptr<bakery::Database> database;
+    minimumSize = std::max(minimumSize, g_plannedSize);
+
+    if (database && database->Size() >= minimumSize)
+        return *database;
+
+    // Release the smaller database first, there's no need to hold both in memory
+    database.reset();
+    database = std::make_unique<bakery::Database>();
+
+    if (const auto snapshot = FindSnapshot(minimumSize))
+    {
+        if (database->LoadSnapshot(*snapshot, minimumSize) && database->Size() == minimumSize)
+            return *database;
+
+        std::cerr << "Ignoring unreadable fixture snapshot " << *snapshot << "\n";
+    }
+
+    // Sequential generation is deterministic, and a prefix of any larger run, which parallel generation isn't
+    database = std::make_unique<bakery::Database>(minimumSize);
+
+    std::error_code error;
+    std::filesystem::create_directories(GetCacheDirectory(), error);
+
+    // Write to a temporary first, so an interrupted run never leaves a truncated snapshot behind
+    const std::filesystem::path snapshot = GetSnapshotPath(minimumSize);
+    std::filesystem::path temporary = snapshot;
+    temporary += ".tmp";
+
+    if (database->SaveSnapshot(temporary))
+        std::filesystem::rename(temporary, snapshot, error);
+    else
+        error = std::make_error_code(std::errc::io_error);
+
+    if (error)
+    {
+        std::filesystem::remove(temporary, error);
+        std::cerr << "Unable to cache the fixture snapshot in " << GetCacheDirectory() << "\n";
+    }
+    else
+    {
+        RemoveSmallerSnapshots(minimumSize);
+    }
+
+    return *database;
+}
+
+const bakery::Database* GetDatabase(benchmark::State& state, std::size_t minimumSize)
+{
+    if (!g_sizing)
+        return &GetDatabase(minimumSize);
+
+    g_plannedSize = std::max(g_plannedSize, minimumSize);
+    state.SkipWithError("Sizing the fixture");
+
+    return nullptr;
+}
+
+void SizeSelectedBenchmarks()
+{
+    SilentReporter reporter;
+
+    // A file reporter is made for --benchmark_out if there is one, and the real run writes over what it writes
+    g_sizing = true;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    g_sizing = false;
+}
+} // end fixtures namespace
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "bakery.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <filesystem>
+
+namespace fixtures
+{
+/// <summary>
+/// Returns a database holding at least the given number of transactions. Nothing is built until a benchmark
+/// asks for it, and whatever is built is cached on disk as a binary snapshot keyed by the generation seed and
+/// size, so later runs only pay for reading it back (only the requested prefix of a larger snapshot is read).
+/// Transactions are generated sequentially from the seed, so a smaller database is always a prefix of a larger
+/// one, and a benchmark sees the same rows whichever snapshot they came from.
+///
+/// Once SizeSelectedBenchmarks has run, every request is rounded up to the largest one the selected benchmarks
+/// make, so that one database is built (or read back) once and the smaller spans are prefixes of it.
+///
+/// The returned reference stays valid until a later call asks for more transactions than it holds.
+/// </summary>
+const bakery::Database& GetDatabase(std::size_t minimumSize);
+
+/// <summary>
+/// The same, for a benchmark that may be being sized. While SizeSelectedBenchmarks runs, this records the
+/// size, skips the benchmark and returns nothing, and the benchmark has to return without running.
+/// </summary>
+const bakery::Database* GetDatabase(benchmark::State& state, std::size_t minimumSize);
+
+/// <summary>
+/// Runs the benchmarks the command line selected once, without timing or reporting them, only to record the
+/// largest database they ask for. Call it after benchmark::Initialize and before benchmark::RunSpecifiedBenchmarks.
+/// </summary>
+void SizeSelectedBenchmarks();
+
+/// <summary>
+/// Where snapshots are cached. Defaults to a monoid-fixtures folder in the temp directory, and can be moved
+/// with the MONOID_FIXTURE_DIR environment variable.
+/// </summary>
+std::filesystem::path GetCacheDirectory();
+} // end fixtures namespace
@@ -0,0 +1,485 @@
+#include "bakery.h"
+#include "compression.h"
+#include "groupby.h"
+#include "outofcore.h"
+#include "queries.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <iterator>
+#include <memory_resource>
+#include <new>
+#include <sstream>
+#include <vector>
+
+/// <summary>
+/// Microbenchmarks for the building blocks the queries are made of, so a regression can be pinned on a
+/// single kernel rather than on a whole query. Every benchmark reports items / second, and the number of
+/// heap allocations made per item, which are counted by replacing the global allocation functions below.
+/// </summary>
+namespace
+{
+std::atomic<std::uint64_t> g_allocations = 0;
+
+constexpr std::size_t kRows = 1 << 16;
+
+const bakery::TransactionVector& GetTransactions()
+{
+    static const bakery::TransactionVector transactions = bakery::GenerateTransactionsSequential(kRows);
+    return transactions;
+}
+
+/// <summary>
+/// Snapshots the allocation count when the benchmark starts, and reports the allocations made per item
+/// once it's done (setup done between the two is counted too, so keep it out of the timed loop's scope).
+/// </summary>
+class AllocationCounter
+{
+public:
+    AllocationCounter() : m_start(g_allocations.load(std::memory_order_relaxed)) {}
+
+    void Report(benchmark::State& state, std::size_t itemsPerIteration) const
+    {
+        const std::uint64_t items = state.iterations() * itemsPerIteration;
+        const std::uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - m_start;
+
+        state.SetItemsProcessed(items);
+        state.counters["allocs_per_item"] = items == 0 ? 0.0 : static_cast<double>(allocations) / items;
+    }
+
+private:
+    std::uint64_t m_start = 0;
+};
+
+void GetPurchasesBM(benchmark::State& state)
+{
+    const auto& transactions = GetTransactions();
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        for (const bakery::Transaction& transaction : transactions)
+            benchmark::DoNotOptimize(transaction.GetPurchases());
+    }
+
+    counter.Report(state, transactions.size());
+}
+
+void GetFoodBM(benchmark::State& state)
+{
+    const bakery::Database database;
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        for (int foodID = 0; foodID < 27; ++foodID)
+            benchmark::DoNotOptimize(database.GetFood(foodID));
+    }
+
+    counter.Report(state, 27);
+}
+
+void ChunkBM(benchmark::State& state)
+{
+    const auto span = std::span<const bakery::Transaction>(GetTransactions());
+    const auto numChunks = static_cast<std::size_t>(state.range(0));
+
+    std::vector<std::span<const bakery::Transaction>> chunks;
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        queries::detail::Chunk(span, numChunks, chunks);
+        benchmark::DoNotOptimize(chunks.data());
+    }
+
+    counter.Report(state, numChunks);
+}
+
+template<typename Query>
+void MapReduceBM(benchmark::State& state)
+{
+    const bakery::Database database;
+    const Query query{ database };
+    const auto span = std::span<const bakery::Transaction>(GetTransactions());
+
+    AllocationCounter counter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(queries::detail::MapReduce(span, queries::detail::Mapper(query), queries::detail::Reducer<Query>()));
+
+    counter.Report(state, span.size());
+}
+
+// The co-purchase matrix built a pair at a time, to compare against the bit-sliced MapReduceBM<CoPurchaseQuery>
+void CoPurchasePairLoopBM(benchmark::State& state)
+{
+    const auto& transactions = GetTransactions();
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        queries::CoPurchaseMatrix matrix;
+        for (const bakery::Transaction& transaction : transactions)
+            matrix.Add(static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+
+        benchmark::DoNotOptimize(matrix);
+    }
+
+    counter.Report(state, transactions.size());
+}
+
+void FilteredRevenueBM(benchmark::State& state)
+{
+    using namespace queries::predicates;
+    using Query = queries::FilteredQuery<queries::RevenueQuery>;
+
+    const bakery::Database database;
+    const Query query{ database, (ContainsAny({ 17, 18, 19 }) && GratuityAbove(0.15)) || TotalBetween(0.0, 3.0) };
+    const auto span = std::span<const bakery::Transaction>(GetTransactions());
+
+    AllocationCounter counter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(queries::detail::MapReduce(span, queries::detail::Mapper(query), queries::detail::Reducer<Query>()));
+
+    counter.Report(state, span.size());
+}
+
+template<typename Selector>
+void GroupByBM(benchmark::State& state)
+{
+    const bakery::Database database;
+    const Selector selector = [&database]() {
+        if constexpr (std::is_constructible_v<Selector, const bakery::Database&>)
+            return Selector{ database };
+        else if constexpr (std::is_same_v<Selector, queries::groupby::ByOrderBucket>)
+            return Selector{ 1024, kRows / 1024 };
+        else
+            return Selector{};
+    }();
+
+    const queries::groupby::Count count;
+    const auto span = std::span<const bakery::Transaction>(GetTransactions());
+
+    AllocationCounter counter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(queries::groupby::GroupBy(span, selector, count));
+
+    counter.Report(state, span.size());
+}
+
+// Counts the transactions containing the first state.range(0) of a few items, through the index or by scanning
+const std::vector<int> kIndexedItems = { 18, 20, 3 };
+
+void ItemIndexCountBM(benchmark::State& state)
+{
+    const auto& transactions = GetTransactions();
+    const std::span<const int> foodIDs{ kIndexedItems.data(), static_cast<std::size_t>(state.range(0)) };
+
+    bakery::ItemIndex index;
+    index.Append(transactions);
+
+    AllocationCounter counter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(index.CountAll(foodIDs, 0, index.Size()));
+
+    counter.Report(state, transactions.size());
+}
+
+void ItemScanCountBM(benchmark::State& state)
+{
+    const auto& transactions = GetTransactions();
+
+    std::uint32_t mask = 0;
+    for (int foodID : std::span{ kIndexedItems }.first(state.range(0)))
+        mask |= std::uint32_t{ 1 } << foodID;
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        std::int64_t count = 0;
+        for (const bakery::Transaction& transaction : transactions)
+            count += (static_cast<std::uint32_t>(transaction.purchases.to_ulong()) & mask) == mask;
+
+        benchmark::DoNotOptimize(count);
+    }
+
+    counter.Report(state, transactions.size());
+}
+
+void SelectBM(benchmark::State& state)
+{
+    const auto& foods = bakery::GenerateFoods();
+    bakery::detail::Random random{ bakery::GetGenerationSeed() };
+
+    AllocationCounter counter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bakery::detail::Select(bakery::FoodType::eBeverage, foods, random));
+
+    counter.Report(state, 1);
+}
+
+void GenerateTicketBM(benchmark::State& state)
+{
+    const auto& foods = bakery::GenerateFoods();
+    bakery::detail::Random random{ bakery::GetGenerationSeed() };
+
+    AllocationCounter counter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bakery::detail::GenerateTicket(foods, random));
+
+    counter.Report(state, 1);
+}
+
+void WriteTransactionsCsvBM(benchmark::State& state)
+{
+    const auto& transactions = GetTransactions();
+    std::ostringstream stream;
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        stream.str({});
+        for (const bakery::Transaction& transaction : transactions)
+            stream << transaction;
+
+        benchmark::DoNotOptimize(stream.tellp());
+    }
+
+    counter.Report(state, transactions.size());
+}
+
+void ReadTransactionsCsvBM(benchmark::State& state)
+{
+    const auto& transactions = GetTransactions();
+
+    std::ostringstream source;
+    for (const bakery::Transaction& transaction : transactions)
+        source << transaction;
+
+    const std::string csv = source.str();
+    std::vector<bakery::Transaction> parsed;
+    parsed.reserve(transactions.size());
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        std::istringstream stream{ csv };
+
+        parsed.clear();
+        std::copy(std::istream_iterator<bakery::Transaction>(stream), std::istream_iterator<bakery::Transaction>(),
+                  std::back_inserter(parsed));
+
+        benchmark::DoNotOptimize(parsed.data());
+    }
+
+    counter.Report(state, transactions.size());
+}
+
+/// <summary>
+/// A full scan over far more rows than the TLB covers with 4KB pages, stored with each huge page mode.
+/// </summary>
+void TransactionScanBM(benchmark::State& state)
+{
+    constexpr std::size_t kScanRows = 1 << 22;
+
+    const bakery::HugePages original = bakery::GetHugePages();
+    bakery::SetHugePages(static_cast<bakery::HugePages>(state.range(0)));
+    const bakery::TransactionVector transactions = bakery::GenerateTransactionsParallel(kScanRows);
+    bakery::SetHugePages(original);
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        std::size_t items = 0;
+        for (const bakery::Transaction& transaction : transactions)
+            items += transaction.purchases.count();
+
+        benchmark::DoNotOptimize(items);
+    }
+
+    counter.Report(state, transactions.size());
+}
+
+// Building and tearing down the purchase mapping, with node allocations from the heap (0) or an arena (1)
+void PurchaseMappingBM(benchmark::State& state)
+{
+    const auto& transactions = GetTransactions();
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        if (state.range(0) == 0)
+        {
+            benchmark::DoNotOptimize(bakery::GeneratePurchaseMapping(transactions).size());
+        }
+        else
+        {
+            std::pmr::monotonic_buffer_resource arena{ bakery::GetHugePageResource() };
+            benchmark::DoNotOptimize(bakery::GeneratePurchaseMapping(transactions, &arena).size());
+        }
+    }
+
+    counter.Report(state, transactions.size());
+}
+
+/// <summary>
+/// Streams a snapshot through a cheap query a block at a time, with the given memory budget in MB. The file
+/// will mostly be in the page cache, so this measures the pipeline's own ceiling rather than the disk's.
+/// </summary>
+void OutOfCoreRevenueBM(benchmark::State& state)
+{
+    const std::filesystem::path snapshot = std::filesystem::temp_directory_path() / "outofcore-kernel.bin";
+    bakery::SaveSnapshot(bakery::GenerateTransactionsParallel(1 << 22), snapshot);
+
+    queries::outofcore::OutOfCoreExecutor executor{ snapshot, static_cast<std::size_t>(state.range(0)) << 20 };
+
+    AllocationCounter counter;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(executor.Run<queries::RevenueQuery>());
+
+    counter.Report(state, executor.Size());
+    state.SetBytesProcessed(state.iterations() * executor.Size() * sizeof(bakery::TransactionRecord));
+
+    std::filesystem::remove(snapshot);
+}
+
+// Decoding one compressed block into transactions, with exact (0) or quantized (1) gratuity
+void DecodeBlockBM(benchmark::State& state)
+{
+    const auto& transactions = GetTransactions();
+
+    std::vector<std::byte> block;
+    bakery::EncodeBlock(transactions, { .gratuityStep = state.range(0) == 0 ? 0.0 : 1e-4 }, block);
+
+    std::vector<bakery::Transaction> decoded(transactions.size());
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bakery::DecodeBlock(block, decoded));
+        benchmark::ClobberMemory();
+    }
+
+    counter.Report(state, transactions.size());
+    state.counters["bytes_per_row"] = static_cast<double>(block.size()) / transactions.size();
+}
+
+// A query over one compressed block, decoded into rows and mapped (0) or mapped from its columns (1)
+template<typename Query>
+void MapBlockBM(benchmark::State& state)
+{
+    const bakery::Database database;
+    const Query query{ database };
+    const auto& transactions = GetTransactions();
+
+    std::vector<std::byte> block;
+    bakery::EncodeBlock(transactions, {}, block);
+
+    std::vector<bakery::Transaction> decoded(transactions.size());
+
+    AllocationCounter counter;
+    for (auto _ : state)
+    {
+        if (state.range(0) == 0)
+        {
+            bakery::DecodeBlock(block, decoded);
+            benchmark::DoNotOptimize(queries::detail::MapReduce(std::span<const bakery::Transaction>{ decoded }, queries::detail::Mapper(query),
+                                                                queries::detail::Reducer<Query>()));
+        }
+        else
+        {
+            benchmark::DoNotOptimize(query.MapBlock(bakery::CompressedBlockView{ block }));
+        }
+    }
+
+    counter.Report(state, transactions.size());
+}
+} // end unnamed namespace
+
+// The counting replacements for the global allocation functions. They pair malloc with free, which GCC can't see
+// through once they're inlined into each other, so it reports them as mismatched. Aligned new isn't replaced, so
+// over-aligned allocations aren't counted.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+#pragma GCC diagnostic pop
+
+BENCHMARK(GetPurchasesBM);
+BENCHMARK(GetFoodBM);
+BENCHMARK(ChunkBM)->RangeMultiplier(8)->Range(1, 4096)->ArgName("Chunks");
+
+BENCHMARK_TEMPLATE(MapReduceBM, queries::PopularItemsQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::TransactionsOver15Query);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::LargestPurchaseQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::RevenueQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::GratuityQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::AverageTicketQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::TicketDistributionQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::TicketTotalQuantilesQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::TopItemsQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::TopBasketsQuery);
+BENCHMARK_TEMPLATE(MapReduceBM, queries::CoPurchaseQuery);
+BENCHMARK(CoPurchasePairLoopBM);
+BENCHMARK(FilteredRevenueBM);
+
+BENCHMARK_TEMPLATE(GroupByBM, queries::groupby::ByFoodID);
+BENCHMARK_TEMPLATE(GroupByBM, queries::groupby::ByFoodType);
+BENCHMARK_TEMPLATE(GroupByBM, queries::groupby::ByBasketSize);
+BENCHMARK_TEMPLATE(GroupByBM, queries::groupby::ByOrderBucket);
+
+BENCHMARK(ItemIndexCountBM)->DenseRange(1, 3)->ArgName("Items");
+BENCHMARK(ItemScanCountBM)->DenseRange(1, 3)->ArgName("Items");
+
+BENCHMARK(SelectBM);
+BENCHMARK(GenerateTicketBM);
+
+BENCHMARK(TransactionScanBM)->DenseRange(0, 2)->ArgName("HugePages");
+BENCHMARK(PurchaseMappingBM)->DenseRange(0, 1)->ArgName("Arena");
+
+BENCHMARK(DecodeBlockBM)->DenseRange(0, 1)->ArgName("Quantized");
+BENCHMARK_TEMPLATE(MapBlockBM, queries::PopularItemsQuery)->DenseRange(0, 1)->ArgName("Columns");
+BENCHMARK_TEMPLATE(MapBlockBM, queries::TicketDistributionQuery)->DenseRange(0, 1)->ArgName("Columns");
+BENCHMARK(OutOfCoreRevenueBM)->RangeMultiplier(4)->Range(1, 64)->ArgName("BudgetMB");
+
+BENCHMARK(WriteTransactionsCsvBM);
+BENCHMARK(ReadTransactionsCsvBM);
+
+BENCHMARK_MAIN();
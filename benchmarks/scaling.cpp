@@ -0,0 +1,332 @@
+#include "bakery.h"
+#include "fixtures.h"
+#include "queries.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// These benchmarks sweep the thread count for every strategy, and compare the queries against a STREAM style
+/// bandwidth baseline, to see how close each query gets to the memory roofline of the host.
+///
+/// Every benchmark reports rows / second (items_per_second), bytes / second and a GBps counter, along with the
+/// thread count it ran with, so plot.py --scaling can draw the scaling curves.
+/// </summary>
+namespace
+{
+// The working sets: one that comfortably fits in the last level cache, and one that's well out of it.
+constexpr std::size_t kCacheResidentRows = 1 << 16;
+constexpr std::size_t kStreamingRows = 1 << 24;
+
+// Elements per STREAM array. Three of these are in flight for add / triad (384 MB in total).
+constexpr std::size_t kStreamElements = 1 << 24;
+
+// Each thread's partial result sits on its own cache line, so the scans don't false share
+constexpr std::size_t kPartialStride = 64 / sizeof(std::uint64_t);
+
+enum WorkingSet : int
+{
+    eCacheResident,
+    eStreaming
+};
+
+const bakery::Database& GetDatabase()
+{
+    return fixtures::GetDatabase(kStreamingRows);
+}
+
+std::span<const bakery::Transaction> GetWorkingSet(int workingSet)
+{
+    const auto transactions = std::span<const bakery::Transaction>(GetDatabase().GetTransactions());
+    return workingSet == eCacheResident ? transactions.first(kCacheResidentRows) : transactions;
+}
+
+std::vector<int> ThreadCounts()
+{
+    const int hardwareThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    std::vector<int> counts;
+    for (int count = 1; count < hardwareThreads; count *= 2)
+        counts.push_back(count);
+
+    counts.push_back(hardwareThreads);
+    return counts;
+}
+
+void ScalingArguments(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgNames({ "Threads", "WorkingSet" });
+    for (int workingSet : { eCacheResident, eStreaming })
+    {
+        for (int threads : ThreadCounts())
+            benchmark->Args({ threads, workingSet });
+    }
+}
+
+void StreamArguments(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgName("Threads");
+    for (int threads : ThreadCounts())
+        benchmark->Arg(threads);
+}
+
+void FixedThreadArguments(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgNames({ "Threads", "WorkingSet" });
+    for (int workingSet : { eCacheResident, eStreaming })
+        benchmark->Args({ 1, workingSet });
+}
+
+void HardwareThreadArguments(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgNames({ "Threads", "WorkingSet" });
+    for (int workingSet : { eCacheResident, eStreaming })
+        benchmark->Args({ static_cast<int>(std::thread::hardware_concurrency()), workingSet });
+}
+
+void ReportThroughput(benchmark::State& state, std::size_t rows, std::size_t bytes)
+{
+    state.SetItemsProcessed(state.iterations() * rows);
+    state.SetBytesProcessed(state.iterations() * bytes);
+
+    state.counters["thread_count"] = static_cast<double>(state.range(0));
+    state.counters["GBps"] = benchmark::Counter(state.iterations() * bytes / 1e9, benchmark::Counter::kIsRate);
+}
+
+/// <summary>
+/// Only the thread pool strategy can be sized. The sequential ones always run on one thread, and the
+/// standard library's parallel algorithms pick their own.
+/// </summary>
+template<typename Derived>
+Derived MakeStrategy(const bakery::Database& database, std::size_t threads)
+{
+    if constexpr (std::is_constructible_v<Derived, const bakery::Database&, std::size_t>)
+        return Derived{ database, threads };
+    else
+        return Derived{ database };
+}
+
+/// <summary>
+/// The incremental strategy would serve every iteration after the first from its cache, so it's rebuilt each
+/// iteration to measure its cold scan instead.
+/// </summary>
+template<typename Derived, typename Query>
+void RunQueryScaling(benchmark::State& state, Query query)
+{
+    const auto span = GetWorkingSet(static_cast<int>(state.range(1)));
+
+    if constexpr (std::is_same_v<Derived, queries::SequentialIA>)
+    {
+        for (auto _ : state)
+        {
+            Derived strategy{ GetDatabase() };
+            benchmark::DoNotOptimize(query(strategy, span));
+        }
+    }
+    else
+    {
+        Derived strategy = MakeStrategy<Derived>(GetDatabase(), state.range(0));
+        for (auto _ : state)
+            benchmark::DoNotOptimize(query(strategy, span));
+    }
+
+    ReportThroughput(state, span.size(), span.size_bytes());
+}
+
+template<typename Derived>
+void LeastAndGreatestScalingBM(benchmark::State& state)
+{
+    RunQueryScaling<Derived>(state, [](queries::QueryStrategies& strategy, const auto& span) {
+        return strategy.GetGreatestAndLeastPopularItems(span);
+    });
+}
+
+template<typename Derived>
+void LargestNumberOfPurchasesScalingBM(benchmark::State& state)
+{
+    RunQueryScaling<Derived>(state, [](queries::QueryStrategies& strategy, const auto& span) {
+        return strategy.GetLargestNumberOfPurachasesMade(span);
+    });
+}
+
+template<typename Derived>
+void NumberOfTransactionsOver15ScalingBM(benchmark::State& state)
+{
+    RunQueryScaling<Derived>(state, [](queries::QueryStrategies& strategy, const auto& span) {
+        return strategy.GetNumberOfTransactionsOver15(span);
+    });
+}
+
+/// <summary>
+/// Runs the kernel over every element index in parallel, split into one chunk per thread, on a pool that's
+/// kept alive for the whole benchmark. The kernel is given its chunk index, and the [begin, end) of its chunk.
+/// </summary>
+template<typename Kernel>
+void RunChunked(ThreadPool& pool, std::size_t threads, std::size_t count, Kernel kernel)
+{
+    std::vector<std::future<void>> futures;
+    const std::size_t chunkSize = (count + threads - 1) / threads;
+
+    for (std::size_t chunk = 0; chunk * chunkSize < count; ++chunk)
+    {
+        const std::size_t begin = chunk * chunkSize;
+        futures.push_back(pool.Run([=]() { kernel(chunk, begin, std::min(begin + chunkSize, count)); }));
+    }
+
+    for (auto& future : futures)
+        future.get();
+}
+
+enum class StreamKernel
+{
+    eCopy,
+    eScale,
+    eAdd,
+    eTriad
+};
+
+/// <summary>
+/// The four STREAM kernels (https://www.cs.virginia.edu/stream/). Bytes are counted the way STREAM does, as
+/// the arrays read plus the array written, so the results are comparable with published figures.
+/// </summary>
+template<StreamKernel Kernel>
+void StreamBM(benchmark::State& state)
+{
+    const auto threads = static_cast<std::size_t>(state.range(0));
+    ThreadPool pool{ threads };
+
+    std::vector<double> a(kStreamElements, 1.0);
+    std::vector<double> b(kStreamElements, 2.0);
+    std::vector<double> c(kStreamElements, 0.0);
+    constexpr double scalar = 3.0;
+
+    for (auto _ : state)
+    {
+        RunChunked(pool, threads, kStreamElements, [&](std::size_t, std::size_t begin, std::size_t end) {
+            for (std::size_t index = begin; index < end; ++index)
+            {
+                if constexpr (Kernel == StreamKernel::eCopy)
+                    c[index] = a[index];
+                else if constexpr (Kernel == StreamKernel::eScale)
+                    b[index] = scalar * c[index];
+                else if constexpr (Kernel == StreamKernel::eAdd)
+                    c[index] = a[index] + b[index];
+                else
+                    a[index] = b[index] + scalar * c[index];
+            }
+        });
+
+        benchmark::ClobberMemory();
+    }
+
+    constexpr std::size_t arrays = Kernel == StreamKernel::eCopy || Kernel == StreamKernel::eScale ? 2 : 3;
+    ReportThroughput(state, kStreamElements, arrays * kStreamElements * sizeof(double));
+}
+
+/// <summary>
+/// The same trivial scan (a popcount of every basket) over two data layouts: the array of Transaction structs
+/// the queries read, and a column of just the purchase masks. The gap between the two is the bandwidth spent
+/// dragging order numbers and gratuity through the cache for queries that never look at them.
+/// </summary>
+void TransactionLayoutBM(benchmark::State& state)
+{
+    const auto threads = static_cast<std::size_t>(state.range(0));
+    const auto span = GetWorkingSet(static_cast<int>(state.range(1)));
+    ThreadPool pool{ threads };
+
+    std::vector<std::uint64_t> partials(threads * kPartialStride);
+    for (auto _ : state)
+    {
+        RunChunked(pool, threads, span.size(), [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+            std::uint64_t count = 0;
+            for (std::size_t index = begin; index < end; ++index)
+                count += span[index].purchases.count();
+
+            partials[chunk * kPartialStride] = count;
+        });
+
+        benchmark::DoNotOptimize(partials.data());
+    }
+
+    ReportThroughput(state, span.size(), span.size_bytes());
+}
+
+void MaskColumnLayoutBM(benchmark::State& state)
+{
+    const auto threads = static_cast<std::size_t>(state.range(0));
+    const auto span = GetWorkingSet(static_cast<int>(state.range(1)));
+    ThreadPool pool{ threads };
+
+    std::vector<std::uint32_t> masks(span.size());
+    std::ranges::transform(span, masks.begin(), [](const bakery::Transaction& transaction) {
+        return static_cast<std::uint32_t>(transaction.purchases.to_ulong());
+    });
+
+    std::vector<std::uint64_t> partials(threads * kPartialStride);
+    for (auto _ : state)
+    {
+        RunChunked(pool, threads, masks.size(), [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+            std::uint64_t count = 0;
+            for (std::size_t index = begin; index < end; ++index)
+                count += std::popcount(masks[index]);
+
+            partials[chunk * kPartialStride] = count;
+        });
+
+        benchmark::DoNotOptimize(partials.data());
+    }
+
+    ReportThroughput(state, masks.size(), masks.size() * sizeof(std::uint32_t));
+}
+} // end unnamed namespace
+
+BENCHMARK_TEMPLATE(StreamBM, StreamKernel::eCopy)
+    ->Apply(StreamArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK_TEMPLATE(StreamBM, StreamKernel::eScale)
+    ->Apply(StreamArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK_TEMPLATE(StreamBM, StreamKernel::eAdd)
+    ->Apply(StreamArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK_TEMPLATE(StreamBM, StreamKernel::eTriad)
+    ->Apply(StreamArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK(TransactionLayoutBM)->Apply(ScalingArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK(MaskColumnLayoutBM)->Apply(ScalingArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK_TEMPLATE(LeastAndGreatestScalingBM, queries::MapReduceParallel)
+    ->Apply(ScalingArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK_TEMPLATE(LargestNumberOfPurchasesScalingBM, queries::MapReduceParallel)
+    ->Apply(ScalingArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK_TEMPLATE(NumberOfTransactionsOver15ScalingBM, queries::MapReduceParallel)
+    ->Apply(ScalingArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK_TEMPLATE(LeastAndGreatestScalingBM, queries::MapReduceParallelStd)
+    ->Apply(HardwareThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK_TEMPLATE(LargestNumberOfPurchasesScalingBM, queries::MapReduceParallelStd)
+    ->Apply(HardwareThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK_TEMPLATE(NumberOfTransactionsOver15ScalingBM, queries::MapReduceParallelStd)
+    ->Apply(HardwareThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK_TEMPLATE(LeastAndGreatestScalingBM, queries::Sequential)
+    ->Apply(FixedThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK_TEMPLATE(LargestNumberOfPurchasesScalingBM, queries::Sequential)
+    ->Apply(FixedThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK_TEMPLATE(NumberOfTransactionsOver15ScalingBM, queries::Sequential)
+    ->Apply(FixedThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK_TEMPLATE(LeastAndGreatestScalingBM, queries::SequentialIA)
+    ->Apply(FixedThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK_TEMPLATE(LargestNumberOfPurchasesScalingBM, queries::SequentialIA)
+    ->Apply(FixedThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+BENCHMARK_TEMPLATE(NumberOfTransactionsOver15ScalingBM, queries::SequentialIA)
+    ->Apply(FixedThreadArguments)->UseRealTime()->Unit(benchmark::TimeUnit::kMillisecond);
+
+BENCHMARK_MAIN();
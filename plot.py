@@ -93,6 +93,87 @@ def create_and_serialize_chart(iterable, title, file_name):
     fig.savefig(f"{file_name}.png", dpi = 100)
 
 
+def decompose_scaling_name(benchmark_name):
+    """Extracts the benchmark name, template argument and working set from a scaling run name"""
+    match = re.match(r'(\w+)(?:<(?:\w+::)*(\w+)>)?', benchmark_name)
+    working_set = re.search(r'WorkingSet:(\d+)', benchmark_name)
+
+    name, argument = match.groups()
+    return name, argument or '', int(working_set.group(1)) if working_set else None
+
+
+def create_scaling_datasets(benchmark_data, metric):
+    """Groups the thread-scaling results into one data set per benchmark / strategy / working set"""
+    datasets = {}
+
+    for benchmark in benchmark_data:
+        if 'thread_count' not in benchmark:
+            continue
+
+        name, argument, working_set = decompose_scaling_name(benchmark['name'])
+        key = (name, argument, working_set)
+
+        dataset = datasets.setdefault(key, DataSet(name, argument, [], [], [], benchmark['time_unit']))
+        dataset.x.append(benchmark['thread_count'])
+        dataset.y.append(benchmark[metric])
+        dataset.times.append(benchmark['real_time'])
+
+    return datasets
+
+
+def create_and_serialize_scaling_chart(datasets, title, ylabel, file_name, baselines=()):
+    """Plots throughput against thread count, with the bandwidth baselines drawn as dashed lines"""
+    fig, axis = plt.subplots()
+    fig.set_size_inches(8, 4.5)
+    line_formats = ['o-', 's-', 'd-', '^-']
+
+    for index, ((name, argument, working_set), dataset) in enumerate(sorted(datasets.items())):
+        label = f'{name} {argument}'.strip()
+        if working_set is not None:
+            label += ' (cache)' if working_set == 0 else ' (memory)'
+
+        axis.plot(dataset.x, dataset.y, line_formats[index % len(line_formats)], label=label)
+
+    for (name, argument, _), dataset in sorted(baselines):
+        axis.plot(dataset.x, dataset.y, '--', label=f'STREAM {argument}'.strip())
+
+    axis.legend(fontsize='x-small')
+    axis.set(xscale='log', yscale='log')
+    axis.set_xscale('log', base=2)
+
+    axis.set(xlabel='Threads', ylabel=ylabel, title=title)
+    axis.grid()
+
+    fig.savefig(f"{file_name}.png", dpi = 100)
+
+
+def plot_scaling(benchmark_data):
+    """Renders the thread-scaling charts: rows / second per query, and GB/s against the STREAM roofline"""
+    rows = create_scaling_datasets(benchmark_data, 'items_per_second')
+    bandwidth = create_scaling_datasets(benchmark_data, 'GBps')
+
+    streams = [(key, dataset) for key, dataset in bandwidth.items() if key[0] == 'StreamBM']
+
+    def is_query(key):
+        return 'Scaling' in key[0]
+
+    def is_layout(key):
+        return 'Layout' in key[0]
+
+    queries = [('LeastAndGreatest', 'q1'), ('LargestNumberOfPurchases', 'q2'), ('NumberOfTransactionsOver15', 'q3')]
+    for prefix, file_name in queries:
+        selected = {key: dataset for key, dataset in rows.items() if is_query(key) and key[0].startswith(prefix)}
+        create_and_serialize_scaling_chart(selected, f'{prefix} - Thread Scaling', 'Transactions / Second',
+                                           f'{file_name}_scaling')
+
+        selected = {key: dataset for key, dataset in bandwidth.items() if is_query(key) and key[0].startswith(prefix)}
+        create_and_serialize_scaling_chart(selected, f'{prefix} - Bandwidth', 'GB / Second',
+                                           f'{file_name}_bandwidth', streams)
+
+    layouts = {key: dataset for key, dataset in bandwidth.items() if is_layout(key)}
+    create_and_serialize_scaling_chart(layouts, 'Data Layout - Bandwidth', 'GB / Second', 'layout_bandwidth', streams)
+
+
 def setup_arguments():
     """Configures the acceptable command-line arguments."""
 
@@ -102,6 +183,9 @@ def setup_arguments():
     parser.add_argument("results", type=BenchmarkResults,
         help="An absolute or relative path to a .json google benchmarks results file")
 
+    parser.add_argument("--scaling", action="store_true",
+        help="Plot thread-scaling and bandwidth curves from monoid-scaling results")
+
     return parser
 
 
@@ -109,6 +193,12 @@ def main():
     parser = setup_arguments()
     args = parser.parse_args()
 
+    plt.style.use('tableau-colorblind10')
+
+    if args.scaling:
+        plot_scaling(args.results.benchmarks)
+        return
+
     datasets = create_datasets(args.results.benchmarks)
 
     q1_title = f'Least and Most Popular Bakery Products - Throughput'
@@ -124,8 +214,6 @@ def main():
     def filter_q3(dataset):
         return '15' in dataset.name and 'Std' not in dataset.strategy
 
-    plt.style.use('tableau-colorblind10')
-
     create_and_serialize_chart(filter(filter_q1, datasets), q1_title, 'q1')
     create_and_serialize_chart(filter(filter_q2, datasets), q2_title, 'q2')
     create_and_serialize_chart(filter(filter_q3, datasets), q3_title, 'q3')
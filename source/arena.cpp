@@ -0,0 +1,125 @@
+#include "arena.h"
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define BAKERY_HAS_MMAP 1
+#endif
+
+namespace bakery
+{
+namespace
+{
+std::atomic<HugePages> g_hugePages = HugePages::eTransparent;
+
+std::size_t RoundUp(std::size_t bytes)
+{
+    return (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+}
+
+#ifdef BAKERY_HAS_MMAP
+/// <summary>
+/// Transparent huge pages only back 2MB aligned ranges, and mmap only aligns to 4KB, so this maps an extra
+/// huge page and unmaps the slack either side of the aligned range.
+/// </summary>
+void* MapAligned(std::size_t size)
+{
+    const std::size_t padded = size + kHugePageSize;
+    void* mapping = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+        throw std::bad_alloc{};
+
+    auto* const start = static_cast<char*>(mapping);
+    auto* const aligned = reinterpret_cast<char*>(RoundUp(reinterpret_cast<std::uintptr_t>(start)));
+
+    if (aligned != start)
+        munmap(start, aligned - start);
+
+    if (const std::size_t tail = (start + padded) - (aligned + size); tail != 0)
+        munmap(aligned + size, tail);
+
+    return aligned;
+}
+#endif
+} // end unnamed namespace
+
+void SetHugePages(HugePages mode)
+{
+    g_hugePages.store(mode, std::memory_order_relaxed);
+}
+
+HugePages GetHugePages()
+{
+    return g_hugePages.load(std::memory_order_relaxed);
+}
+
+void* AllocatePages(std::size_t bytes)
+{
+    const std::size_t size = RoundUp(bytes);
+
+#ifdef BAKERY_HAS_MMAP
+    const HugePages mode = GetHugePages();
+
+#ifdef MAP_HUGETLB
+    if (mode == HugePages::eExplicit)
+    {
+        // Fails when the pool hasn't got enough pages reserved, which is the usual case unless it's been set up
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapping != MAP_FAILED)
+            return mapping;
+    }
+#endif
+
+    void* pointer = MapAligned(size);
+
+#ifdef MADV_HUGEPAGE
+    // Only advice, so it's not an error if the kernel has transparent huge pages turned off
+    if (mode != HugePages::eNone)
+        madvise(pointer, size, MADV_HUGEPAGE);
+#endif
+
+    return pointer;
+#else
+    return ::operator new(size, std::align_val_t{ kHugePageSize });
+#endif
+}
+
+void FreePages(void* pointer, std::size_t bytes) noexcept
+{
+#ifdef BAKERY_HAS_MMAP
+    munmap(pointer, RoundUp(bytes));
+#else
+    ::operator delete(pointer, RoundUp(bytes), std::align_val_t{ kHugePageSize });
+#endif
+}
+
+void* HugePageResource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    if (bytes < kHugePageThreshold || alignment > kHugePageSize)
+        return ::operator new(bytes, std::align_val_t{ alignment });
+
+    return AllocatePages(bytes);
+}
+
+void HugePageResource::do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment)
+{
+    if (bytes < kHugePageThreshold || alignment > kHugePageSize)
+        ::operator delete(pointer, bytes, std::align_val_t{ alignment });
+    else
+        FreePages(pointer, bytes);
+}
+
+bool HugePageResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return dynamic_cast<const HugePageResource*>(&other) != nullptr;
+}
+
+HugePageResource* GetHugePageResource()
+{
+    static HugePageResource resource;
+    return &resource;
+}
+} // end bakery namespace
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace bakery
+{
+/// <summary>
+/// How big allocations are backed. Transparent asks the kernel (madvise) to back them with huge pages when it
+/// can, and explicit maps them from the reserved huge page pool (MAP_HUGETLB), falling back to transparent
+/// when the pool is empty. Either way a full scan of the transactions takes a TLB miss every 2MB instead of
+/// every 4KB. Without POSIX mappings, every mode is an ordinary aligned allocation.
+/// </summary>
+enum class HugePages
+{
+    eNone,
+    eTransparent,
+    eExplicit
+};
+
+inline constexpr std::size_t kHugePageSize = std::size_t{ 2 } << 20;
+
+// Allocations smaller than a huge page aren't worth mapping, so they go to the default allocator
+inline constexpr std::size_t kHugePageThreshold = kHugePageSize;
+
+// The mode for every allocation from here on (the default is transparent)
+void SetHugePages(HugePages mode);
+HugePages GetHugePages();
+
+/// <summary>
+/// Maps whole huge pages, aligned to one, for at least bytes. The size passed to FreePages must be the same.
+/// Throws std::bad_alloc when there's no memory left.
+/// </summary>
+void* AllocatePages(std::size_t bytes);
+void FreePages(void* pointer, std::size_t bytes) noexcept;
+
+/// <summary>
+/// The allocator the transactions are stored with. Big allocations (a bulk build's single one, and a growing
+/// vector's later ones) are mapped with AllocatePages, so they're huge page backed and handed straight back
+/// to the OS when freed. It's stateless, so vectors using it move and swap as cheaply as with std::allocator.
+/// </summary>
+template<typename T>
+class HugePageAllocator
+{
+public:
+    using value_type = T;
+
+    HugePageAllocator() = default;
+
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t count)
+    {
+        if (count * sizeof(T) < kHugePageThreshold)
+            return std::allocator<T>{}.allocate(count);
+
+        return static_cast<T*>(AllocatePages(count * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, std::size_t count) noexcept
+    {
+        if (count * sizeof(T) < kHugePageThreshold)
+            std::allocator<T>{}.deallocate(pointer, count);
+        else
+            FreePages(pointer, count * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const HugePageAllocator<U>&) const noexcept { return true; }
+};
+
+/// <summary>
+/// The same split as HugePageAllocator as a memory resource, to be the upstream of an arena (a
+/// std::pmr::monotonic_buffer_resource). The arena then turns millions of small node allocations into bumps
+/// of a pointer through a few big, huge page backed buffers, which are all released at once with it.
+/// </summary>
+class HugePageResource : public std::pmr::memory_resource
+{
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+// One resource serves every arena
+HugePageResource* GetHugePageResource();
+} // end bakery namespace
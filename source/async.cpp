@@ -0,0 +1,45 @@
+#include "async.h"
+
+namespace queries::async
+{
+Task<MinMaxFood> AsyncQueries::GetGreatestAndLeastPopularItems(std::span<const bakery::Transaction> span)
+{
+    return Run<queries::PopularItemsQuery>(span);
+}
+
+Task<std::size_t> AsyncQueries::GetNumberOfTransactionsOver15(std::span<const bakery::Transaction> span)
+{
+    return Run<queries::TransactionsOver15Query>(span);
+}
+
+Task<std::size_t> AsyncQueries::GetLargestNumberOfPurachasesMade(std::span<const bakery::Transaction> span)
+{
+    return Run<queries::LargestPurchaseQuery>(span);
+}
+
+/// <summary>
+/// The first Schedule moves the query off the caller's thread, and every one after that is a yield point.
+/// Chunks are reduced in order, so the result is identical to the synchronous strategies.
+/// </summary>
+template<typename Query>
+Task<typename Query::Result> AsyncQueries::Run(std::span<const bakery::Transaction> span)
+{
+    const Query query{ m_database };
+    typename Query::Monoid aggregate{};
+
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    for (std::size_t offset = 0; offset < span.size(); offset += m_chunkSize)
+    {
+        co_await Schedule(m_pool);
+
+        const trace::ScopedEvent event{ "async_chunk", static_cast<std::int64_t>(offset / m_chunkSize) };
+        const auto chunk = span.subspan(offset, std::min(m_chunkSize, span.size() - offset));
+
+        aggregate = Query::Reduce(aggregate, queries::detail::MapReduce(chunk, queries::detail::Mapper(query),
+                                                                        queries::detail::Reducer<Query>()));
+    }
+
+    co_return Query::Finalize(aggregate);
+}
+} // end queries::async namespace
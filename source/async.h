@@ -0,0 +1,315 @@
+#pragma once
+
+#include "bakery.h"
+#include "queries.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <span>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace queries::async
+{
+template<typename T>
+class Task;
+
+namespace detail
+{
+/// <summary>
+/// Where a task's result (or the exception it threw) is kept until whoever awaits it picks it up.
+/// </summary>
+template<typename T>
+class PromiseStorage
+{
+public:
+    void return_value(T value) { m_result.template emplace<1>(std::move(value)); }
+    void unhandled_exception() { m_result.template emplace<2>(std::current_exception()); }
+
+    T TakeResult()
+    {
+        if (m_result.index() == 2)
+            std::rethrow_exception(std::get<2>(m_result));
+
+        return std::move(std::get<1>(m_result));
+    }
+
+private:
+    std::variant<std::monostate, T, std::exception_ptr> m_result;
+};
+
+template<>
+class PromiseStorage<void>
+{
+public:
+    void return_void() {}
+    void unhandled_exception() { m_exception = std::current_exception(); }
+
+    void TakeResult()
+    {
+        if (m_exception)
+            std::rethrow_exception(m_exception);
+    }
+
+private:
+    std::exception_ptr m_exception;
+};
+
+/// <summary>
+/// A fire and forget coroutine, which starts immediately and destroys itself once it finishes. This is only
+/// used internally, to drive tasks from code that isn't itself a coroutine.
+/// </summary>
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+} // end detail namespace
+
+/// <summary>
+/// A lazily started coroutine producing a T. Nothing runs until the task is co_await'ed, at which point the
+/// awaiting coroutine is resumed on whichever thread the task finishes on.
+/// </summary>
+template<typename T>
+class [[nodiscard]] Task
+{
+public:
+    struct promise_type : detail::PromiseStorage<T>
+    {
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+
+        Task get_return_object() { return Task{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        auto final_suspend() noexcept
+        {
+            struct FinalAwaiter
+            {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    return handle.promise().continuation;
+                }
+                void await_resume() noexcept {}
+            };
+
+            return FinalAwaiter{};
+        }
+    };
+
+    Task() = default;
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (m_handle)
+                m_handle.destroy();
+
+            m_handle = std::exchange(other.m_handle, {});
+        }
+
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().TakeResult(); }
+        };
+
+        return Awaiter{ m_handle };
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+/// <summary>
+/// Suspends the awaiting coroutine and resumes it on one of the pool's threads. This is also how a running
+/// query yields: re-scheduling puts it at the back of the pool's queue, behind every other in-flight query.
+/// </summary>
+inline auto Schedule(ThreadPool& pool)
+{
+    struct Awaiter
+    {
+        ThreadPool& pool;
+
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { pool.Run([handle]() { handle.resume(); }); }
+        void await_resume() noexcept {}
+    };
+
+    return Awaiter{ pool };
+}
+
+/// <summary>
+/// Runs every task concurrently, and resumes the awaiting coroutine once all of them have finished. The
+/// results are returned in the same order as the tasks. If any of them threw, the first exception (by
+/// position) is rethrown once they've all finished.
+/// </summary>
+template<typename T>
+Task<std::vector<T>> WhenAll(std::vector<Task<T>> tasks)
+{
+    struct Latch
+    {
+        std::atomic<std::size_t> remaining;
+        std::coroutine_handle<> awaiting;
+    };
+
+    struct Awaiter
+    {
+        std::vector<Task<T>>& tasks;
+        std::vector<std::optional<T>>& results;
+        std::vector<std::exception_ptr>& errors;
+        Latch latch;
+
+        static detail::DetachedTask Drive(Task<T>& task, std::optional<T>& result, std::exception_ptr& error, Latch& latch)
+        {
+            try
+            {
+                result.emplace(co_await std::move(task));
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            if (latch.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                latch.awaiting.resume();
+        }
+
+        bool await_ready() noexcept { return tasks.empty(); }
+
+        bool await_suspend(std::coroutine_handle<> awaiting)
+        {
+            // The extra count is released below, so the last task can't resume us before everything has started
+            latch.remaining.store(tasks.size() + 1, std::memory_order_relaxed);
+            latch.awaiting = awaiting;
+
+            for (std::size_t index = 0; index < tasks.size(); ++index)
+                Drive(tasks[index], results[index], errors[index], latch);
+
+            return latch.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::vector<std::optional<T>> results(tasks.size());
+    std::vector<std::exception_ptr> errors(tasks.size());
+
+    co_await Awaiter{ tasks, results, errors, {} };
+
+    for (const std::exception_ptr& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    std::vector<T> values;
+    values.reserve(results.size());
+
+    for (std::optional<T>& result : results)
+        values.push_back(std::move(*result));
+
+    co_return values;
+}
+
+/// <summary>
+/// Blocks the calling thread until the task finishes, and returns its result. This is the bridge for callers
+/// that aren't coroutines. It must not be called from one of the pool's threads if the task runs on that pool.
+/// </summary>
+template<typename T>
+T SyncWait(Task<T> task)
+{
+    std::promise<T> promise;
+    std::future<T> future = promise.get_future();
+
+    // The promise is moved into the coroutine, since it may still be inside set_value when this thread wakes up
+    [](Task<T>& task, std::promise<T> promise) -> detail::DetachedTask {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                co_await std::move(task);
+                promise.set_value();
+            }
+            else
+            {
+                promise.set_value(co_await std::move(task));
+            }
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }(task, std::move(promise));
+
+    return future.get();
+}
+
+/// <summary>
+/// Non-blocking versions of the queries. Each one is a coroutine that runs on the given pool a chunk at a
+/// time, and yields back to the pool between chunks, so a single caller can keep hundreds of queries in flight
+/// on a handful of threads without any of them blocking a thread while it waits.
+///
+/// The database, the pool and this object must outlive every task it hands out.
+/// </summary>
+class AsyncQueries
+{
+public:
+    static constexpr std::size_t kDefaultChunkSize = 1 << 16;
+
+    AsyncQueries(const bakery::Database& database, ThreadPool& pool, std::size_t chunkSize = kDefaultChunkSize)
+        : m_database(database), m_pool(pool), m_chunkSize(chunkSize)
+    {
+        if (m_chunkSize == 0)
+            throw std::invalid_argument{ "The chunk size must be greater than zero." };
+    }
+
+    Task<MinMaxFood> GetGreatestAndLeastPopularItems(std::span<const bakery::Transaction> span);
+    Task<std::size_t> GetNumberOfTransactionsOver15(std::span<const bakery::Transaction> span);
+    Task<std::size_t> GetLargestNumberOfPurachasesMade(std::span<const bakery::Transaction> span);
+
+private:
+
+    template<typename Query>
+    Task<typename Query::Result> Run(std::span<const bakery::Transaction> span);
+
+    const bakery::Database& m_database;
+    ThreadPool& m_pool;
+    std::size_t m_chunkSize = kDefaultChunkSize;
+};
+} // end queries::async namespace
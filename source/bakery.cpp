@@ -1,12 +1,19 @@
 #include "bakery.h"
+#include "compression.h"
 #include "queries.h"
+#include "trace.h"
+#include "wal.h"
 
 #include <array>
+#include <bit>
 #include <execution>
 #include <fstream>
 #include <filesystem>
+#include <functional>
 #include <future>
 #include <iterator>
+#include <memory_resource>
+#include <numeric>
 #include <ranges>
 #include <thread>
 #include <utility>
@@ -37,6 +44,16 @@ namespace
 //const std::mt19937::result_type kSeed = std::random_device{}();
 const std::mt19937::result_type kSeed = 777;
 
+bool Equals(double a, double b, double epsilon = 1e-5)
+{
+    return std::fabs(a - b) < epsilon;
+}
+} // end unnamed namespace
+
+namespace bakery
+{
+namespace detail
+{
 int Select(bakery::FoodType type, const bakery::Hashtable<bakery::FoodItem>& foods, bakery::detail::Random& random)
 {
     const std::size_t count = std::ranges::count_if(foods,
@@ -93,15 +110,13 @@ double GenerateGratuity(bakery::detail::Random& random)
 
     return gratuity;
 }
+} // end detail namespace
 
-bool Equals(double a, double b, double epsilon = 1e-5)
+std::mt19937::result_type GetGenerationSeed()
 {
-    return std::fabs(a - b) < epsilon;
+    return kSeed;
 }
-} // end unnamed namespace
 
-namespace bakery
-{
 std::ostream& operator<<(std::ostream& stream, const bakery::FoodItem& item)
 {
     stream << item.foodID << ",";
@@ -210,32 +225,43 @@ const Hashtable<FoodItem>& GenerateFoods()
 /// </summary>
 /// <param name="amount"></param>
 /// <returns></returns>
-std::vector<Transaction> GenerateTransactionsParallel(std::size_t amount)
+TransactionVector GenerateTransactionsParallel(std::size_t amount)
 {
     detail::Random random{ kSeed };
 
-    std::vector<Transaction> transactions;
+    TransactionVector transactions;
     if (amount <= 0)
         return transactions;
 
     transactions.resize(amount);
 
     // Chunk up the work...
+    const auto chunkStart = queries::metrics::Now();
     std::vector<std::span<Transaction>> chunks;
     const std::span<Transaction> span{ transactions };
     queries::detail::Chunk(span, std::thread::hardware_concurrency(), chunks);
+    queries::metrics::RecordChunking(chunkStart);
 
-    const auto CreateTransactions = [&random](const std::span<Transaction>& span, int minID, int maxID)
+    queries::metrics::ChunkTimes chunkTimes{ chunks.size() };
+
+    const auto CreateTransactions = [&random, &chunkTimes](const std::span<Transaction>& span, int minID, int maxID,
+                                                           std::size_t chunkIndex, queries::metrics::Clock::time_point queued)
     {
+        queries::metrics::RecordQueueWait(queued);
+        const queries::trace::ScopedEvent event{ "generate", static_cast<std::int64_t>(chunkIndex) };
+        const auto start = queries::metrics::Now();
+
         if ((maxID - minID) != span.size())
             throw std::logic_error{ "Invalid min / max range" };
 
         for (Transaction& trans : span)
         {
             trans.orderNumber = minID++;
-            trans.gratuity = GenerateGratuity(random);
-            trans.purchases = GenerateTicket(GenerateFoods(), random);
+            trans.gratuity = detail::GenerateGratuity(random);
+            trans.purchases = detail::GenerateTicket(GenerateFoods(), random);
         }
+
+        chunkTimes.Record(chunkIndex, start);
     };
 
     static ThreadPool pool;
@@ -247,28 +273,38 @@ std::vector<Transaction> GenerateTransactionsParallel(std::size_t amount)
         const int minID = (i - 1) * chunk.size();
         const int maxID = i * chunk.size();
 
-        futures.push_back(pool.Run(CreateTransactions, chunk, minID, maxID));
+        futures.push_back(pool.Run(CreateTransactions, chunk, minID, maxID, i - 1, queries::metrics::Now()));
     }
 
-    std::ranges::for_each(futures, [](auto& future) { future.get(); });
+    std::ranges::for_each(futures, [](auto& future) {
+        const auto waitStart = queries::metrics::Now();
+        const queries::trace::ScopedEvent event{ "future_wait" };
+        future.get();
+        queries::metrics::RecordFutureWait(waitStart);
+    });
+
+    chunkTimes.Commit();
+    queries::metrics::RecordRows(span.size(), span.size_bytes());
 
     return transactions;
 }
 
-std::vector<Transaction> GenerateTransactionsSequential(std::size_t amount)
+TransactionVector GenerateTransactionsSequential(std::size_t amount)
 {
     detail::Random random{ kSeed };
 
-    std::vector<Transaction> transactions;
+    TransactionVector transactions;
     if (amount <= 0)
         return transactions;
 
+    transactions.reserve(amount);
+
     for (auto index = 0; index < amount; ++index)
     {
         transactions.push_back(Transaction{
             .orderNumber = index,
-            .gratuity = GenerateGratuity(random),
-            .purchases = GenerateTicket(GenerateFoods(), random)
+            .gratuity = detail::GenerateGratuity(random),
+            .purchases = detail::GenerateTicket(GenerateFoods(), random)
         });
     }
 
@@ -279,12 +315,17 @@ std::vector<Transaction> GenerateTransactionsSequential(std::size_t amount)
 /// These are only used when serializing the database to and from disk. They take up far too much space to
 /// create while testing with huge transaction counts.
 /// </summary>
-MultiHashtable<PurchaseMapping> GeneratePurchaseMapping(const std::vector<Transaction>& transactions)
+MultiHashtable<PurchaseMapping> GeneratePurchaseMapping(std::span<const Transaction> transactions, std::pmr::memory_resource* resource)
 {
-    MultiHashtable<PurchaseMapping> purchaseMapping;
+    MultiHashtable<PurchaseMapping> purchaseMapping{ resource };
     if (transactions.empty())
         return purchaseMapping;
 
+    // Sized for the items actually bought (a cheap pass over the masks), so it never rehashes or over-allocates
+    const std::size_t items = std::transform_reduce(transactions.begin(), transactions.end(), std::size_t{ 0 }, std::plus<>{},
+                                                    [](const Transaction& transaction) { return transaction.purchases.count(); });
+    purchaseMapping.reserve(items);
+
     const bakery::Hashtable<FoodItem>& foods = GenerateFoods();
     for (const auto& transaction : transactions)
     {
@@ -327,6 +368,20 @@ Database::Database(std::size_t amount, bool parallelCreation)
     m_transactions = parallelCreation ? GenerateTransactionsParallel(amount) : GenerateTransactionsSequential(amount);
 }
 
+void Database::Append(std::span<const Transaction> transactions)
+{
+    m_transactions.insert(m_transactions.end(), transactions.begin(), transactions.end());
+
+    if (m_itemIndex)
+        m_itemIndex->Append(transactions);
+}
+
+void Database::BuildItemIndex()
+{
+    static ThreadPool pool;
+    m_itemIndex = ItemIndex::Build(m_transactions, pool);
+}
+
 void Database::Save(const std::filesystem::path& directory) const
 {
     if (!std::filesystem::is_directory(directory))
@@ -341,7 +396,9 @@ void Database::Save(const std::filesystem::path& directory) const
     for (const auto& transaction : m_transactions)
         transactionsDB << transaction;
 
-    for (const auto& [_, purchaseMapping] : GeneratePurchaseMapping(m_transactions))
+    // The mapping is thrown away once it's written, so its nodes all come from one arena, freed in one go
+    std::pmr::monotonic_buffer_resource arena{ GetHugePageResource() };
+    for (const auto& [_, purchaseMapping] : GeneratePurchaseMapping(m_transactions, &arena))
         purchasedItemsDB << purchaseMapping;
 }
 
@@ -359,7 +416,8 @@ bool Database::Load(const std::filesystem::path& directory)
         return false;
     }
 
-    MultiHashtable<PurchaseMapping> purchaseMapping;
+    std::pmr::monotonic_buffer_resource arena{ GetHugePageResource() };
+    MultiHashtable<PurchaseMapping> purchaseMapping{ &arena };
 
     std::ifstream transactionsDB{ transDBPath };
     std::ifstream purchasedItemsDB{ purchasedDBPath };
@@ -381,6 +439,9 @@ bool Database::Load(const std::filesystem::path& directory)
         });
     }
 
+    if (m_itemIndex)
+        BuildItemIndex();
+
     return true;
 }
 
@@ -397,4 +458,205 @@ bool Database::CleanDisk(const std::filesystem::path& directory) const
            std::filesystem::remove(transDBPath) &&
            std::filesystem::remove(purchasedDBPath);
 }
+
+bool Database::SaveSnapshot(const std::filesystem::path& file) const
+{
+    return bakery::SaveSnapshot(m_transactions, file);
+}
+
+bool SaveSnapshot(std::span<const Transaction> transactions, const std::filesystem::path& file)
+{
+    std::ofstream stream{ file, std::ios::binary | std::ios::trunc };
+    if (!stream)
+        return false;
+
+    const SnapshotHeader header{ .recordSize = sizeof(TransactionRecord), .seed = kSeed, .count = transactions.size() };
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Convert and write in blocks, so there's never a second copy of the whole database in memory
+    constexpr std::size_t kBlockSize = 1 << 16;
+    std::vector<TransactionRecord> records;
+    records.reserve(kBlockSize);
+
+    for (std::size_t offset = 0; offset < transactions.size(); offset += kBlockSize)
+    {
+        const std::size_t count = std::min(kBlockSize, transactions.size() - offset);
+
+        records.clear();
+        for (const Transaction& transaction : transactions.subspan(offset, count))
+        {
+            records.push_back(TransactionRecord{
+                .orderNumber = transaction.orderNumber,
+                .purchases = static_cast<std::uint32_t>(transaction.purchases.to_ulong()),
+                .gratuity = transaction.gratuity
+            });
+        }
+
+        stream.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(TransactionRecord));
+    }
+
+    return static_cast<bool>(stream);
+}
+
+bool Database::LoadCompressed(const std::filesystem::path& file)
+{
+    const std::optional<CompressedIndex> index = ReadCompressedIndex(file);
+    if (!index)
+        return false;
+
+    std::ifstream stream{ file, std::ios::binary };
+
+    TransactionVector transactions(index->header.count);
+    std::vector<std::byte> block;
+
+    try
+    {
+        for (std::size_t number = 0; number < index->header.blocks; ++number)
+        {
+            block.resize(index->offsets[number + 1] - index->offsets[number]);
+            stream.seekg(static_cast<std::streamoff>(index->offsets[number]));
+
+            if (!stream.read(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(block.size())))
+                return false;
+
+            const std::size_t first = number * index->header.blockRows;
+            const std::size_t rows = std::min<std::size_t>(index->header.blockRows, transactions.size() - first);
+
+            if (DecodeBlock(block, std::span{ transactions }.subspan(first, rows)) != rows)
+                return false;
+        }
+    }
+    catch (const std::runtime_error&)
+    {
+        return false;
+    }
+
+    m_transactions = std::move(transactions);
+
+    if (m_itemIndex)
+        BuildItemIndex();
+
+    return true;
+}
+
+bool Database::Recover(const std::filesystem::path& directory)
+{
+    if (!std::filesystem::is_directory(directory))
+        return false;
+
+    // Without a snapshot, the rows (and any index over them) start over, and the index is rebuilt once they're replayed
+    bool rebuildIndex = false;
+
+    const std::filesystem::path snapshotPath = directory / kSnapshotFile;
+    if (std::filesystem::exists(snapshotPath))
+    {
+        if (!LoadSnapshot(snapshotPath))
+            return false;
+    }
+    else
+    {
+        m_transactions.clear();
+        rebuildIndex = m_itemIndex.has_value();
+        m_itemIndex.reset();
+    }
+
+    const std::size_t snapshotRows = m_transactions.size();
+    const bool replayed = TransactionLog::Replay(directory / kLogFile, m_transactions).has_value();
+
+    // A gap in the log means rows were lost (a snapshot that never reached the disk, say), so nothing it holds
+    // is trusted, and recovering fails rather than leaving the database short
+    if (!replayed)
+        m_transactions.erase(m_transactions.begin() + snapshotRows, m_transactions.end());
+
+    if (rebuildIndex)
+        BuildItemIndex();
+    else if (m_itemIndex)
+        m_itemIndex->Append(std::span<const Transaction>(m_transactions).subspan(snapshotRows));
+
+    return replayed;
+}
+
+bool Database::Compact(const std::filesystem::path& directory, TransactionLog& log) const
+{
+    // The new snapshot only replaces the old one once it's complete, and the log keeps every row until then
+    const std::filesystem::path snapshotPath = directory / kSnapshotFile;
+    const std::filesystem::path temporaryPath = directory / (std::string{ kSnapshotFile } + ".tmp");
+
+    if (!SaveSnapshot(temporaryPath) || !SyncFile(temporaryPath))
+        return false;
+
+    // The snapshot's rename has to be on disk before the log's, or a power loss could keep the compacted log
+    // and lose the snapshot that holds the rows it dropped
+    std::filesystem::rename(temporaryPath, snapshotPath);
+    if (!SyncDirectory(directory))
+        return false;
+
+    log.Compact(Size());
+
+    return true;
+}
+
+std::uint64_t Fingerprint(std::span<const Transaction> transactions)
+{
+    std::uint64_t hash = 0x9E3779B97F4A7C15 ^ transactions.size();
+    for (const Transaction& transaction : transactions)
+    {
+        const std::uint64_t key = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(transaction.orderNumber)) << 32) |
+                                  transaction.purchases.to_ulong();
+
+        hash = std::rotl((hash ^ key) * 0x9FB21C651E98DF25, 31);
+        hash = std::rotl((hash ^ std::bit_cast<std::uint64_t>(transaction.gratuity)) * 0xC2B2AE3D27D4EB4F, 29);
+    }
+
+    return hash;
+}
+
+bool Database::LoadSnapshot(const std::filesystem::path& file, std::size_t maxCount)
+{
+    std::ifstream stream{ file, std::ios::binary };
+    if (!stream)
+        return false;
+
+    SnapshotHeader header;
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!stream ||
+        header.magic != SnapshotHeader::kMagic ||
+        header.version != SnapshotHeader::kVersion ||
+        header.recordSize != sizeof(TransactionRecord))
+    {
+        return false;
+    }
+
+    const std::size_t total = std::min<std::uint64_t>(header.count, maxCount);
+
+    TransactionVector transactions;
+    transactions.reserve(total);
+
+    constexpr std::size_t kBlockSize = 1 << 16;
+    std::vector<TransactionRecord> records(std::min(kBlockSize, total));
+
+    while (transactions.size() < total)
+    {
+        const std::size_t count = std::min(kBlockSize, total - transactions.size());
+        if (!stream.read(reinterpret_cast<char*>(records.data()), count * sizeof(TransactionRecord)))
+            return false;
+
+        for (const TransactionRecord& record : std::span{ records }.first(count))
+        {
+            transactions.push_back(Transaction{
+                .orderNumber = record.orderNumber,
+                .gratuity = record.gratuity,
+                .purchases = record.purchases
+            });
+        }
+    }
+
+    m_transactions = std::move(transactions);
+
+    if (m_itemIndex)
+        BuildItemIndex();
+
+    return true;
+}
 }
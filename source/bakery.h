@@ -1,8 +1,16 @@
 #pragma once
 
+#include "arena.h"
+#include "itemindex.h"
+
 #include <bitset>
 #include <compare>
+#include <cstdint>
 #include <filesystem>
+#include <iosfwd>
+#include <limits>
+#include <memory_resource>
+#include <optional>
 #include <random>
 #include <ranges>
 #include <span>
@@ -86,15 +94,76 @@ struct PurchaseMapping
     auto operator<=>(const PurchaseMapping&) const = default;
 };
 
+/// <summary>
+/// The binary snapshot format: a header, followed by one fixed size record per transaction. Being fixed size
+/// means any prefix (or block) of the transactions can be read without parsing what comes before it.
+/// </summary>
+struct SnapshotHeader
+{
+    static constexpr std::uint64_t kMagic = 0x42444449'4F4E4F4D; // "MONOIDDB"
+    static constexpr std::uint32_t kVersion = 1;
+
+    std::uint64_t magic = kMagic;
+    std::uint32_t version = kVersion;
+    std::uint32_t recordSize = 0;
+    std::uint64_t seed = 0;
+    std::uint64_t count = 0;
+};
+
+struct TransactionRecord
+{
+    std::int32_t orderNumber = 0;
+    std::uint32_t purchases = 0;
+    double gratuity = 0.0;
+};
+
+// The transactions are the one big allocation, so they're kept on huge pages
+using TransactionVector = std::vector<Transaction, HugePageAllocator<Transaction>>;
+
 template<typename DBItem>
 using Hashtable = std::unordered_map<int, DBItem>;
 
 template<typename DBItem>
-using MultiHashtable = std::unordered_multimap<int, DBItem>;
+using MultiHashtable = std::pmr::unordered_multimap<int, DBItem>;
+
+namespace detail
+{
+/// <summary>
+/// The building blocks of transaction generation. These are exposed for the kernel benchmarks.
+/// </summary>
+int Select(FoodType type, const Hashtable<FoodItem>& foods, Random& random);
+std::bitset<27> GenerateTicket(const Hashtable<FoodItem>& foods, Random& random);
+double GenerateGratuity(Random& random);
+} // end detail namespace
+
+/// <summary>
+/// The CSV representations used by Database::Save and Database::Load.
+/// </summary>
+std::ostream& operator<<(std::ostream& stream, const FoodItem& item);
+std::ostream& operator<<(std::ostream& stream, const Transaction& item);
+std::ostream& operator<<(std::ostream& stream, const PurchaseMapping& item);
+
+std::istream& operator>>(std::istream& stream, FoodItem& item);
+std::istream& operator>>(std::istream& stream, Transaction& item);
+std::istream& operator>>(std::istream& stream, PurchaseMapping& item);
+
+const Hashtable<FoodItem>& GenerateFoods();
+std::mt19937::result_type GetGenerationSeed();
+
+TransactionVector GenerateTransactionsSequential(std::size_t amount);
+TransactionVector GenerateTransactionsParallel(std::size_t amount);
+
+// The mapping's nodes come from the resource, which can be an arena that outlives it
+MultiHashtable<PurchaseMapping> GeneratePurchaseMapping(std::span<const Transaction> transactions,
+                                                        std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 
-std::vector<Transaction> GenerateTransactionsSequential(std::size_t amount);
-std::vector<Transaction> GenerateTransactionsParallel(std::size_t amount);
-MultiHashtable<PurchaseMapping> GeneratePurchaseMapping(const std::vector<Transaction>& transactions);
+// Writes any run of transactions as a snapshot, which Database::LoadSnapshot can read back
+bool SaveSnapshot(std::span<const Transaction> transactions, const std::filesystem::path& file);
+
+// An order sensitive hash of a run of transactions, to tell whether a prefix of the database has changed
+std::uint64_t Fingerprint(std::span<const Transaction> transactions);
+
+class TransactionLog;
 
 class Database
 {
@@ -111,10 +180,33 @@ public:
 
     bool CleanDisk(const std::filesystem::path& directory) const;
 
+    /// <summary>
+    /// Saves / loads the transactions to / from a single binary snapshot file, which is far smaller and faster
+    /// to read than the CSV files. Loading can stop after the first maxCount transactions.
+    /// </summary>
+    bool SaveSnapshot(const std::filesystem::path& file) const;
+    bool LoadSnapshot(const std::filesystem::path& file, std::size_t maxCount = std::numeric_limits<std::size_t>::max());
+
+    // Loads a compressed snapshot (see SaveCompressed), decoding each block straight into place
+    bool LoadCompressed(const std::filesystem::path& file);
+
+    /// <summary>
+    /// A durable database lives in a directory as a snapshot plus a transaction log of what's been appended
+    /// since. Recover loads the snapshot (if there is one) and replays the log on top, and Compact writes a
+    /// new snapshot and then drops the rows it covers from the log. Either can be cut short by a crash and
+    /// leave a directory that recovers to the same rows. Recover fails if the log doesn't carry on from the
+    /// snapshot, since the rows in between are lost.
+    /// </summary>
+    static constexpr const char* kSnapshotFile = "transactions.bin";
+    static constexpr const char* kLogFile = "transactions.wal";
+
+    bool Recover(const std::filesystem::path& directory);
+    bool Compact(const std::filesystem::path& directory, TransactionLog& log) const;
+
     const FoodItem& GetFood(int ID) const { return m_foods.at(ID); }
     const Hashtable<FoodItem>& GetFoods() const { return m_foods; }
 
-    const std::vector<Transaction>& GetTransactions() const { return m_transactions; }
+    const TransactionVector& GetTransactions() const { return m_transactions; }
 
     std::span<const Transaction> GetTransactions(std::size_t count) const
     {
@@ -126,8 +218,18 @@ public:
 
     std::size_t Size() const { return m_transactions.size(); }
 
+    void Append(std::span<const Transaction> transactions);
+
+    /// <summary>
+    /// The per-item bitmap index is optional, as it costs memory and build time that only pays off for item
+    /// lookups. Once built, Append keeps it up to date, and Load / LoadSnapshot rebuild it.
+    /// </summary>
+    void BuildItemIndex();
+    const ItemIndex* GetItemIndex() const { return m_itemIndex ? &*m_itemIndex : nullptr; }
+
 private:
     const Hashtable<FoodItem>& m_foods;
-    std::vector<Transaction> m_transactions;
+    TransactionVector m_transactions;
+    std::optional<ItemIndex> m_itemIndex;
 };
 }
\ No newline at end of file
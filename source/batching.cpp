@@ -0,0 +1,192 @@
+#include "batching.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+namespace queries::batching
+{
+SharedScanBatcher::SharedScanBatcher(const bakery::Database& database, std::chrono::microseconds window, std::size_t blockSize)
+    : m_database(database), m_window(window), m_blockSize(blockSize)
+{
+    if (m_blockSize == 0)
+        throw std::invalid_argument{ "The block size must be greater than zero." };
+
+    m_worker = std::thread{ &SharedScanBatcher::Worker, this };
+}
+
+SharedScanBatcher::~SharedScanBatcher()
+{
+    {
+        std::scoped_lock lock{ m_mutex };
+        m_stopping = true;
+    }
+
+    m_condition.notify_all();
+    m_worker.join();
+}
+
+std::future<MinMaxFood> SharedScanBatcher::GetGreatestAndLeastPopularItems(std::span<const bakery::Transaction> span)
+{
+    return Submit<PopularItemsQuery>(span);
+}
+
+std::future<std::size_t> SharedScanBatcher::GetNumberOfTransactionsOver15(std::span<const bakery::Transaction> span)
+{
+    return Submit<TransactionsOver15Query>(span);
+}
+
+std::future<std::size_t> SharedScanBatcher::GetLargestNumberOfPurachasesMade(std::span<const bakery::Transaction> span)
+{
+    return Submit<LargestPurchaseQuery>(span);
+}
+
+std::uint64_t SharedScanBatcher::ScansPerformed() const
+{
+    std::scoped_lock lock{ m_mutex };
+    return m_scans;
+}
+
+std::uint64_t SharedScanBatcher::QueriesServed() const
+{
+    std::scoped_lock lock{ m_mutex };
+    return m_served;
+}
+
+template<typename Query>
+std::future<typename Query::Result> SharedScanBatcher::Submit(std::span<const bakery::Transaction> span)
+{
+    auto request = std::make_unique<QueryRequest<Query>>(m_database, span);
+    std::future<typename Query::Result> future = request->promise.get_future();
+
+    {
+        std::scoped_lock lock{ m_mutex };
+        if (m_stopping)
+            throw std::logic_error{ "The batcher is shutting down." };
+
+        m_pending.push_back(std::move(request));
+    }
+
+    m_condition.notify_all();
+    return future;
+}
+
+/// <summary>
+/// Waits for a query to arrive, holds the batch open for the window so that concurrent queries can join it,
+/// then scans each group of overlapping ranges once.
+/// </summary>
+void SharedScanBatcher::Worker()
+{
+    for (;;)
+    {
+        std::vector<std::unique_ptr<Request>> batch;
+        {
+            std::unique_lock lock{ m_mutex };
+            m_condition.wait(lock, [this]() { return m_stopping || !m_pending.empty(); });
+
+            if (m_pending.empty())
+                return;
+
+            const auto deadline = std::chrono::steady_clock::now() + m_window;
+            m_condition.wait_until(lock, deadline, [this]() { return m_stopping; });
+
+            batch.swap(m_pending);
+        }
+
+        const std::vector<std::vector<Request*>> groups = Group(batch);
+
+        // Counted before any future is made ready, so a caller that's seen its result sees its scan too
+        {
+            std::scoped_lock lock{ m_mutex };
+            m_scans += groups.size();
+            m_served += batch.size();
+        }
+
+        for (const auto& group : groups)
+            Scan(group);
+    }
+}
+
+/// <summary>
+/// Sorts the requests by where their range starts, then sweeps them, starting a new group whenever a range
+/// begins after everything in the current group has ended.
+/// </summary>
+std::vector<std::vector<SharedScanBatcher::Request*>> SharedScanBatcher::Group(const std::vector<std::unique_ptr<Request>>& batch)
+{
+    std::vector<Request*> requests;
+    for (const auto& request : batch)
+        requests.push_back(request.get());
+
+    const std::less<const bakery::Transaction*> before;
+    std::ranges::sort(requests, before, [](const Request* request) { return request->span.data(); });
+
+    std::vector<std::vector<Request*>> groups;
+    const bakery::Transaction* groupEnd = nullptr;
+
+    for (Request* request : requests)
+    {
+        const bakery::Transaction* begin = request->span.data();
+        const bakery::Transaction* end = begin + request->span.size();
+
+        if (groups.empty() || before(groupEnd, begin))
+        {
+            groups.emplace_back();
+            groupEnd = end;
+        }
+
+        groups.back().push_back(request);
+        groupEnd = std::max(groupEnd, end, before);
+    }
+
+    return groups;
+}
+
+void SharedScanBatcher::Scan(const std::vector<Request*>& group)
+{
+    const std::less<const bakery::Transaction*> before;
+
+    const bakery::Transaction* groupBegin = group.front()->span.data();
+    const bakery::Transaction* groupEnd = groupBegin;
+
+    for (const Request* request : group)
+        groupEnd = std::max(groupEnd, request->span.data() + request->span.size(), before);
+
+    metrics::RecordRows(groupEnd - groupBegin, (groupEnd - groupBegin) * sizeof(bakery::Transaction));
+
+    for (const bakery::Transaction* blockBegin = groupBegin; blockBegin != groupEnd; )
+    {
+        const bakery::Transaction* blockEnd = blockBegin + std::min<std::size_t>(m_blockSize, groupEnd - blockBegin);
+
+        for (Request* request : group)
+        {
+            if (request->failed)
+                continue;
+
+            // Clip the block to this request's range
+            const bakery::Transaction* begin = std::max(blockBegin, request->span.data(), before);
+            const bakery::Transaction* end = std::min(blockEnd, request->span.data() + request->span.size(), before);
+
+            if (!before(begin, end))
+                continue;
+
+            try
+            {
+                request->Consume({ begin, end });
+            }
+            catch (...)
+            {
+                request->failed = true;
+                request->Fail(std::current_exception());
+            }
+        }
+
+        blockBegin = blockEnd;
+    }
+
+    for (Request* request : group)
+    {
+        if (!request->failed)
+            request->Complete();
+    }
+}
+} // end queries::batching namespace
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "bakery.h"
+#include "queries.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace queries::batching
+{
+/// <summary>
+/// A front end that shares one pass over the transactions between every query submitted at about the same time.
+///
+/// Queries are collected for a short window after the first one arrives. The batch is then grouped into
+/// overlapping ranges, and each group is scanned once, a block at a time: every block is handed to every query
+/// in the group whose range covers it, while it's still hot in the cache. Each query reduces into its own monoid
+/// and gets its own result, in block order, so results are identical to the sequential strategy.
+///
+/// The spans must stay valid until their futures are ready.
+/// </summary>
+class SharedScanBatcher
+{
+public:
+    static constexpr std::chrono::microseconds kDefaultWindow{ 500 };
+    static constexpr std::size_t kDefaultBlockSize = 4096;
+
+    explicit SharedScanBatcher(const bakery::Database& database, std::chrono::microseconds window = kDefaultWindow,
+                               std::size_t blockSize = kDefaultBlockSize);
+
+    // Finishes every query that's already been submitted
+    ~SharedScanBatcher();
+
+    SharedScanBatcher(const SharedScanBatcher&) = delete;
+    SharedScanBatcher& operator=(const SharedScanBatcher&) = delete;
+
+    std::future<MinMaxFood> GetGreatestAndLeastPopularItems(std::span<const bakery::Transaction> span);
+    std::future<std::size_t> GetNumberOfTransactionsOver15(std::span<const bakery::Transaction> span);
+    std::future<std::size_t> GetLargestNumberOfPurachasesMade(std::span<const bakery::Transaction> span);
+
+    // How many shared passes have been made, and how many queries they've served
+    std::uint64_t ScansPerformed() const;
+    std::uint64_t QueriesServed() const;
+
+private:
+
+    /// <summary>
+    /// A single submitted query. The scan feeds it every block of its range, in order, then completes it.
+    /// </summary>
+    struct Request
+    {
+        explicit Request(std::span<const bakery::Transaction> span) : span(span) {}
+        virtual ~Request() = default;
+
+        virtual void Consume(std::span<const bakery::Transaction> block) = 0;
+        virtual void Complete() = 0;
+        virtual void Fail(std::exception_ptr error) = 0;
+
+        std::span<const bakery::Transaction> span;
+        bool failed = false;
+    };
+
+    template<typename Query>
+    struct QueryRequest : Request
+    {
+        QueryRequest(const bakery::Database& database, std::span<const bakery::Transaction> span)
+            : Request(span), query{ database }
+        {}
+
+        void Consume(std::span<const bakery::Transaction> block) override
+        {
+            aggregate = Query::Reduce(aggregate, detail::MapReduce(block, detail::Mapper(query), detail::Reducer<Query>()));
+        }
+
+        void Complete() override { promise.set_value(Query::Finalize(aggregate)); }
+        void Fail(std::exception_ptr error) override { promise.set_exception(error); }
+
+        Query query;
+        typename Query::Monoid aggregate{};
+        std::promise<typename Query::Result> promise;
+    };
+
+    template<typename Query>
+    std::future<typename Query::Result> Submit(std::span<const bakery::Transaction> span);
+
+    void Worker();
+    void Scan(const std::vector<Request*>& group);
+
+    static std::vector<std::vector<Request*>> Group(const std::vector<std::unique_ptr<Request>>& batch);
+
+    const bakery::Database& m_database;
+    const std::chrono::microseconds m_window;
+    const std::size_t m_blockSize;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<std::unique_ptr<Request>> m_pending;
+    bool m_stopping = false;
+
+    std::uint64_t m_scans = 0;
+    std::uint64_t m_served = 0;
+
+    std::thread m_worker;
+};
+} // end queries::batching namespace
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+
+namespace queries
+{
+class CancellationToken;
+
+/// <summary>
+/// Cancels every query running with one of its tokens, from any thread. Queries notice at their next chunk
+/// boundary, and hand back what they've reduced so far.
+/// </summary>
+class CancellationSource
+{
+public:
+    CancellationSource() : m_cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void Cancel() { m_cancelled->store(true, std::memory_order_release); }
+    bool IsCancelled() const { return m_cancelled->load(std::memory_order_acquire); }
+
+    CancellationToken Token() const;
+
+private:
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+};
+
+/// <summary>
+/// Tells a query when to stop: once its source is cancelled, or once its deadline passes, whichever comes
+/// first. A default constructed token never stops. Tokens are cheap to copy, and checking one is a load and
+/// (with a deadline) a read of the steady clock, so they're checked once per chunk rather than per row.
+/// </summary>
+class CancellationToken
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    CancellationToken() = default;
+
+    static CancellationToken At(Clock::time_point deadline) { return CancellationToken{}.WithDeadline(deadline); }
+    static CancellationToken After(Clock::duration timeout) { return At(Clock::now() + timeout); }
+
+    // The same token, stopping at the deadline if that's sooner than its own
+    CancellationToken WithDeadline(Clock::time_point deadline) const
+    {
+        CancellationToken token = *this;
+        token.m_deadline = m_deadline ? std::min(*m_deadline, deadline) : deadline;
+
+        return token;
+    }
+
+    bool StopRequested() const
+    {
+        return (m_cancelled && m_cancelled->load(std::memory_order_acquire)) ||
+               (m_deadline && Clock::now() >= *m_deadline);
+    }
+
+private:
+    friend class CancellationSource;
+
+    std::shared_ptr<const std::atomic<bool>> m_cancelled;
+    std::optional<Clock::time_point> m_deadline;
+};
+
+inline CancellationToken CancellationSource::Token() const
+{
+    CancellationToken token;
+    token.m_cancelled = m_cancelled;
+
+    return token;
+}
+} // end queries namespace
@@ -0,0 +1,508 @@
+#include "compression.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <ranges>
+#include <stdexcept>
+
+namespace bakery
+{
+namespace
+{
+constexpr unsigned kMaskBits = 27;
+constexpr std::size_t kPadding = sizeof(std::uint64_t);
+
+// Past this many distinct values, a dictionary costs more than it saves
+constexpr std::size_t kMaxDictionary = std::size_t{ 1 } << 12;
+constexpr unsigned kMaxDictionaryBits = 12;
+
+std::size_t PackedBytes(std::size_t count, unsigned bits)
+{
+    return (count * bits + 7) / 8 + kPadding;
+}
+
+unsigned BitsFor(std::uint64_t value)
+{
+    return static_cast<unsigned>(std::bit_width(value));
+}
+
+/// <summary>
+/// Values are written at consecutive bit offsets, each or'd into the 8 bytes at its first byte. Values are
+/// at most 32 bits and start at most 7 bits into that byte, so one 64-bit word always holds them.
+/// </summary>
+template<typename Values>
+void Pack(const Values& values, unsigned bits, std::vector<std::byte>& out)
+{
+    const std::size_t start = out.size();
+    out.resize(start + PackedBytes(std::size(values), bits));
+
+    if (bits == 0)
+        return;
+
+    std::size_t position = 0;
+    for (const std::uint64_t value : values)
+    {
+        std::byte* const at = out.data() + start + position / 8;
+
+        std::uint64_t word;
+        std::memcpy(&word, at, sizeof(word));
+        word |= value << (position % 8);
+        std::memcpy(at, &word, sizeof(word));
+
+        position += bits;
+    }
+}
+
+/// <summary>
+/// The decoding half: one unaligned load, a shift and a mask per value, with no branches, so the loop is a
+/// straight run of independent loads the compiler can unroll and vectorize.
+/// </summary>
+template<typename Store>
+void Unpack(const std::byte* data, unsigned bits, std::size_t count, Store&& store)
+{
+    const std::uint64_t mask = (std::uint64_t{ 1 } << bits) - 1;
+
+    for (std::size_t index = 0; index < count; ++index)
+    {
+        const std::size_t position = index * bits;
+
+        std::uint64_t word;
+        std::memcpy(&word, data + position / 8, sizeof(word));
+        store(index, (word >> (position % 8)) & mask);
+    }
+}
+
+template<typename T>
+void Append(std::vector<std::byte>& out, const T& value)
+{
+    const auto bytes = std::as_bytes(std::span{ &value, 1 });
+    out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+template<typename T>
+std::vector<T> Distinct(std::vector<T> values)
+{
+    std::ranges::sort(values);
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+
+    return values;
+}
+
+template<typename T>
+std::vector<std::uint32_t> DictionaryCodes(const std::vector<T>& values, const std::vector<T>& dictionary)
+{
+    std::vector<std::uint32_t> codes;
+    codes.reserve(values.size());
+
+    for (const T& value : values)
+        codes.push_back(static_cast<std::uint32_t>(std::ranges::lower_bound(dictionary, value) - dictionary.begin()));
+
+    return codes;
+}
+
+/// <summary>
+/// Reads a dictionary into a table with an entry for every code the bit width allows, so a corrupt code
+/// reads a zero rather than past the end.
+/// </summary>
+template<typename T>
+std::vector<T> ReadDictionary(const std::byte* data, std::size_t size, unsigned bits)
+{
+    std::vector<T> table(std::size_t{ 1 } << bits);
+    std::memcpy(table.data(), data, std::min(table.size(), size) * sizeof(T));
+
+    return table;
+}
+
+void EncodeMasks(std::span<const Transaction> transactions, CompressedBlockHeader& header, std::vector<std::byte>& out)
+{
+    std::vector<std::uint32_t> masks;
+    masks.reserve(transactions.size());
+    for (const Transaction& transaction : transactions)
+        masks.push_back(static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+
+    const std::vector<std::uint32_t> distinct = Distinct(masks);
+    const unsigned bits = BitsFor(distinct.size() - 1);
+
+    if (distinct.size() > kMaxDictionary || distinct.size() * 32 + masks.size() * bits >= masks.size() * kMaskBits)
+    {
+        header.maskBits = static_cast<std::uint8_t>(kMaskBits);
+        Pack(masks, kMaskBits, out);
+        return;
+    }
+
+    header.maskBits = static_cast<std::uint8_t>(bits);
+    header.maskDictionarySize = static_cast<std::uint32_t>(distinct.size());
+
+    for (const std::uint32_t mask : distinct)
+        Append(out, mask);
+
+    Pack(DictionaryCodes(masks, distinct), bits, out);
+}
+
+void EncodeGratuity(std::span<const Transaction> transactions, const CompressionOptions& options,
+                    CompressedBlockHeader& header, std::vector<std::byte>& codes)
+{
+    const std::size_t rows = transactions.size();
+
+    // Distinct by bit pattern, so a dictionary round trips every double exactly (even -0 and NaN)
+    std::vector<std::uint64_t> values;
+    values.reserve(rows);
+    for (const Transaction& transaction : transactions)
+        values.push_back(std::bit_cast<std::uint64_t>(transaction.gratuity));
+
+    const std::vector<std::uint64_t> distinct = Distinct(values);
+
+    std::size_t bestBits = rows * 64;
+    header.gratuityCoding = GratuityCoding::eRaw;
+
+    if (!distinct.empty() && distinct.size() <= kMaxDictionary)
+    {
+        const unsigned bits = BitsFor(distinct.size() - 1);
+        if (const std::size_t cost = distinct.size() * 64 + rows * bits; cost <= bestBits)
+        {
+            bestBits = cost;
+            header.gratuityCoding = GratuityCoding::eDictionary;
+            header.gratuityBits = static_cast<std::uint8_t>(bits);
+        }
+    }
+
+    double base = 0.0;
+    std::uint64_t maxCode = 0;
+    bool quantizable = options.gratuityStep > 0.0 && rows != 0;
+
+    if (quantizable)
+    {
+        const auto [min, max] = std::ranges::minmax(transactions | std::views::transform(&Transaction::gratuity));
+        base = min;
+
+        const double steps = std::round((max - base) / options.gratuityStep);
+        quantizable = std::isfinite(steps) && steps <= std::numeric_limits<std::uint32_t>::max();
+        maxCode = quantizable ? static_cast<std::uint64_t>(steps) : 0;
+    }
+
+    if (quantizable && rows * BitsFor(maxCode) < bestBits)
+    {
+        header.gratuityCoding = GratuityCoding::eQuantized;
+        header.gratuityBits = static_cast<std::uint8_t>(BitsFor(maxCode));
+        header.gratuityBase = base;
+        header.gratuityStep = options.gratuityStep;
+    }
+
+    switch (header.gratuityCoding)
+    {
+    case GratuityCoding::eDictionary:
+    {
+        header.gratuityDictionarySize = static_cast<std::uint32_t>(distinct.size());
+        for (const std::uint64_t value : distinct)
+            Append(codes, value);
+
+        Pack(DictionaryCodes(values, distinct), header.gratuityBits, codes);
+        break;
+    }
+    case GratuityCoding::eQuantized:
+    {
+        std::vector<std::uint32_t> steps;
+        steps.reserve(rows);
+        for (const Transaction& transaction : transactions)
+            steps.push_back(static_cast<std::uint32_t>(std::llround((transaction.gratuity - base) / header.gratuityStep)));
+
+        Pack(steps, header.gratuityBits, codes);
+        break;
+    }
+    case GratuityCoding::eRaw:
+        for (const Transaction& transaction : transactions)
+            Append(codes, transaction.gratuity);
+        break;
+    }
+}
+
+// The size of everything after the header, given what the header says
+std::size_t PayloadBytes(const CompressedBlockHeader& header)
+{
+    const std::size_t bytes = PackedBytes(header.rows, header.orderBits) +
+                              header.maskDictionarySize * sizeof(std::uint32_t) + PackedBytes(header.rows, header.maskBits);
+
+    switch (header.gratuityCoding)
+    {
+    case GratuityCoding::eDictionary:
+        return bytes + header.gratuityDictionarySize * sizeof(double) + PackedBytes(header.rows, header.gratuityBits);
+    case GratuityCoding::eQuantized:
+        return bytes + PackedBytes(header.rows, header.gratuityBits);
+    case GratuityCoding::eRaw:
+        return bytes + header.rows * sizeof(double);
+    }
+
+    return 0;
+}
+} // end unnamed namespace
+
+void EncodeBlock(std::span<const Transaction> transactions, const CompressionOptions& options, std::vector<std::byte>& out)
+{
+    CompressedBlockHeader header{ .rows = static_cast<std::uint32_t>(transactions.size()) };
+
+    std::vector<std::uint32_t> deltas(transactions.size());
+    if (!transactions.empty())
+    {
+        header.firstOrder = transactions.front().orderNumber;
+
+        std::int64_t minDelta = std::numeric_limits<std::int64_t>::max();
+        for (std::size_t row = 1; row < transactions.size(); ++row)
+            minDelta = std::min<std::int64_t>(minDelta, std::int64_t{ transactions[row].orderNumber } - transactions[row - 1].orderNumber);
+
+        header.minDelta = transactions.size() > 1 ? minDelta : 0;
+
+        std::uint64_t maxDelta = 0;
+        for (std::size_t row = 1; row < transactions.size(); ++row)
+        {
+            deltas[row] = static_cast<std::uint32_t>(std::int64_t{ transactions[row].orderNumber } - transactions[row - 1].orderNumber - header.minDelta);
+            maxDelta = std::max<std::uint64_t>(maxDelta, deltas[row]);
+        }
+
+        header.orderBits = static_cast<std::uint8_t>(BitsFor(maxDelta));
+    }
+
+    // The header's filled in as the columns are encoded, so it goes in front of them afterwards
+    std::vector<std::byte> columns;
+    Pack(deltas, header.orderBits, columns);
+    EncodeMasks(transactions, header, columns);
+    EncodeGratuity(transactions, options, header, columns);
+
+    Append(out, header);
+    out.insert(out.end(), columns.begin(), columns.end());
+}
+
+CompressedBlockView::CompressedBlockView(std::span<const std::byte> block)
+{
+    CompressedBlockHeader& header = m_header;
+    if (block.size() < sizeof(header))
+        throw std::runtime_error{ "A compressed block is too short for its header." };
+
+    std::memcpy(&header, block.data(), sizeof(header));
+
+    const bool maskDictionary = header.maskDictionarySize != 0;
+    const bool gratuityDictionary = header.gratuityCoding == GratuityCoding::eDictionary;
+
+    if (header.orderBits > 32 || header.gratuityBits > 32 ||
+        header.gratuityCoding > GratuityCoding::eRaw ||
+        (maskDictionary ? header.maskBits > kMaxDictionaryBits || header.maskDictionarySize > (std::size_t{ 1 } << header.maskBits) : header.maskBits != kMaskBits) ||
+        (gratuityDictionary ? header.gratuityBits > kMaxDictionaryBits || header.gratuityDictionarySize == 0 ||
+                              header.gratuityDictionarySize > (std::size_t{ 1 } << header.gratuityBits)
+                            : header.gratuityDictionarySize != 0) ||
+        block.size() != sizeof(header) + PayloadBytes(header))
+    {
+        throw std::runtime_error{ "A compressed block is malformed." };
+    }
+
+    const std::size_t rows = header.rows;
+    const std::byte* data = block.data() + sizeof(header);
+
+    m_orders = data;
+    data += PackedBytes(rows, header.orderBits);
+
+    if (maskDictionary)
+    {
+        m_maskDictionary = ReadDictionary<std::uint32_t>(data, header.maskDictionarySize, header.maskBits);
+        data += header.maskDictionarySize * sizeof(std::uint32_t);
+    }
+
+    m_masks = data;
+    data += PackedBytes(rows, header.maskBits);
+
+    if (gratuityDictionary)
+    {
+        m_gratuityDictionary = ReadDictionary<double>(data, header.gratuityDictionarySize, header.gratuityBits);
+        data += header.gratuityDictionarySize * sizeof(double);
+    }
+
+    m_gratuities = data;
+}
+
+void CompressedBlockView::OrderDeltas(std::span<std::uint32_t> deltas) const
+{
+    Unpack(m_orders, m_header.orderBits, Rows(), [&](std::size_t row, std::uint64_t delta) {
+        deltas[row] = static_cast<std::uint32_t>(delta);
+    });
+}
+
+void CompressedBlockView::MaskCodes(std::span<std::uint32_t> codes) const
+{
+    if (MaskDictionary().empty())
+        throw std::logic_error{ "The block's masks aren't dictionary coded." };
+
+    Unpack(m_masks, m_header.maskBits, Rows(), [&](std::size_t row, std::uint64_t code) {
+        codes[row] = static_cast<std::uint32_t>(code);
+    });
+}
+
+std::vector<MaskCount> CompressedBlockView::CountMasks() const
+{
+    std::vector<MaskCount> counts;
+
+    if (!MaskDictionary().empty())
+    {
+        std::vector<std::uint32_t> frequencies(m_maskDictionary.size());
+        Unpack(m_masks, m_header.maskBits, Rows(), [&](std::size_t, std::uint64_t code) { ++frequencies[code]; });
+
+        for (std::size_t code = 0; code < frequencies.size(); ++code)
+        {
+            if (frequencies[code] != 0)
+                counts.push_back({ .mask = m_maskDictionary[code], .rows = frequencies[code] });
+        }
+
+        return counts;
+    }
+
+    // Packed as they are, the masks are counted by sorting them
+    std::vector<std::uint32_t> masks(Rows());
+    Unpack(m_masks, kMaskBits, Rows(), [&](std::size_t row, std::uint64_t mask) { masks[row] = static_cast<std::uint32_t>(mask); });
+    std::ranges::sort(masks);
+
+    for (std::size_t row = 0; row < masks.size(); ++row)
+    {
+        if (counts.empty() || counts.back().mask != masks[row])
+            counts.push_back({ .mask = masks[row], .rows = 0 });
+
+        ++counts.back().rows;
+    }
+
+    return counts;
+}
+
+void CompressedBlockView::GratuityCodes(std::span<std::uint32_t> codes) const
+{
+    if (m_header.gratuityCoding == GratuityCoding::eRaw)
+        throw std::logic_error{ "The block's gratuities aren't coded." };
+
+    Unpack(m_gratuities, m_header.gratuityBits, Rows(), [&](std::size_t row, std::uint64_t code) {
+        codes[row] = static_cast<std::uint32_t>(code);
+    });
+}
+
+void CompressedBlockView::Decode(std::span<Transaction> transactions) const
+{
+    const CompressedBlockHeader& header = m_header;
+    const std::size_t rows = header.rows;
+
+    // Order numbers are a running sum, so they're the one column that can't be decoded out of order
+    std::int64_t orderNumber = header.firstOrder - header.minDelta;
+    Unpack(m_orders, header.orderBits, rows, [&](std::size_t row, std::uint64_t delta) {
+        orderNumber += header.minDelta + static_cast<std::int64_t>(delta);
+        transactions[row].orderNumber = static_cast<int>(orderNumber);
+    });
+
+    if (!MaskDictionary().empty())
+    {
+        Unpack(m_masks, header.maskBits, rows, [&](std::size_t row, std::uint64_t code) {
+            transactions[row].purchases = m_maskDictionary[code];
+        });
+    }
+    else
+    {
+        Unpack(m_masks, kMaskBits, rows, [&](std::size_t row, std::uint64_t mask) {
+            transactions[row].purchases = static_cast<unsigned long>(mask);
+        });
+    }
+
+    switch (header.gratuityCoding)
+    {
+    case GratuityCoding::eDictionary:
+        Unpack(m_gratuities, header.gratuityBits, rows, [&](std::size_t row, std::uint64_t code) {
+            transactions[row].gratuity = m_gratuityDictionary[code];
+        });
+        break;
+    case GratuityCoding::eQuantized:
+        Unpack(m_gratuities, header.gratuityBits, rows, [&](std::size_t row, std::uint64_t code) {
+            transactions[row].gratuity = header.gratuityBase + static_cast<double>(code) * header.gratuityStep;
+        });
+        break;
+    case GratuityCoding::eRaw:
+        for (std::size_t row = 0; row < rows; ++row)
+            std::memcpy(&transactions[row].gratuity, m_gratuities + row * sizeof(double), sizeof(double));
+        break;
+    }
+}
+
+std::size_t DecodeBlock(std::span<const std::byte> block, std::span<Transaction> transactions)
+{
+    const CompressedBlockView view{ block };
+    if (view.Rows() > transactions.size())
+        throw std::runtime_error{ "A compressed block is malformed." };
+
+    view.Decode(transactions);
+
+    return view.Rows();
+}
+
+bool SaveCompressed(std::span<const Transaction> transactions, const std::filesystem::path& file, const CompressionOptions& options)
+{
+    if (options.blockRows == 0 || options.blockRows > std::numeric_limits<std::uint32_t>::max())
+        return false;
+
+    std::ofstream stream{ file, std::ios::binary | std::ios::trunc };
+    if (!stream)
+        return false;
+
+    CompressedHeader header{ .blockRows = static_cast<std::uint32_t>(options.blockRows), .count = transactions.size() };
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<std::uint64_t> offsets{ sizeof(header) };
+    std::vector<std::byte> block;
+
+    for (std::size_t first = 0; first < transactions.size(); first += options.blockRows)
+    {
+        block.clear();
+        EncodeBlock(transactions.subspan(first, std::min(options.blockRows, transactions.size() - first)), options, block);
+
+        stream.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(block.size()));
+        offsets.push_back(offsets.back() + block.size());
+    }
+
+    header.blocks = offsets.size() - 1;
+    header.indexOffset = offsets.back();
+    stream.write(reinterpret_cast<const char*>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(std::uint64_t)));
+
+    stream.seekp(0);
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    return static_cast<bool>(stream);
+}
+
+std::optional<CompressedIndex> ReadCompressedIndex(const std::filesystem::path& file)
+{
+    std::ifstream stream{ file, std::ios::binary };
+
+    CompressedIndex index;
+    CompressedHeader& header = index.header;
+
+    // The index is the end of the file, which bounds how many blocks a corrupt header can claim
+    std::error_code error;
+    const std::uintmax_t fileSize = std::filesystem::file_size(file, error);
+
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != CompressedHeader::kMagic ||
+        header.version != CompressedHeader::kVersion ||
+        header.blockRows == 0 ||
+        header.blocks != (header.count + header.blockRows - 1) / header.blockRows ||
+        error || header.indexOffset > fileSize || (fileSize - header.indexOffset) / sizeof(std::uint64_t) != header.blocks + 1)
+    {
+        return std::nullopt;
+    }
+
+    index.offsets.resize(header.blocks + 1);
+    stream.seekg(static_cast<std::streamoff>(header.indexOffset));
+
+    if (!stream.read(reinterpret_cast<char*>(index.offsets.data()), static_cast<std::streamsize>(index.offsets.size() * sizeof(std::uint64_t))) ||
+        index.offsets.front() != sizeof(header) ||
+        index.offsets.back() != header.indexOffset ||
+        !std::ranges::is_sorted(index.offsets))
+    {
+        return std::nullopt;
+    }
+
+    return index;
+}
+} // end bakery namespace
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "bakery.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace bakery
+{
+struct CompressionOptions
+{
+    static constexpr std::size_t kDefaultBlockRows = std::size_t{ 1 } << 16;
+
+    std::size_t blockRows = kDefaultBlockRows;
+
+    // 0 keeps gratuity exact. Otherwise it may be rounded to a multiple of this, so 1e-4 is within 0.005%.
+    double gratuityStep = 0.0;
+};
+
+/// <summary>
+/// The compressed snapshot format: a header, independently decodable blocks of up to blockRows transactions,
+/// and an index of where each block starts (with the end of the last), so a reader can fetch any block with
+/// one read. The header is rewritten once the blocks are, so it holds where the index is.
+/// </summary>
+struct CompressedHeader
+{
+    static constexpr std::uint64_t kMagic = 0x4243'4449'4F4E'4F4D; // "MONOIDCB"
+    static constexpr std::uint32_t kVersion = 1;
+
+    std::uint64_t magic = kMagic;
+    std::uint32_t version = kVersion;
+    std::uint32_t blockRows = 0;
+    std::uint64_t count = 0;
+    std::uint64_t blocks = 0;
+    std::uint64_t indexOffset = 0;
+};
+
+enum class GratuityCoding : std::uint8_t
+{
+    eDictionary,
+    eQuantized,
+    eRaw
+};
+
+/// <summary>
+/// Each block is this header followed by its columns:
+///  - order numbers, as the bit packed differences between neighbours, less the smallest difference (so
+///    consecutive order numbers take 0 bits)
+///  - purchases, as bit packed indices into a dictionary of the block's distinct baskets (there are only a
+///    few hundred in practice), or as bit packed 27 bit masks when that's smaller
+///  - gratuity, as bit packed indices into a dictionary of the block's distinct values (stored first), as
+///    bit packed multiples of a step above the block's smallest value, or as raw doubles, whichever is
+///    smallest of the codings that are allowed
+/// Every bit packed column is followed by 8 bytes of padding, so a decoder can always load a whole word.
+/// </summary>
+struct CompressedBlockHeader
+{
+    std::uint32_t rows = 0;
+    std::int32_t firstOrder = 0;
+    std::int64_t minDelta = 0;
+    std::uint8_t orderBits = 0;
+    std::uint8_t maskBits = 0;
+    GratuityCoding gratuityCoding = GratuityCoding::eRaw;
+    std::uint8_t gratuityBits = 0;
+
+    // A mask dictionary size of 0 means the masks are packed as they are
+    std::uint32_t maskDictionarySize = 0;
+    std::uint32_t gratuityDictionarySize = 0;
+    std::uint32_t reserved = 0;
+
+    double gratuityBase = 0.0;
+    double gratuityStep = 0.0;
+};
+
+// Appends the transactions (one block's worth) to out, encoded as a block
+void EncodeBlock(std::span<const Transaction> transactions, const CompressionOptions& options, std::vector<std::byte>& out);
+
+// One of a block's distinct purchase masks, and how many of its rows bought exactly that
+struct MaskCount
+{
+    std::uint32_t mask = 0;
+    std::uint32_t rows = 0;
+};
+
+/// <summary>
+/// A block read column by column, without building its rows. Constructing one checks the header against
+/// the block's size and reads the dictionaries; each column is only unpacked when it's asked for. The
+/// block's bytes have to outlive the view.
+///
+/// A query that only looks at purchases can then work from CountMasks: the mask dictionary weighted by how
+/// often each code occurs, which is a few hundred entries per block rather than a row per transaction.
+/// </summary>
+class CompressedBlockView
+{
+public:
+    // Throws a runtime_error if the block is malformed
+    explicit CompressedBlockView(std::span<const std::byte> block);
+
+    const CompressedBlockHeader& Header() const { return m_header; }
+    std::size_t Rows() const { return m_header.rows; }
+
+    // The packed order number differences, less the header's minDelta. The first row's is always 0.
+    void OrderDeltas(std::span<std::uint32_t> deltas) const;
+
+    // The distinct masks codes index, or nothing if the masks are packed as they are
+    std::span<const std::uint32_t> MaskDictionary() const { return std::span{ m_maskDictionary }.first(m_header.maskDictionarySize); }
+
+    // Each row's index into MaskDictionary. Only for a block that has one.
+    void MaskCodes(std::span<std::uint32_t> codes) const;
+
+    // The block's distinct masks with how many rows have each, from the code frequencies when there's a dictionary
+    std::vector<MaskCount> CountMasks() const;
+
+    // The distinct gratuities codes index, when the coding is eDictionary
+    std::span<const double> GratuityDictionary() const { return std::span{ m_gratuityDictionary }.first(m_header.gratuityDictionarySize); }
+
+    // Each row's gratuity code: an index into GratuityDictionary, or a number of steps above the base. Not for eRaw.
+    void GratuityCodes(std::span<std::uint32_t> codes) const;
+
+    // Each column decoded into its rows, which must have room for Rows() of them
+    void Decode(std::span<Transaction> transactions) const;
+
+private:
+    CompressedBlockHeader m_header;
+
+    const std::byte* m_orders = nullptr;
+    const std::byte* m_masks = nullptr;
+    const std::byte* m_gratuities = nullptr;
+
+    // Padded to an entry for every code the bit width allows, so a corrupt code reads a zero
+    std::vector<std::uint32_t> m_maskDictionary;
+    std::vector<double> m_gratuityDictionary;
+};
+
+/// <summary>
+/// Decodes a block straight into transactions, which must have room for its rows, and returns how many
+/// there were. Throws a runtime_error if the block is malformed.
+///
+/// This is the fallback for the queries that need whole rows. The out-of-core executor hands the ones that
+/// can work from the columns a CompressedBlockView instead (see MapBlock in queries.h).
+/// </summary>
+std::size_t DecodeBlock(std::span<const std::byte> block, std::span<Transaction> transactions);
+
+bool SaveCompressed(std::span<const Transaction> transactions, const std::filesystem::path& file,
+                    const CompressionOptions& options = {});
+
+struct CompressedIndex
+{
+    CompressedHeader header;
+
+    // Where each block starts in the file, followed by where the last one ends
+    std::vector<std::uint64_t> offsets;
+};
+
+// Nothing if the file is missing or isn't a compressed snapshot
+std::optional<CompressedIndex> ReadCompressedIndex(const std::filesystem::path& file);
+} // end bakery namespace
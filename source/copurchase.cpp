@@ -0,0 +1,144 @@
+#include "copurchase.h"
+
+#include <bit>
+#include <utility>
+
+namespace queries
+{
+void CoPurchaseMatrix::Add(std::uint32_t purchases, std::int64_t count)
+{
+    m_transactions += count;
+
+    for (std::uint32_t first = purchases; first != 0; first &= first - 1)
+    {
+        const int row = std::countr_zero(first);
+        for (std::uint32_t second = purchases; second != 0; second &= second - 1)
+            m_counts[row * kItems + std::countr_zero(second)] += count;
+    }
+}
+
+void CoPurchaseMatrix::Merge(const CoPurchaseMatrix& other)
+{
+    for (std::size_t index = 0; index < m_counts.size(); ++index)
+        m_counts[index] += other.m_counts[index];
+
+    m_transactions += other.m_transactions;
+}
+
+CoPurchaseMatrix CoPurchaseMatrix::Merge(const CoPurchaseMatrix& aggregate, const CoPurchaseMatrix& next)
+{
+    CoPurchaseMatrix result = aggregate;
+    result.Merge(next);
+
+    return result;
+}
+
+double CoPurchaseMatrix::Support(int first, int second) const
+{
+    if (m_transactions == 0)
+        return 0.0;
+
+    return static_cast<double>(Count(first, second)) / m_transactions;
+}
+
+double CoPurchaseMatrix::Lift(int first, int second) const
+{
+    const std::int64_t firstCount = Count(first, first);
+    const std::int64_t secondCount = Count(second, second);
+
+    if (firstCount == 0 || secondCount == 0)
+        return 0.0;
+
+    return static_cast<double>(Count(first, second)) * m_transactions / (static_cast<double>(firstCount) * secondCount);
+}
+
+void CoPurchaseCounter::Add(std::uint32_t purchases)
+{
+    // Fibonacci hashing, then linear probing
+    std::size_t slot = (purchases * 0x9E3779B9u) >> (32 - kSlotBits);
+    while (m_slots[slot].purchases != purchases)
+    {
+        if (m_slots[slot].purchases == kEmpty)
+        {
+            m_slots[slot].purchases = purchases;
+            ++m_used;
+            break;
+        }
+
+        slot = (slot + 1) & (m_slots.size() - 1);
+    }
+
+    ++m_slots[slot].count;
+    ++m_transactions;
+
+    // Flushing before a count could overflow, too
+    if (m_used == kMaxUsed || m_transactions == std::numeric_limits<std::uint32_t>::max())
+        Flush();
+}
+
+CoPurchaseMatrix CoPurchaseCounter::Finish()
+{
+    Flush();
+    return std::exchange(m_matrix, {});
+}
+
+/// <summary>
+/// Expands every distinct basket into its pairs once, weighted by how many times it was seen. Only the upper
+/// triangle (first <= second) is expanded, then mirrored.
+/// </summary>
+void CoPurchaseCounter::Flush()
+{
+    constexpr std::size_t kItems = CoPurchaseMatrix::kItems;
+
+    std::array<std::int64_t, kItems * kItems> upper{};
+    for (Slot& slot : m_slots)
+    {
+        if (slot.purchases == kEmpty)
+            continue;
+
+        for (std::uint32_t first = slot.purchases; first != 0; first &= first - 1)
+        {
+            const int row = std::countr_zero(first);
+            for (std::uint32_t second = first; second != 0; second &= second - 1)
+                upper[row * kItems + std::countr_zero(second)] += slot.count;
+        }
+
+        slot = {};
+    }
+
+    for (std::size_t row = 0; row < kItems; ++row)
+    {
+        m_matrix.m_counts[row * kItems + row] += upper[row * kItems + row];
+
+        for (std::size_t column = row + 1; column < kItems; ++column)
+        {
+            m_matrix.m_counts[row * kItems + column] += upper[row * kItems + column];
+            m_matrix.m_counts[column * kItems + row] += upper[row * kItems + column];
+        }
+    }
+
+    m_matrix.m_transactions += std::exchange(m_transactions, 0);
+    m_used = 0;
+}
+
+CoPurchaseMatrix CoPurchaseCounter::Count(std::span<const bakery::Transaction> span)
+{
+    // Clearing and sweeping the table costs more than it saves on a handful of rows
+    constexpr std::size_t kMinimumRows = 1024;
+
+    if (span.size() < kMinimumRows)
+    {
+        CoPurchaseMatrix matrix;
+        for (const auto& transaction : span)
+            matrix.Add(static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+
+        return matrix;
+    }
+
+    CoPurchaseCounter counter;
+    for (const auto& transaction : span)
+        counter.Add(static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+
+    return counter.Finish();
+}
+} // end queries namespace
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "bakery.h"
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+
+namespace queries
+{
+/// <summary>
+/// How often every pair of items is bought together: a symmetric 27x27 matrix of counts, whose diagonal is
+/// how many transactions contain each item. It's a monoid under element-wise addition, which is exact, so
+/// the matrix is identical however the transactions were split up.
+/// </summary>
+class CoPurchaseMatrix
+{
+public:
+    static constexpr std::size_t kItems = 27;
+
+    // Counts every pair in a single basket, as though it were bought count times
+    void Add(std::uint32_t purchases, std::int64_t count = 1);
+
+    void Merge(const CoPurchaseMatrix& other);
+    static CoPurchaseMatrix Merge(const CoPurchaseMatrix& aggregate, const CoPurchaseMatrix& next);
+
+    std::int64_t Transactions() const { return m_transactions; }
+    std::int64_t Count(int first, int second) const { return m_counts[first * kItems + second]; }
+
+    /// <summary>
+    /// The fraction of transactions containing both items, and how much more often they're bought together
+    /// than they would be if they were bought independently (0 when either item was never bought).
+    /// </summary>
+    double Support(int first, int second) const;
+    double Lift(int first, int second) const;
+
+    auto operator<=>(const CoPurchaseMatrix&) const = default;
+
+private:
+    friend class CoPurchaseCounter;
+
+    std::array<std::int64_t, kItems * kItems> m_counts{};
+    std::int64_t m_transactions = 0;
+};
+
+/// <summary>
+/// Builds a CoPurchaseMatrix from a run of transactions without expanding every basket into its pairs. Baskets
+/// are first counted by their purchase mask, in a small open-addressed table. There are few distinct baskets
+/// compared to transactions, so the pairs of each distinct basket are then expanded just once, weighted by its
+/// count, when the table fills up or the run ends. That keeps the per-row cost to one probe, however many
+/// items are in the basket.
+/// </summary>
+class CoPurchaseCounter
+{
+public:
+    void Add(std::uint32_t purchases);
+
+    // Flushes the baskets that haven't been expanded yet, and hands back the matrix
+    CoPurchaseMatrix Finish();
+
+    static CoPurchaseMatrix Count(std::span<const bakery::Transaction> span);
+
+private:
+
+    void Flush();
+
+    static constexpr std::uint32_t kEmpty = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::size_t kSlotBits = 12;
+    static constexpr std::size_t kMaxUsed = (std::size_t{ 1 } << kSlotBits) * 3 / 4;
+
+    struct Slot
+    {
+        std::uint32_t purchases = kEmpty;
+        std::uint32_t count = 0;
+    };
+
+    std::array<Slot, std::size_t{ 1 } << kSlotBits> m_slots;
+    std::size_t m_used = 0;
+    std::int64_t m_transactions = 0;
+
+    CoPurchaseMatrix m_matrix;
+};
+} // end queries namespace
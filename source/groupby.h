@@ -0,0 +1,286 @@
+#pragma once
+
+#include "bakery.h"
+#include "metrics.h"
+#include "queries.h"
+#include "trace.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace queries::groupby
+{
+inline constexpr std::size_t kCacheLineSize = 64;
+
+// The food ID passed along with a key that groups the whole transaction, rather than one of its purchases
+inline constexpr int kWholeTransaction = -1;
+
+namespace detail
+{
+/// <summary>
+/// Hands out cache line aligned storage, so that a histogram never shares a cache line with anything
+/// allocated before it.
+/// </summary>
+template<typename T>
+struct CacheAlignedAllocator
+{
+    using value_type = T;
+
+    CacheAlignedAllocator() = default;
+
+    template<typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{ kCacheLineSize }));
+    }
+
+    void deallocate(T* pointer, std::size_t) noexcept
+    {
+        ::operator delete(pointer, std::align_val_t{ kCacheLineSize });
+    }
+
+    template<typename U>
+    bool operator==(const CacheAlignedAllocator<U>&) const noexcept { return true; }
+};
+
+/// <summary>
+/// A histogram owned by a single thread. It's aligned to, and padded out to, a whole number of cache lines,
+/// so no two threads' histograms ever share one. Only the first keyCount bins are used.
+/// </summary>
+template<typename Monoid>
+using Histogram = std::vector<Monoid, CacheAlignedAllocator<Monoid>>;
+
+template<typename Monoid>
+Histogram<Monoid> MakeHistogram(std::size_t keyCount)
+{
+    std::size_t size = std::max<std::size_t>(keyCount, 1);
+    while ((size * sizeof(Monoid)) % kCacheLineSize != 0)
+        ++size;
+
+    return Histogram<Monoid>(size, Monoid{});
+}
+
+/// <summary>
+/// Calls visit with the ID of every item on the ticket, walking the set bits of the purchase mask rather than
+/// building a vector of them.
+/// </summary>
+template<typename Visit>
+void ForEachPurchase(const bakery::Transaction& transaction, Visit&& visit)
+{
+    for (auto purchases = static_cast<std::uint32_t>(transaction.purchases.to_ulong()); purchases != 0; purchases &= purchases - 1)
+        visit(std::countr_zero(purchases));
+}
+} // end detail namespace
+
+/// <summary>
+/// Key selectors. Each one maps a transaction to one or more keys in [0, KeyCount()) by calling emit(key, foodID).
+/// The item selectors emit once per purchase (with that purchase's food ID), and the transaction selectors emit
+/// once per transaction (with kWholeTransaction).
+/// </summary>
+struct ByFoodID
+{
+    std::size_t KeyCount() const { return 27; }
+
+    template<typename Emit>
+    void operator()(const bakery::Transaction& transaction, Emit&& emit) const
+    {
+        detail::ForEachPurchase(transaction, [&emit](int foodID) { emit(static_cast<std::size_t>(foodID), foodID); });
+    }
+};
+
+struct ByFoodType
+{
+    explicit ByFoodType(const bakery::Database& database)
+    {
+        for (std::size_t foodID = 0; foodID < types.size(); ++foodID)
+            types[foodID] = static_cast<std::uint8_t>(database.GetFood(static_cast<int>(foodID)).type);
+    }
+
+    std::size_t KeyCount() const { return 6; }
+
+    template<typename Emit>
+    void operator()(const bakery::Transaction& transaction, Emit&& emit) const
+    {
+        detail::ForEachPurchase(transaction, [&](int foodID) { emit(types[foodID], foodID); });
+    }
+
+    std::array<std::uint8_t, 27> types{};
+};
+
+struct ByBasketSize
+{
+    std::size_t KeyCount() const { return 28; }
+
+    template<typename Emit>
+    void operator()(const bakery::Transaction& transaction, Emit&& emit) const
+    {
+        emit(transaction.purchases.count(), kWholeTransaction);
+    }
+};
+
+/// <summary>
+/// Groups transactions into buckets of bucketWidth consecutive order numbers. Anything past the last bucket
+/// is counted in the last bucket.
+/// </summary>
+struct ByOrderBucket
+{
+    ByOrderBucket(int bucketWidth, std::size_t bucketCount)
+        : bucketWidth(bucketWidth), bucketCount(bucketCount)
+    {
+        if (bucketWidth <= 0 || bucketCount == 0)
+            throw std::invalid_argument{ "The bucket width and count must be greater than zero." };
+    }
+
+    std::size_t KeyCount() const { return bucketCount; }
+
+    template<typename Emit>
+    void operator()(const bakery::Transaction& transaction, Emit&& emit) const
+    {
+        const auto bucket = static_cast<std::size_t>(std::max(transaction.orderNumber, 0) / bucketWidth);
+        emit(std::min(bucket, bucketCount - 1), kWholeTransaction);
+    }
+
+    int bucketWidth = 1;
+    std::size_t bucketCount = 1;
+};
+
+/// <summary>
+/// Aggregations. Any type with a Monoid, a Map(transaction, foodID) and a static Reduce works here; these
+/// are the common ones.
+/// </summary>
+struct Count
+{
+    using Monoid = std::int64_t;
+
+    Monoid Map(const bakery::Transaction&, int) const { return 1; }
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return aggregate + next; }
+};
+
+/// <summary>
+/// Revenue in cents: the item's price for item selectors, and the ticket's subtotal for transaction selectors.
+/// </summary>
+struct Revenue
+{
+    using Monoid = Cents;
+
+    explicit Revenue(const bakery::Database& database) : prices(queries::detail::GetPricesInCents(database)) {}
+
+    Monoid Map(const bakery::Transaction& transaction, int foodID) const
+    {
+        return foodID == kWholeTransaction ? queries::detail::GetSubtotal(prices, transaction) : prices[foodID];
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return aggregate + next; }
+
+    queries::detail::PriceTable prices;
+};
+
+template<typename Selector>
+concept KeySelector = requires(const Selector selector, const bakery::Transaction& transaction)
+{
+    { selector.KeyCount() } -> std::convertible_to<std::size_t>;
+    selector(transaction, [](std::size_t, int) {});
+};
+
+template<typename Aggregator>
+concept Aggregation = requires(const Aggregator aggregator, const bakery::Transaction& transaction,
+                               const typename Aggregator::Monoid& monoid)
+{
+    { aggregator.Map(transaction, 0) } -> std::convertible_to<typename Aggregator::Monoid>;
+    { Aggregator::Reduce(monoid, monoid) } -> std::convertible_to<typename Aggregator::Monoid>;
+};
+
+namespace detail
+{
+template<KeySelector Selector, Aggregation Aggregator>
+Histogram<typename Aggregator::Monoid> Accumulate(std::span<const bakery::Transaction> span, const Selector& selector,
+                                                  const Aggregator& aggregator)
+{
+    auto histogram = MakeHistogram<typename Aggregator::Monoid>(selector.KeyCount());
+
+    for (const auto& transaction : span)
+    {
+        selector(transaction, [&](std::size_t key, int foodID) {
+            histogram[key] = Aggregator::Reduce(histogram[key], aggregator.Map(transaction, foodID));
+        });
+    }
+
+    return histogram;
+}
+} // end detail namespace
+
+/// <summary>
+/// Aggregates the span into one monoid per key. The result has selector.KeyCount() entries, indexed by key.
+/// </summary>
+template<KeySelector Selector, Aggregation Aggregator>
+std::vector<typename Aggregator::Monoid> GroupBy(std::span<const bakery::Transaction> span, const Selector& selector,
+                                                 const Aggregator& aggregator)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const auto histogram = detail::Accumulate(span, selector, aggregator);
+    return { histogram.begin(), std::next(histogram.begin(), selector.KeyCount()) };
+}
+
+/// <summary>
+/// The parallel version: one chunk per pool thread, each aggregating into a histogram it allocates and owns,
+/// so the scan never writes to memory another thread touches. The histograms are merged key by key, in chunk
+/// order, once every chunk is done, which keeps the result identical to the sequential GroupBy.
+/// </summary>
+template<KeySelector Selector, Aggregation Aggregator>
+std::vector<typename Aggregator::Monoid> GroupBy(ThreadPool& pool, std::span<const bakery::Transaction> span,
+                                                 const Selector& selector, const Aggregator& aggregator)
+{
+    using Monoid = typename Aggregator::Monoid;
+
+    const std::size_t keyCount = selector.KeyCount();
+    std::vector<Monoid> result(keyCount, Monoid{});
+
+    if (span.empty())
+        return result;
+
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const auto chunkStart = metrics::Now();
+    std::vector<std::span<const bakery::Transaction>> chunks;
+    queries::detail::Chunk(span, std::min(pool.ThreadCount(), span.size()), chunks);
+    metrics::RecordChunking(chunkStart);
+
+    std::vector<std::future<detail::Histogram<Monoid>>> futures;
+    futures.reserve(chunks.size());
+
+    for (std::size_t index = 0; index < chunks.size(); ++index)
+    {
+        futures.push_back(pool.Run([&, index]() {
+            const trace::ScopedEvent event{ "group_by", static_cast<std::int64_t>(index) };
+            return detail::Accumulate(chunks[index], selector, aggregator);
+        }));
+    }
+
+    for (auto& future : futures)
+    {
+        const auto waitStart = metrics::Now();
+        const detail::Histogram<Monoid> partial = future.get();
+        metrics::RecordFutureWait(waitStart);
+
+        const auto reduceStart = metrics::Now();
+        for (std::size_t key = 0; key < keyCount; ++key)
+            result[key] = Aggregator::Reduce(result[key], partial[key]);
+        metrics::RecordReduce(reduceStart);
+    }
+
+    return result;
+}
+} // end queries::groupby namespace
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace queries
+{
+/// <summary>
+/// One ranked entry of a heavy hitters summary. The true count of the key is somewhere in [count, maxCount].
+/// </summary>
+struct HeavyHitter
+{
+    std::uint32_t key = 0;
+    std::int64_t count = 0;
+    std::int64_t maxCount = 0;
+
+    auto operator<=>(const HeavyHitter&) const = default;
+};
+
+/// <summary>
+/// A Misra-Gries heavy hitters summary: a mergeable monoid that tracks the most frequent keys in a fixed
+/// amount of memory (Capacity counters), however many distinct keys there are.
+///
+/// Counts are never overestimated. Each one is underestimated by at most ErrorBound(), which is no more
+/// than N / (Capacity + 1) for N total occurrences, however the summaries were split up and merged. So every
+/// key occurring more than N / (Capacity + 1) times is guaranteed to be in the summary, and while there are
+/// no more than Capacity distinct keys, the counts are exact.
+///
+/// Merging sums the counters, and if that leaves more than Capacity of them, subtracts the (Capacity + 1)th
+/// largest count from all of them and drops the ones left without a positive count. This is commutative, but
+/// only associative up to the error bound: summaries reduced in a different order can differ, within it.
+///
+/// Keys are found through a small open-addressed index of where each one's counter is, so adding one costs a
+/// probe or two rather than a scan of the counters.
+/// </summary>
+template<std::size_t Capacity>
+class HeavyHitters
+{
+public:
+    static_assert(Capacity > 0, "A summary needs at least one counter.");
+
+    static constexpr std::size_t kCapacity = Capacity;
+
+    HeavyHitters() = default;
+
+    // Only the counters in use are copied
+    HeavyHitters(const HeavyHitters& other) : m_index(other.m_index), m_size(other.m_size), m_total(other.m_total)
+    {
+        std::copy_n(other.m_counters.begin(), other.m_size, m_counters.begin());
+    }
+
+    HeavyHitters& operator=(const HeavyHitters& other)
+    {
+        std::copy_n(other.m_counters.begin(), other.m_size, m_counters.begin());
+        m_index = other.m_index;
+        m_size = other.m_size;
+        m_total = other.m_total;
+
+        return *this;
+    }
+
+    void Add(std::uint32_t key, std::int64_t weight = 1)
+    {
+        m_total += weight;
+        Insert(key, weight);
+
+        if (m_size > Capacity)
+            Prune();
+    }
+
+    /// <summary>
+    /// Adds one of each key, only pruning once the spare counters run out (rather than each time there's one
+    /// more key than the capacity) and once at the end. That's the same as merging in exact counts of the keys
+    /// a piece at a time, so the error bound holds, with a fraction of the pruning.
+    /// </summary>
+    template<std::ranges::input_range Keys>
+    void AddAll(Keys&& keys)
+    {
+        for (const std::uint32_t key : keys)
+        {
+            ++m_total;
+            Insert(key, 1);
+
+            if (m_size == m_counters.size())
+                Prune();
+        }
+
+        if (m_size > Capacity)
+            Prune();
+    }
+
+    void Merge(const HeavyHitters& other)
+    {
+        m_total += other.m_total;
+        for (const Counter& counter : other.Counters())
+            Insert(counter.key, counter.count);
+
+        if (m_size > Capacity)
+            Prune();
+    }
+
+    static HeavyHitters Merge(const HeavyHitters& aggregate, const HeavyHitters& next)
+    {
+        HeavyHitters result = aggregate;
+        result.Merge(next);
+
+        return result;
+    }
+
+    std::int64_t Total() const { return m_total; }
+    std::size_t Size() const { return m_size; }
+
+    /// <summary>
+    /// The most any reported count falls short of the true count, and the most often an unreported key can
+    /// occur. Every decrement drops Capacity + 1 occurrences from the counters, so this is the occurrences
+    /// that aren't accounted for, divided by Capacity + 1.
+    /// </summary>
+    std::int64_t ErrorBound() const
+    {
+        std::int64_t counted = 0;
+        for (const Counter& counter : Counters())
+            counted += counter.count;
+
+        return (m_total - counted) / static_cast<std::int64_t>(Capacity + 1);
+    }
+
+    /// <summary>
+    /// Every tracked key, by descending count (ties broken by key, so the order is deterministic).
+    /// </summary>
+    std::vector<HeavyHitter> Ranked() const
+    {
+        const std::int64_t errorBound = ErrorBound();
+
+        std::vector<HeavyHitter> ranked;
+        ranked.reserve(m_size);
+
+        for (const Counter& counter : Counters())
+            ranked.push_back({ counter.key, counter.count, counter.count + errorBound });
+
+        std::ranges::sort(ranked, [](const HeavyHitter& lhs, const HeavyHitter& rhs) {
+            return lhs.count != rhs.count ? lhs.count > rhs.count : lhs.key < rhs.key;
+        });
+
+        return ranked;
+    }
+
+    // The counters in use, and the total. Loading refuses more counters than the capacity.
+    bool Save(std::ostream& stream) const
+    {
+        const std::uint64_t size = m_size;
+        stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        stream.write(reinterpret_cast<const char*>(&m_total), sizeof(m_total));
+
+        // Field by field, since the struct's padding is never initialized
+        for (const Counter& counter : Counters())
+        {
+            stream.write(reinterpret_cast<const char*>(&counter.key), sizeof(counter.key));
+            stream.write(reinterpret_cast<const char*>(&counter.count), sizeof(counter.count));
+        }
+
+        return static_cast<bool>(stream);
+    }
+
+    bool Load(std::istream& stream)
+    {
+        std::uint64_t size = 0;
+        std::int64_t total = 0;
+        if (!stream.read(reinterpret_cast<char*>(&size), sizeof(size)) ||
+            !stream.read(reinterpret_cast<char*>(&total), sizeof(total)) || size > Capacity)
+        {
+            return false;
+        }
+
+        std::array<Counter, Capacity * 2> counters;
+        for (std::size_t index = 0; index < size; ++index)
+        {
+            if (!stream.read(reinterpret_cast<char*>(&counters[index].key), sizeof(counters[index].key)) ||
+                !stream.read(reinterpret_cast<char*>(&counters[index].count), sizeof(counters[index].count)))
+            {
+                return false;
+            }
+        }
+
+        std::copy_n(counters.begin(), size, m_counters.begin());
+        m_size = size;
+        m_total = total;
+        Reindex();
+
+        return true;
+    }
+
+private:
+
+    // The counters are deliberately left uninitialized past m_size, so a summary of a single row is cheap to build
+    struct Counter
+    {
+        std::uint32_t key;
+        std::int64_t count;
+    };
+
+    // Twice as many index slots as counters, so probes stay short. A slot holds its counter's position plus
+    // one, so the zeroed index is empty.
+    static constexpr std::size_t kIndexBits = std::bit_width(Capacity * 4 - 1);
+    using IndexSlot = std::conditional_t<(Capacity * 2 < 0xFFFF), std::uint16_t, std::uint32_t>;
+
+    std::span<const Counter> Counters() const { return { m_counters.data(), m_size }; }
+
+    static std::size_t Hash(std::uint32_t key)
+    {
+        // Fibonacci hashing, then linear probing
+        return (key * 0x9E3779B9u) >> (32 - kIndexBits);
+    }
+
+    void Insert(std::uint32_t key, std::int64_t weight)
+    {
+        std::size_t slot = Hash(key);
+        for (; m_index[slot] != 0; slot = (slot + 1) & (m_index.size() - 1))
+        {
+            Counter& counter = m_counters[m_index[slot] - 1];
+            if (counter.key == key)
+            {
+                counter.count += weight;
+                return;
+            }
+        }
+
+        m_counters[m_size++] = { key, weight };
+        m_index[slot] = static_cast<IndexSlot>(m_size);
+    }
+
+    void Reindex()
+    {
+        m_index.fill(0);
+        for (std::size_t index = 0; index < m_size; ++index)
+        {
+            std::size_t slot = Hash(m_counters[index].key);
+            while (m_index[slot] != 0)
+                slot = (slot + 1) & (m_index.size() - 1);
+
+            m_index[slot] = static_cast<IndexSlot>(index + 1);
+        }
+    }
+
+    void Prune()
+    {
+        // There's room for twice the capacity, so a whole summary can be merged in before pruning
+        std::array<std::int64_t, Capacity * 2> counts;
+        for (std::size_t index = 0; index < m_size; ++index)
+            counts[index] = m_counters[index].count;
+
+        const auto nth = counts.begin() + Capacity;
+        std::nth_element(counts.begin(), nth, counts.begin() + m_size, std::greater<>{});
+        const std::int64_t decrement = *nth;
+
+        std::size_t kept = 0;
+        for (std::size_t index = 0; index < m_size; ++index)
+        {
+            if (m_counters[index].count > decrement)
+                m_counters[kept++] = { m_counters[index].key, m_counters[index].count - decrement };
+        }
+
+        m_size = kept;
+        Reindex();
+    }
+
+    std::array<Counter, Capacity * 2> m_counters;
+    std::array<IndexSlot, std::size_t{ 1 } << kIndexBits> m_index{};
+    std::size_t m_size = 0;
+    std::int64_t m_total = 0;
+};
+} // end queries namespace
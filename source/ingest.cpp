@@ -0,0 +1,90 @@
+#include "ingest.h"
+
+#include <utility>
+
+namespace bakery
+{
+LogFollower::LogFollower(Database& database, const std::filesystem::path& log)
+    : m_database(database), m_reader(log, database.Size())
+{}
+
+LogFollower::~LogFollower()
+{
+    try
+    {
+        Stop();
+    }
+    catch (...)
+    {
+        // Nothing to report an error from the thread to, once the follower's going away
+    }
+}
+
+void LogFollower::Subscribe(Listener listener)
+{
+    std::lock_guard lock{ m_mutex };
+    m_listeners.push_back(std::move(listener));
+}
+
+std::size_t LogFollower::Poll()
+{
+    std::lock_guard lock{ m_mutex };
+
+    // The log is read outside of the database, so a read that throws part way leaves the database as it was
+    m_buffer.clear();
+    const std::size_t newRows = m_reader.Read(m_buffer);
+    if (newRows == 0)
+        return 0;
+
+    m_database.Append(m_buffer);
+
+    for (const Listener& listener : m_listeners)
+        listener(m_database.GetTransactions(), newRows);
+
+    return newRows;
+}
+
+void LogFollower::Start(std::chrono::milliseconds interval)
+{
+    Stop();
+
+    m_stopping = false;
+    m_follower = std::thread{ &LogFollower::Follow, this, interval };
+}
+
+void LogFollower::Stop()
+{
+    if (m_follower.joinable())
+    {
+        {
+            std::lock_guard lock{ m_mutex };
+            m_stopping = true;
+        }
+
+        m_condition.notify_all();
+        m_follower.join();
+    }
+
+    if (m_error)
+        std::rethrow_exception(std::exchange(m_error, nullptr));
+}
+
+void LogFollower::Follow(std::chrono::milliseconds interval)
+{
+    try
+    {
+        for (;;)
+        {
+            Poll();
+
+            std::unique_lock lock{ m_mutex };
+            if (m_condition.wait_for(lock, interval, [this]() { return m_stopping; }))
+                return;
+        }
+    }
+    catch (...)
+    {
+        m_error = std::current_exception();
+    }
+}
+} // end bakery namespace
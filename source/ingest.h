@@ -0,0 +1,71 @@
+#pragma once
+
+#include "bakery.h"
+#include "wal.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace bakery
+{
+/// <summary>
+/// Streams the transactions another process appends to a transaction log into a database, rather than
+/// reloading the whole thing to pick them up. Each poll reads only the frames committed since the last one,
+/// appends them to the database, and then calls every listener with the grown transactions, so incremental
+/// aggregates (e.g. SequentialIA::Advance) only reduce the new rows.
+///
+/// Polling can be driven by hand with Poll, or by a background thread with Start. While the thread runs, the
+/// database and whatever the listeners update are only changed under Lock, so readers should hold it.
+/// </summary>
+class LogFollower
+{
+public:
+    static constexpr std::chrono::milliseconds kDefaultInterval{ 250 };
+
+    // Called after new rows are appended, with all of the database's transactions and how many are new
+    using Listener = std::function<void(std::span<const Transaction> transactions, std::size_t newRows)>;
+
+    // Follows the log on from the database's last row, so it should already hold what's been logged so far
+    LogFollower(Database& database, const std::filesystem::path& log);
+
+    ~LogFollower();
+
+    LogFollower(const LogFollower&) = delete;
+    LogFollower& operator=(const LogFollower&) = delete;
+
+    void Subscribe(Listener listener);
+
+    // Reads, appends and notifies once, and returns how many rows were new
+    std::size_t Poll();
+
+    /// <summary>
+    /// Polls on a background thread every interval until Stop. If a poll throws, the thread stops, and the
+    /// exception is rethrown by Stop.
+    /// </summary>
+    void Start(std::chrono::milliseconds interval = kDefaultInterval);
+    void Stop();
+
+    std::unique_lock<std::mutex> Lock() { return std::unique_lock{ m_mutex }; }
+
+private:
+    void Follow(std::chrono::milliseconds interval);
+
+    Database& m_database;
+    TransactionLogReader m_reader;
+    std::vector<Transaction> m_buffer;
+    std::vector<Listener> m_listeners;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping = false;
+    std::exception_ptr m_error;
+    std::thread m_follower;
+};
+} // end bakery namespace
@@ -0,0 +1,259 @@
+#include "itemindex.h"
+#include "bakery.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <bit>
+#include <future>
+
+#include "ThreadPool.h"
+
+namespace bakery
+{
+namespace
+{
+std::uint64_t PopCount(std::span<const std::uint64_t> words)
+{
+    std::uint64_t count = 0;
+    for (std::uint64_t word : words)
+        count += std::popcount(word);
+
+    return count;
+}
+
+/// <summary>
+/// Clears the bits of the (already gathered) words that fall outside [begin, end), where words[0] holds bits
+/// [begin / 64 * 64, begin / 64 * 64 + 64).
+/// </summary>
+void ClipWords(std::span<std::uint64_t> words, std::uint32_t begin, std::uint32_t end)
+{
+    words.front() &= ~std::uint64_t{ 0 } << (begin % 64);
+    if (end % 64 != 0)
+        words.back() &= ~(~std::uint64_t{ 0 } << (end % 64));
+}
+} // end unnamed namespace
+
+bool ItemIndex::Container::Contains(std::uint16_t value) const
+{
+    if (IsBitmap())
+        return (bitmap[value / 64] >> (value % 64)) & 1;
+
+    return std::ranges::binary_search(array, value);
+}
+
+void ItemIndex::Container::Add(std::uint16_t value)
+{
+    ++cardinality;
+
+    if (IsBitmap())
+    {
+        bitmap[value / 64] |= std::uint64_t{ 1 } << (value % 64);
+        return;
+    }
+
+    array.push_back(value);
+    if (array.size() <= kMaxArraySize)
+        return;
+
+    // Too many rows for an array to be any smaller than a bitmap
+    bitmap.resize(kBitmapWords);
+    for (std::uint16_t row : array)
+        bitmap[row / 64] |= std::uint64_t{ 1 } << (row % 64);
+
+    array = {};
+}
+
+std::int64_t ItemIndex::Container::CountInRange(std::uint32_t begin, std::uint32_t end) const
+{
+    if (begin == 0 && end == kBlockRows)
+        return cardinality;
+
+    if (begin >= end)
+        return 0;
+
+    if (IsBitmap())
+    {
+        // Counting the whole words, less the bits before begin and from end onwards
+        const std::size_t first = begin / 64;
+        const std::size_t last = (end - 1) / 64;
+
+        std::uint64_t count = PopCount({ bitmap.data() + first, last - first + 1 });
+        count -= std::popcount(bitmap[first] & ~(~std::uint64_t{ 0 } << (begin % 64)));
+        if (end % 64 != 0)
+            count -= std::popcount(bitmap[last] & (~std::uint64_t{ 0 } << (end % 64)));
+
+        return static_cast<std::int64_t>(count);
+    }
+
+    return std::ranges::lower_bound(array, end) - std::ranges::lower_bound(array, begin);
+}
+
+ItemIndex ItemIndex::Build(std::span<const Transaction> transactions, ThreadPool& pool)
+{
+    const queries::trace::ScopedEvent event{ "build_item_index" };
+
+    std::vector<std::future<Block>> futures;
+    for (std::size_t first = 0; first < transactions.size(); first += kBlockRows)
+        futures.push_back(pool.Run(&ItemIndex::BuildBlock, transactions.subspan(first, std::min(kBlockRows, transactions.size() - first))));
+
+    ItemIndex index;
+    index.m_blocks.reserve(futures.size());
+    for (auto& future : futures)
+        index.m_blocks.push_back(future.get());
+
+    index.m_rows = transactions.size();
+    return index;
+}
+
+/// <summary>
+/// Sets every item's bits in a full bitmap first, then shrinks the sparse ones down to arrays. That's a store
+/// per purchase with no branching on the container type, and the bitmaps for a block (27 * 8KB) stay in cache.
+/// </summary>
+ItemIndex::Block ItemIndex::BuildBlock(std::span<const Transaction> transactions)
+{
+    const queries::trace::ScopedEvent event{ "build_item_index_block" };
+
+    std::vector<std::uint64_t> bitmaps(kItems * kBitmapWords);
+    for (std::size_t row = 0; row < transactions.size(); ++row)
+    {
+        const auto purchases = static_cast<std::uint32_t>(transactions[row].purchases.to_ulong());
+        for (std::uint32_t bits = purchases; bits != 0; bits &= bits - 1)
+            bitmaps[std::countr_zero(bits) * kBitmapWords + row / 64] |= std::uint64_t{ 1 } << (row % 64);
+    }
+
+    Block block;
+    for (std::size_t item = 0; item < kItems; ++item)
+    {
+        const std::span<const std::uint64_t> words{ bitmaps.data() + item * kBitmapWords, kBitmapWords };
+
+        Container& container = block[item];
+        container.cardinality = static_cast<std::uint32_t>(PopCount(words));
+
+        if (container.cardinality > kMaxArraySize)
+        {
+            container.bitmap.assign(words.begin(), words.end());
+            continue;
+        }
+
+        container.array.reserve(container.cardinality);
+        for (std::size_t word = 0; word < kBitmapWords; ++word)
+        {
+            for (std::uint64_t bits = words[word]; bits != 0; bits &= bits - 1)
+                container.array.push_back(static_cast<std::uint16_t>(word * 64 + std::countr_zero(bits)));
+        }
+    }
+
+    return block;
+}
+
+void ItemIndex::Append(std::span<const Transaction> transactions)
+{
+    for (const Transaction& transaction : transactions)
+    {
+        const std::size_t block = m_rows / kBlockRows;
+        const auto row = static_cast<std::uint16_t>(m_rows % kBlockRows);
+
+        if (block == m_blocks.size())
+            m_blocks.emplace_back();
+
+        const auto purchases = static_cast<std::uint32_t>(transaction.purchases.to_ulong());
+        for (std::uint32_t bits = purchases; bits != 0; bits &= bits - 1)
+            m_blocks[block][std::countr_zero(bits)].Add(row);
+
+        ++m_rows;
+    }
+}
+
+bool ItemIndex::Contains(int foodID, std::size_t row) const
+{
+    if (row >= m_rows)
+        return false;
+
+    return m_blocks[row / kBlockRows].at(foodID).Contains(static_cast<std::uint16_t>(row % kBlockRows));
+}
+
+/// <summary>
+/// When every container is a bitmap, the bitmaps are ANDed into one buffer and counted, which are both plain
+/// loops over words that the compiler vectorizes. Otherwise the smallest container is an array, and each of
+/// its rows is probed in the others.
+/// </summary>
+std::int64_t ItemIndex::CountBlock(std::span<const Container* const> containers, std::uint32_t begin, std::uint32_t end)
+{
+    if (begin >= end)
+        return 0;
+
+    const Container* smallest = *std::ranges::min_element(containers, {}, &Container::cardinality);
+    if (smallest->cardinality == 0)
+        return 0;
+
+    if (containers.size() == 1)
+        return smallest->CountInRange(begin, end);
+
+    if (smallest->IsBitmap())
+    {
+        const std::size_t first = begin / 64;
+        const std::size_t count = (end + 63) / 64 - first;
+
+        std::array<std::uint64_t, kBitmapWords> words;
+        std::copy_n(containers[0]->bitmap.begin() + first, count, words.begin());
+
+        for (const Container* container : containers.subspan(1))
+        {
+            const std::uint64_t* bitmap = container->bitmap.data() + first;
+            for (std::size_t word = 0; word < count; ++word)
+                words[word] &= bitmap[word];
+        }
+
+        ClipWords({ words.data(), count }, begin, end);
+        return PopCount({ words.data(), count });
+    }
+
+    const auto rows = std::ranges::subrange(std::ranges::lower_bound(smallest->array, begin),
+                                            std::ranges::lower_bound(smallest->array, end));
+
+    return std::ranges::count_if(rows, [containers, smallest](std::uint16_t row) {
+        return std::ranges::all_of(containers, [smallest, row](const Container* container) {
+            return container == smallest || container->Contains(row);
+        });
+    });
+}
+
+std::int64_t ItemIndex::CountAll(std::span<const int> foodIDs, std::size_t firstRow, std::size_t lastRow) const
+{
+    lastRow = std::min(lastRow, m_rows);
+    if (firstRow >= lastRow)
+        return 0;
+
+    if (foodIDs.empty())
+        return static_cast<std::int64_t>(lastRow - firstRow);
+
+    std::vector<const Container*> containers(foodIDs.size());
+
+    std::int64_t count = 0;
+    for (std::size_t block = firstRow / kBlockRows; block <= (lastRow - 1) / kBlockRows; ++block)
+    {
+        for (std::size_t index = 0; index < foodIDs.size(); ++index)
+            containers[index] = &m_blocks[block].at(foodIDs[index]);
+
+        const std::size_t blockStart = block * kBlockRows;
+        const auto begin = static_cast<std::uint32_t>(std::max(firstRow, blockStart) - blockStart);
+        const auto end = static_cast<std::uint32_t>(std::min(lastRow, blockStart + kBlockRows) - blockStart);
+
+        count += CountBlock(containers, begin, end);
+    }
+
+    return count;
+}
+
+std::size_t ItemIndex::MemoryUsage() const
+{
+    std::size_t bytes = 0;
+    for (const Block& block : m_blocks)
+    {
+        for (const Container& container : block)
+            bytes += container.array.capacity() * sizeof(std::uint16_t) + container.bitmap.capacity() * sizeof(std::uint64_t);
+    }
+
+    return bytes;
+}
+} // end bakery namespace
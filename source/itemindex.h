@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <vector>
+
+class ThreadPool;
+
+namespace bakery
+{
+struct Transaction;
+
+/// <summary>
+/// A compressed bitmap per food ID over the rows of a database, answering "how many transactions contained
+/// these items?" without touching the transactions themselves.
+///
+/// It's laid out like a Roaring bitmap: rows are split into blocks of 65536, and each item keeps one container
+/// per block holding the low 16 bits of its rows. A container is a sorted array while it holds at most 4096
+/// rows (8KB at most), and a 1024 word bitmap (also 8KB) once it holds more, so rare items stay small and
+/// common ones are intersected a word at a time. Row IDs are positions in the database, so every item has a
+/// container for every block, and finding a block's container is an index rather than a search.
+/// </summary>
+class ItemIndex
+{
+public:
+    static constexpr std::size_t kItems = 27;
+    static constexpr std::size_t kBlockRows = std::size_t{ 1 } << 16;
+
+    ItemIndex() = default;
+
+    // Indexes the transactions one block per task
+    static ItemIndex Build(std::span<const Transaction> transactions, ThreadPool& pool);
+
+    // Indexes transactions appended after the ones already indexed
+    void Append(std::span<const Transaction> transactions);
+
+    std::size_t Size() const { return m_rows; }
+
+    bool Contains(int foodID, std::size_t row) const;
+
+    /// <summary>
+    /// How many of the rows in [firstRow, lastRow) contain every one of the items. No items matches every row.
+    /// </summary>
+    std::int64_t CountAll(std::span<const int> foodIDs, std::size_t firstRow, std::size_t lastRow) const;
+
+    std::int64_t CountAll(std::initializer_list<int> foodIDs) const
+    {
+        return CountAll(std::span{ foodIDs.begin(), foodIDs.size() }, 0, m_rows);
+    }
+
+    std::int64_t Count(int foodID) const { return CountAll({ foodID }); }
+
+    // The bytes held by the containers, for comparing against scanning the rows
+    std::size_t MemoryUsage() const;
+
+private:
+
+    static constexpr std::size_t kMaxArraySize = 4096;
+    static constexpr std::size_t kBitmapWords = kBlockRows / 64;
+
+    struct Container
+    {
+        // Sorted, while there are no more than kMaxArraySize rows. Afterwards it's empty, and bitmap is used.
+        std::vector<std::uint16_t> array;
+        std::vector<std::uint64_t> bitmap;
+        std::uint32_t cardinality = 0;
+
+        bool IsBitmap() const { return !bitmap.empty(); }
+        bool Contains(std::uint16_t value) const;
+
+        // Values must be added in increasing order
+        void Add(std::uint16_t value);
+        std::int64_t CountInRange(std::uint32_t begin, std::uint32_t end) const;
+    };
+
+    using Block = std::array<Container, kItems>;
+
+    static Block BuildBlock(std::span<const Transaction> transactions);
+    static std::int64_t CountBlock(std::span<const Container* const> containers, std::uint32_t begin, std::uint32_t end);
+
+    std::vector<Block> m_blocks;
+    std::size_t m_rows = 0;
+};
+} // end bakery namespace
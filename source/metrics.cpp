@@ -0,0 +1,75 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace queries::metrics
+{
+namespace detail
+{
+Counters& GetCounters()
+{
+    static Counters counters;
+    return counters;
+}
+} // end detail namespace
+
+Snapshot TakeSnapshot()
+{
+    const detail::Counters& counters = detail::GetCounters();
+
+    Snapshot snapshot;
+    snapshot.rowsScanned = counters.rowsScanned.load(std::memory_order_relaxed);
+    snapshot.bytesTouched = counters.bytesTouched.load(std::memory_order_relaxed);
+    snapshot.chunks = counters.chunks.load(std::memory_order_relaxed);
+    snapshot.chunkingNanos = counters.chunkingNanos.load(std::memory_order_relaxed);
+    snapshot.chunkNanos = counters.chunkNanos.load(std::memory_order_relaxed);
+    snapshot.maxChunkNanos = counters.maxChunkNanos.load(std::memory_order_relaxed);
+    snapshot.queueWaitNanos = counters.queueWaitNanos.load(std::memory_order_relaxed);
+    snapshot.futureWaitNanos = counters.futureWaitNanos.load(std::memory_order_relaxed);
+    snapshot.reduceNanos = counters.reduceNanos.load(std::memory_order_relaxed);
+    snapshot.parallelQueries = counters.parallelQueries.load(std::memory_order_relaxed);
+    snapshot.cacheHits = counters.cacheHits.load(std::memory_order_relaxed);
+    snapshot.cacheMisses = counters.cacheMisses.load(std::memory_order_relaxed);
+
+    if (snapshot.parallelQueries > 0)
+        snapshot.imbalance = counters.imbalanceMilli.load(std::memory_order_relaxed) / 1000.0 / snapshot.parallelQueries;
+
+    return snapshot;
+}
+
+void Reset()
+{
+    detail::Counters& counters = detail::GetCounters();
+
+    for (auto* counter : { &counters.rowsScanned, &counters.bytesTouched, &counters.chunks, &counters.chunkingNanos,
+                           &counters.chunkNanos, &counters.maxChunkNanos, &counters.queueWaitNanos,
+                           &counters.futureWaitNanos, &counters.reduceNanos, &counters.parallelQueries,
+                           &counters.imbalanceMilli, &counters.cacheHits, &counters.cacheMisses })
+    {
+        counter->store(0, std::memory_order_relaxed);
+    }
+}
+
+void ChunkTimes::Commit() const
+{
+    if constexpr (kEnabled)
+    {
+        if (m_nanos.empty())
+            return;
+
+        detail::Counters& counters = detail::GetCounters();
+
+        const std::uint64_t total = std::accumulate(m_nanos.cbegin(), m_nanos.cend(), std::uint64_t{ 0 });
+        const std::uint64_t slowest = *std::ranges::max_element(m_nanos);
+        const double mean = static_cast<double>(total) / m_nanos.size();
+
+        detail::Add(counters.chunks, m_nanos.size());
+        detail::Add(counters.chunkNanos, total);
+        detail::Max(counters.maxChunkNanos, slowest);
+
+        detail::Add(counters.parallelQueries, 1);
+        detail::Add(counters.imbalanceMilli, mean > 0.0 ? static_cast<std::uint64_t>(slowest / mean * 1000.0) : 1000);
+    }
+}
+} // end queries::metrics namespace
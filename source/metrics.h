@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace queries::metrics
+{
+/// <summary>
+/// Instrumentation is compiled in only when QUERY_METRICS is defined (see the QUERY_METRICS cmake option).
+/// Every recording function below is an inline no-op otherwise, and doesn't even read the clock.
+/// </summary>
+#if defined(QUERY_METRICS)
+inline constexpr bool kEnabled = true;
+#else
+inline constexpr bool kEnabled = false;
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+/// <summary>
+/// A point in time view of everything recorded since the last Reset(). Times are in nanoseconds.
+/// </summary>
+struct Snapshot
+{
+    std::uint64_t rowsScanned = 0;
+    std::uint64_t bytesTouched = 0;
+
+    std::uint64_t chunks = 0;
+    std::uint64_t chunkingNanos = 0;
+    std::uint64_t chunkNanos = 0;
+    std::uint64_t maxChunkNanos = 0;
+    std::uint64_t queueWaitNanos = 0;
+    std::uint64_t futureWaitNanos = 0;
+    std::uint64_t reduceNanos = 0;
+
+    // Worker imbalance is the slowest chunk over the mean chunk, averaged over every parallel query.
+    // A perfectly balanced query has an imbalance of 1.0
+    std::uint64_t parallelQueries = 0;
+    double imbalance = 0.0;
+
+    std::uint64_t cacheHits = 0;
+    std::uint64_t cacheMisses = 0;
+
+    double MeanChunkNanos() const { return chunks == 0 ? 0.0 : static_cast<double>(chunkNanos) / chunks; }
+    double CacheHitRatio() const
+    {
+        const std::uint64_t lookups = cacheHits + cacheMisses;
+        return lookups == 0 ? 0.0 : static_cast<double>(cacheHits) / lookups;
+    }
+};
+
+Snapshot TakeSnapshot();
+void Reset();
+
+namespace detail
+{
+struct Counters
+{
+    std::atomic<std::uint64_t> rowsScanned = 0;
+    std::atomic<std::uint64_t> bytesTouched = 0;
+    std::atomic<std::uint64_t> chunks = 0;
+    std::atomic<std::uint64_t> chunkingNanos = 0;
+    std::atomic<std::uint64_t> chunkNanos = 0;
+    std::atomic<std::uint64_t> maxChunkNanos = 0;
+    std::atomic<std::uint64_t> queueWaitNanos = 0;
+    std::atomic<std::uint64_t> futureWaitNanos = 0;
+    std::atomic<std::uint64_t> reduceNanos = 0;
+    std::atomic<std::uint64_t> parallelQueries = 0;
+    std::atomic<std::uint64_t> imbalanceMilli = 0;
+    std::atomic<std::uint64_t> cacheHits = 0;
+    std::atomic<std::uint64_t> cacheMisses = 0;
+};
+
+Counters& GetCounters();
+
+inline std::uint64_t Since(Clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+inline void Add(std::atomic<std::uint64_t>& counter, std::uint64_t value)
+{
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+inline void Max(std::atomic<std::uint64_t>& counter, std::uint64_t value)
+{
+    std::uint64_t current = counter.load(std::memory_order_relaxed);
+    while (current < value && !counter.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        ;
+}
+} // end detail namespace
+
+inline Clock::time_point Now()
+{
+    if constexpr (kEnabled)
+        return Clock::now();
+    else
+        return {};
+}
+
+inline void RecordRows(std::size_t rows, std::size_t bytes)
+{
+    if constexpr (kEnabled)
+    {
+        detail::Add(detail::GetCounters().rowsScanned, rows);
+        detail::Add(detail::GetCounters().bytesTouched, bytes);
+    }
+}
+
+inline void RecordChunking(Clock::time_point start)
+{
+    if constexpr (kEnabled)
+        detail::Add(detail::GetCounters().chunkingNanos, detail::Since(start));
+}
+
+inline void RecordQueueWait(Clock::time_point queued)
+{
+    if constexpr (kEnabled)
+        detail::Add(detail::GetCounters().queueWaitNanos, detail::Since(queued));
+}
+
+inline void RecordFutureWait(Clock::time_point start)
+{
+    if constexpr (kEnabled)
+        detail::Add(detail::GetCounters().futureWaitNanos, detail::Since(start));
+}
+
+inline void RecordReduce(Clock::time_point start)
+{
+    if constexpr (kEnabled)
+        detail::Add(detail::GetCounters().reduceNanos, detail::Since(start));
+}
+
+inline void RecordCacheLookup(bool hit)
+{
+    if constexpr (kEnabled)
+        detail::Add(hit ? detail::GetCounters().cacheHits : detail::GetCounters().cacheMisses, 1);
+}
+
+/// <summary>
+/// Collects the wall time of each chunk in a single parallel query. Each worker only writes to its own
+/// slot, so recording is contention free, and the imbalance is computed once the query is done.
+/// </summary>
+class ChunkTimes
+{
+public:
+    explicit ChunkTimes(std::size_t numChunks)
+    {
+        if constexpr (kEnabled)
+            m_nanos.resize(numChunks);
+    }
+
+    void Record(std::size_t chunkIndex, Clock::time_point start)
+    {
+        if constexpr (kEnabled)
+            m_nanos[chunkIndex] = detail::Since(start);
+    }
+
+    void Commit() const;
+
+private:
+    std::vector<std::uint64_t> m_nanos;
+};
+} // end queries::metrics namespace
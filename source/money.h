@@ -0,0 +1,56 @@
+#pragma once
+
+#include "bakery.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace queries
+{
+/// <summary>
+/// Money is aggregated in whole cents, as a 64-bit integer. Integer addition is associative, so unlike a
+/// floating point sum, a total doesn't depend on how the work was chunked or how many threads did it.
+/// </summary>
+using Cents = std::int64_t;
+
+namespace detail
+{
+using PriceTable = std::array<Cents, 27>;
+
+inline PriceTable GetPricesInCents(const bakery::Database& database)
+{
+    PriceTable prices{};
+    for (std::size_t foodID = 0; foodID < prices.size(); ++foodID)
+        prices[foodID] = std::llround(database.GetFood(static_cast<int>(foodID)).cost * 100.0);
+
+    return prices;
+}
+
+/// <summary>
+/// Sums the prices of a ticket's purchases straight from its bitmask. Each price is masked in or out by its
+/// bit rather than branched on, and the purchases are never materialized, so the loop vectorizes.
+/// </summary>
+inline Cents GetSubtotal(const PriceTable& prices, std::uint32_t purchases)
+{
+    Cents subtotal = 0;
+    for (std::size_t foodID = 0; foodID < prices.size(); ++foodID)
+        subtotal += prices[foodID] & -static_cast<Cents>((purchases >> foodID) & 1);
+
+    return subtotal;
+}
+
+inline Cents GetSubtotal(const PriceTable& prices, const bakery::Transaction& transaction)
+{
+    return GetSubtotal(prices, static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+}
+
+/// <summary>
+/// The tip is rounded to the nearest cent per ticket, so it only ever depends on that one ticket.
+/// </summary>
+inline Cents GetGratuity(const PriceTable& prices, const bakery::Transaction& transaction)
+{
+    return std::llround(static_cast<double>(GetSubtotal(prices, transaction)) * transaction.gratuity);
+}
+} // end detail namespace
+} // end queries namespace
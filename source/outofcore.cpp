@@ -0,0 +1,399 @@
+#include "outofcore.h"
+#include "compression.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#ifdef MONOID_HAS_LIBURING
+#include <fcntl.h>
+#include <liburing.h>
+#include <unistd.h>
+#endif
+
+namespace queries::outofcore
+{
+namespace detail
+{
+namespace
+{
+/// <summary>
+/// The fallback: one thread that works through the submitted reads in order, with its own stream.
+/// </summary>
+class ThreadBlockReader : public BlockReader
+{
+public:
+    explicit ThreadBlockReader(const std::filesystem::path& file) : m_stream(file, std::ios::binary)
+    {
+        if (!m_stream)
+            throw std::runtime_error{ "Couldn't open " + file.string() };
+
+        m_thread = std::thread{ &ThreadBlockReader::Read, this };
+    }
+
+    ~ThreadBlockReader() override
+    {
+        {
+            std::lock_guard lock{ m_mutex };
+            m_stopping = true;
+        }
+
+        m_condition.notify_all();
+        m_thread.join();
+    }
+
+    void Submit(std::size_t slot, std::uint64_t offset, std::span<std::byte> buffer) override
+    {
+        {
+            std::lock_guard lock{ m_mutex };
+            m_slots[slot] = Slot{ .offset = offset, .buffer = buffer, .bytes = 0, .error = nullptr, .done = false };
+            m_queue.push_back(slot);
+        }
+
+        m_condition.notify_all();
+    }
+
+    std::size_t Wait(std::size_t slot) override
+    {
+        std::unique_lock lock{ m_mutex };
+        m_condition.wait(lock, [this, slot]() { return m_slots[slot].done; });
+
+        if (m_slots[slot].error)
+            std::rethrow_exception(m_slots[slot].error);
+
+        return m_slots[slot].bytes;
+    }
+
+    IoBackend Backend() const override { return IoBackend::eThreads; }
+
+private:
+    struct Slot
+    {
+        std::uint64_t offset = 0;
+        std::span<std::byte> buffer;
+        std::size_t bytes = 0;
+        std::exception_ptr error;
+        bool done = false;
+    };
+
+    void Read()
+    {
+        for (;;)
+        {
+            std::size_t slot = 0;
+            Slot request;
+
+            {
+                std::unique_lock lock{ m_mutex };
+                m_condition.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+
+                if (m_queue.empty())
+                    return;
+
+                slot = m_queue.front();
+                m_queue.pop_front();
+                request = m_slots[slot];
+            }
+
+            try
+            {
+                m_stream.clear();
+                m_stream.seekg(static_cast<std::streamoff>(request.offset));
+                m_stream.read(reinterpret_cast<char*>(request.buffer.data()), static_cast<std::streamsize>(request.buffer.size()));
+
+                if (m_stream.bad())
+                    throw std::runtime_error{ "Couldn't read from the snapshot." };
+
+                request.bytes = static_cast<std::size_t>(m_stream.gcount());
+            }
+            catch (...)
+            {
+                request.error = std::current_exception();
+            }
+
+            {
+                std::lock_guard lock{ m_mutex };
+                request.done = true;
+                m_slots[slot] = request;
+            }
+
+            m_condition.notify_all();
+        }
+    }
+
+    std::ifstream m_stream;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::array<Slot, kSlots> m_slots;
+    std::deque<std::size_t> m_queue;
+    bool m_stopping = false;
+
+    std::thread m_thread;
+};
+
+#ifdef MONOID_HAS_LIBURING
+/// <summary>
+/// Both slots' reads go through one ring, so a read is queued with a single submit and no thread of our own.
+/// Completions can arrive in any order, so waiting on a slot stashes the other slot's completion if it comes
+/// first.
+/// </summary>
+class UringBlockReader : public BlockReader
+{
+public:
+    explicit UringBlockReader(const std::filesystem::path& file)
+    {
+        m_file = open(file.c_str(), O_RDONLY);
+        if (m_file < 0)
+            throw std::system_error{ errno, std::generic_category(), "Couldn't open " + file.string() };
+
+        if (const int result = io_uring_queue_init(kSlots, &m_ring, 0); result < 0)
+        {
+            close(m_file);
+            throw std::system_error{ -result, std::generic_category(), "Couldn't set up io_uring" };
+        }
+    }
+
+    ~UringBlockReader() override
+    {
+        // The kernel may still be writing into a buffer, so every read in flight is finished first
+        for (std::size_t slot = 0; slot < kSlots; ++slot)
+        {
+            if (m_inFlight[slot])
+                Complete(slot);
+        }
+
+        io_uring_queue_exit(&m_ring);
+        close(m_file);
+    }
+
+    void Submit(std::size_t slot, std::uint64_t offset, std::span<std::byte> buffer) override
+    {
+        io_uring_sqe* entry = io_uring_get_sqe(&m_ring);
+        if (entry == nullptr)
+            throw std::logic_error{ "Every io_uring slot is already in flight." };
+
+        io_uring_prep_read(entry, m_file, buffer.data(), static_cast<unsigned>(buffer.size()), offset);
+        io_uring_sqe_set_data(entry, reinterpret_cast<void*>(static_cast<std::uintptr_t>(slot)));
+
+        if (const int result = io_uring_submit(&m_ring); result < 0)
+            throw std::system_error{ -result, std::generic_category(), "Couldn't submit a read" };
+
+        m_inFlight[slot] = true;
+        m_results[slot].reset();
+    }
+
+    std::size_t Wait(std::size_t slot) override
+    {
+        const int result = Complete(slot);
+        if (result < 0)
+            throw std::system_error{ -result, std::generic_category(), "Couldn't read from the snapshot" };
+
+        return static_cast<std::size_t>(result);
+    }
+
+    IoBackend Backend() const override { return IoBackend::eIoUring; }
+
+private:
+    int Complete(std::size_t slot)
+    {
+        while (!m_results[slot])
+        {
+            io_uring_cqe* completion = nullptr;
+            if (const int result = io_uring_wait_cqe(&m_ring, &completion); result < 0)
+                return result;
+
+            const auto completed = static_cast<std::size_t>(reinterpret_cast<std::uintptr_t>(io_uring_cqe_get_data(completion)));
+            m_results[completed] = completion->res;
+            m_inFlight[completed] = false;
+
+            io_uring_cqe_seen(&m_ring, completion);
+        }
+
+        return *m_results[slot];
+    }
+
+    int m_file = -1;
+    io_uring m_ring{};
+    std::array<bool, kSlots> m_inFlight{};
+    std::array<std::optional<int>, kSlots> m_results;
+};
+#endif
+} // end unnamed namespace
+
+std::unique_ptr<BlockReader> OpenBlockReader(const std::filesystem::path& file)
+{
+#ifdef MONOID_HAS_LIBURING
+    try
+    {
+        return std::make_unique<UringBlockReader>(file);
+    }
+    catch (const std::system_error&)
+    {
+        // io_uring can be compiled in and still be turned off (e.g. by a seccomp policy), so fall through
+    }
+#endif
+
+    return std::make_unique<ThreadBlockReader>(file);
+}
+} // end detail namespace
+
+OutOfCoreExecutor::OutOfCoreExecutor(const std::filesystem::path& snapshot, std::size_t memoryBudget)
+{
+    std::size_t blockBytes = 0;
+
+    if (const std::optional<bakery::CompressedIndex> index = bakery::ReadCompressedIndex(snapshot))
+    {
+        // The blocks were sized when the file was written, so all that's left is to check they fit
+        m_rows = index->header.count;
+        m_blockRows = std::min<std::size_t>(index->header.blockRows, std::max<std::size_t>(m_rows, 1));
+        m_offsets = index->offsets;
+
+        for (std::size_t block = 0; block + 1 < m_offsets.size(); ++block)
+            blockBytes = std::max<std::size_t>(blockBytes, m_offsets[block + 1] - m_offsets[block]);
+    }
+    else
+    {
+        std::ifstream stream{ snapshot, std::ios::binary };
+
+        bakery::SnapshotHeader header;
+        if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            header.magic != bakery::SnapshotHeader::kMagic ||
+            header.version != bakery::SnapshotHeader::kVersion ||
+            header.recordSize != sizeof(bakery::TransactionRecord))
+        {
+            throw std::runtime_error{ snapshot.string() + " isn't a snapshot." };
+        }
+
+        if (memoryBudget / kBytesPerRow < kMinBlockRows)
+            throw std::invalid_argument{ "The memory budget can't hold even the smallest blocks." };
+
+        m_rows = header.count;
+
+        // There's no point in blocks bigger than the whole snapshot
+        m_blockRows = std::max(kMinBlockRows, std::min<std::size_t>(memoryBudget / kBytesPerRow, m_rows));
+        blockBytes = m_blockRows * sizeof(bakery::TransactionRecord);
+    }
+
+    for (auto& buffer : m_buffers)
+        buffer.resize(blockBytes);
+
+    m_block.resize(m_blockRows);
+
+    if (MemoryUsage() > memoryBudget)
+        throw std::invalid_argument{ "The memory budget can't hold the snapshot's blocks." };
+
+    m_reader = detail::OpenBlockReader(snapshot);
+}
+
+std::size_t OutOfCoreExecutor::MemoryUsage() const
+{
+    return m_buffers.size() * m_buffers[0].size() + m_block.size() * sizeof(bakery::Transaction);
+}
+
+void OutOfCoreExecutor::ReadBlocks(const std::function<void(std::span<const std::byte>, std::size_t)>& consume)
+{
+    const std::size_t blocks = (m_rows + m_blockRows - 1) / m_blockRows;
+
+    // Where each block is in the file: from the index when it's compressed, and by its rows when it's not
+    const auto Extent = [this](std::size_t block) -> std::pair<std::uint64_t, std::size_t> {
+        if (!m_offsets.empty())
+            return { m_offsets[block], m_offsets[block + 1] - m_offsets[block] };
+
+        const std::size_t first = block * m_blockRows;
+        return { sizeof(bakery::SnapshotHeader) + first * sizeof(bakery::TransactionRecord),
+                 std::min(m_blockRows, m_rows - first) * sizeof(bakery::TransactionRecord) };
+    };
+
+    const auto Submit = [&](std::size_t block) {
+        const auto [offset, bytes] = Extent(block);
+        m_reader->Submit(block % m_buffers.size(), offset, std::span{ m_buffers[block % m_buffers.size()] }.first(bytes));
+    };
+
+    if (blocks == 0)
+        return;
+
+    Submit(0);
+
+    for (std::size_t block = 0; block < blocks; ++block)
+    {
+        const std::size_t count = std::min(m_blockRows, m_rows - block * m_blockRows);
+        const std::size_t bytes = Extent(block).second;
+
+        if (m_reader->Wait(block % m_buffers.size()) != bytes)
+            throw std::runtime_error{ "The snapshot is shorter than its header says." };
+
+        // The next block is read while this one is consumed
+        if (block + 1 < blocks)
+            Submit(block + 1);
+
+        try
+        {
+            consume(std::span{ m_buffers[block % m_buffers.size()] }.first(bytes), count);
+        }
+        catch (...)
+        {
+            // The read ahead is writing into a buffer this owns, so it has to land before unwinding
+            if (block + 1 < blocks)
+            {
+                try
+                {
+                    m_reader->Wait((block + 1) % m_buffers.size());
+                }
+                catch (...)
+                {
+                    // It's landed either way, and the first error is the one worth reporting
+                }
+            }
+
+            throw;
+        }
+    }
+}
+
+void OutOfCoreExecutor::ForEachBlock(const std::function<void(std::span<const bakery::Transaction>)>& reduce)
+{
+    ReadBlocks([&](std::span<const std::byte> buffer, std::size_t count) {
+        if (!m_offsets.empty())
+        {
+            if (bakery::DecodeBlock(buffer, m_block) != count)
+                throw std::runtime_error{ "A compressed block holds the wrong number of rows." };
+        }
+        else
+        {
+            for (std::size_t row = 0; row < count; ++row)
+            {
+                bakery::TransactionRecord record;
+                std::memcpy(&record, buffer.data() + row * sizeof(record), sizeof(record));
+
+                m_block[row] = bakery::Transaction{
+                    .orderNumber = record.orderNumber,
+                    .gratuity = record.gratuity,
+                    .purchases = record.purchases
+                };
+            }
+        }
+
+        reduce(std::span<const bakery::Transaction>{ m_block }.first(count));
+    });
+}
+
+void OutOfCoreExecutor::ForEachBlockView(const std::function<void(const bakery::CompressedBlockView&)>& reduce)
+{
+    ReadBlocks([&](std::span<const std::byte> buffer, std::size_t count) {
+        const bakery::CompressedBlockView view{ buffer };
+        if (view.Rows() != count)
+            throw std::runtime_error{ "A compressed block holds the wrong number of rows." };
+
+        reduce(view);
+    });
+}
+} // end queries::outofcore namespace
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "bakery.h"
+#include "compression.h"
+#include "queries.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace queries::outofcore
+{
+enum class IoBackend
+{
+    eThreads,
+    eIoUring
+};
+
+namespace detail
+{
+/// <summary>
+/// Reads ranges of a file in the background, with up to two reads (slots) in flight. io_uring is used when
+/// it's compiled in (MONOID_HAS_LIBURING) and the kernel allows it, and a reader thread otherwise.
+/// </summary>
+class BlockReader
+{
+public:
+    static constexpr std::size_t kSlots = 2;
+
+    virtual ~BlockReader() = default;
+
+    // Starts reading buffer.size() bytes from offset into buffer. The slot mustn't already have a read in flight.
+    virtual void Submit(std::size_t slot, std::uint64_t offset, std::span<std::byte> buffer) = 0;
+
+    // Waits for the slot's read, and returns how many bytes it read. Throws if the read failed.
+    virtual std::size_t Wait(std::size_t slot) = 0;
+
+    virtual IoBackend Backend() const = 0;
+};
+
+std::unique_ptr<BlockReader> OpenBlockReader(const std::filesystem::path& file);
+} // end detail namespace
+
+/// <summary>
+/// Runs queries over a snapshot that needn't fit in memory, by streaming it a block at a time. While one
+/// block is converted and reduced, the next is already being read, so the reduction overlaps the I/O and a
+/// cheap query runs at about the disk's sequential read rate. Blocks are reduced in order, each into the
+/// running monoid, so results are the same as the sequential strategy's over the loaded snapshot.
+///
+/// Memory is bounded by the budget: it holds two blocks of records (the one being read, and the one being
+/// converted) and one block of transactions, and blocks are sized to fit. Nothing else grows with the file.
+///
+/// A compressed snapshot (see SaveCompressed) is read the same way, a compressed block at a time. A query
+/// with MapBlock maps each block from its columns, without building its rows; any other query has each block
+/// decoded straight into the block of transactions. Its blocks were sized when it was written, so the budget
+/// only has to hold them. Reading a fraction of the bytes, it scans that much faster when it's I/O bound.
+/// </summary>
+class OutOfCoreExecutor
+{
+public:
+    static constexpr std::size_t kDefaultMemoryBudget = std::size_t{ 64 } << 20;
+    static constexpr std::size_t kMinBlockRows = 1024;
+
+    // What each row of a block costs: a record in each read buffer, and the transaction it's converted to
+    static constexpr std::size_t kBytesPerRow = detail::BlockReader::kSlots * sizeof(bakery::TransactionRecord) +
+                                                sizeof(bakery::Transaction);
+
+    /// <summary>
+    /// Opens the snapshot, and sizes the blocks to the budget. Throws if the file isn't a snapshot, or the
+    /// budget can't hold blocks of even kMinBlockRows (or a compressed snapshot's blocks).
+    /// </summary>
+    explicit OutOfCoreExecutor(const std::filesystem::path& snapshot, std::size_t memoryBudget = kDefaultMemoryBudget);
+
+    std::size_t Size() const { return m_rows; }
+    std::size_t BlockRows() const { return m_blockRows; }
+    std::size_t MemoryUsage() const;
+    IoBackend Backend() const { return m_reader->Backend(); }
+
+    // Builds the query from the given arguments, like ShardedExecutor::Run
+    template<typename Query, typename... Args>
+    typename Query::Result Run(const Args&... args)
+    {
+        const Query query{ m_database, args... };
+
+        typename Query::Monoid aggregate{};
+
+        if constexpr (queries::detail::MapsBlocks<Query>)
+        {
+            if (!m_offsets.empty())
+            {
+                ForEachBlockView([&](const bakery::CompressedBlockView& block) {
+                    aggregate = Query::Reduce(aggregate, query.MapBlock(block));
+                });
+
+                return Query::Finalize(aggregate);
+            }
+        }
+
+        ForEachBlock([&](std::span<const bakery::Transaction> block) {
+            aggregate = Query::Reduce(aggregate, queries::detail::MapReduce(block, queries::detail::Mapper(query),
+                                                                             queries::detail::Reducer<Query>()));
+        });
+
+        return Query::Finalize(aggregate);
+    }
+
+private:
+    // Hands reduce every block of the snapshot in order. Throws if the snapshot turns out to be short.
+    void ForEachBlock(const std::function<void(std::span<const bakery::Transaction>)>& reduce);
+
+    // The same for a compressed snapshot, but handing over each block's columns rather than decoding its rows
+    void ForEachBlockView(const std::function<void(const bakery::CompressedBlockView&)>& reduce);
+
+    // Reads every block in order, handing over its bytes and how many rows it should hold
+    void ReadBlocks(const std::function<void(std::span<const std::byte>, std::size_t)>& consume);
+
+    // The queries look foods up in a database, which is all this one's for, so it holds no transactions
+    const bakery::Database m_database;
+
+    std::unique_ptr<detail::BlockReader> m_reader;
+    std::size_t m_rows = 0;
+    std::size_t m_blockRows = 0;
+
+    // Where each compressed block starts (and the last ends), or empty for an uncompressed snapshot
+    std::vector<std::uint64_t> m_offsets;
+
+    std::array<std::vector<std::byte>, detail::BlockReader::kSlots> m_buffers;
+    std::vector<bakery::Transaction> m_block;
+};
+} // end queries::outofcore namespace
@@ -0,0 +1,283 @@
+#include "planner.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <functional>
+#include <limits>
+
+namespace queries
+{
+namespace
+{
+// Calls over fewer rows than this take too little time to say anything about a query's cost
+constexpr std::size_t kMinLearnRows = 4096;
+
+// How far each measured call moves a query's weight towards what it measured
+constexpr double kLearnRate = 0.25;
+
+double NanosSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+} // end anonymous namespace
+
+Calibration Calibration::Measure(std::size_t threadCount)
+{
+    constexpr std::size_t kRows = std::size_t{ 1 } << 18;
+    constexpr std::size_t kSmallRows = 1024;
+    constexpr int kRuns = 5;
+
+    const bakery::Database database{ kRows, true };
+    const std::span<const bakery::Transaction> transactions = database.GetTransactions();
+
+    Sequential sequential{ database };
+    MapReduceParallel parallel{ database, std::max<std::size_t>(threadCount, 1) };
+
+    // The fastest of a few runs, which is the one least disturbed by whatever else the host is doing
+    const auto Time = [](QueryStrategies& strategy, std::span<const bakery::Transaction> span) {
+        double best = std::numeric_limits<double>::infinity();
+        for (int run = 0; run < kRuns; ++run)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            [[maybe_unused]] volatile Cents revenue = strategy.GetRevenue(span);
+            best = std::min(best, NanosSince(start));
+        }
+
+        return best;
+    };
+
+    const double sequentialNanos = Time(sequential, transactions);
+    const double parallelNanos = Time(parallel, transactions);
+    const double parallelSmallNanos = Time(parallel, transactions.first(kSmallRows));
+
+    Calibration calibration;
+    calibration.sequentialNanosPerRow = std::max(sequentialNanos / kRows, 1e-3);
+
+    // The pool can't do better than a linear speedup, or worse than one thread, whatever the timer says
+    const double threads = static_cast<double>(std::max<std::size_t>(threadCount, 1));
+    calibration.parallelNanosPerRow = std::clamp((parallelNanos - parallelSmallNanos) / (kRows - kSmallRows),
+                                                 calibration.sequentialNanosPerRow / threads, calibration.sequentialNanosPerRow);
+    calibration.parallelOverheadNanos = std::max(parallelSmallNanos - calibration.parallelNanosPerRow * kSmallRows, 0.0);
+
+    return calibration;
+}
+
+std::size_t Calibration::ParallelCrossover(double weight) const
+{
+    const double saving = weight * (sequentialNanosPerRow - parallelNanosPerRow);
+    if (saving <= 0.0)
+        return std::numeric_limits<std::size_t>::max();
+
+    return static_cast<std::size_t>(parallelOverheadNanos / saving) + 1;
+}
+
+Planner::Planner(const bakery::Database& database, std::size_t threadCount)
+    : Planner(database, threadCount, Calibration::Measure(threadCount))
+{}
+
+Planner::Planner(const bakery::Database& database, std::size_t threadCount, const Calibration& calibration)
+    : QueryStrategies(database), m_sequential(database), m_incremental(database),
+      m_parallel(database, std::max<std::size_t>(threadCount, 1)), m_calibration(calibration)
+{}
+
+bool Planner::IsDatabasePrefix(const std::span<const bakery::Transaction>& span) const
+{
+    const auto& transactions = m_database.GetTransactions();
+
+    return !span.empty() && span.data() == transactions.data() && span.size() <= transactions.size();
+}
+
+Planner::Plan Planner::Choose(Query query, const std::span<const bakery::Transaction>& span)
+{
+    QueryState& state = m_queries[static_cast<std::size_t>(query)];
+    const auto rows = static_cast<double>(span.size());
+
+    const double sequential = state.weight * m_calibration.sequentialNanosPerRow * rows;
+    const double parallel = m_calibration.parallelOverheadNanos + state.weight * m_calibration.parallelNanosPerRow * rows;
+
+    const Plan fastest = parallel < sequential ? Plan::eParallel : Plan::eSequential;
+    if (!IsCacheable(query) || !IsDatabasePrefix(span))
+        return fastest;
+
+    ++state.prefixCalls;
+
+    // The cache can only grow, so a shorter prefix than it covers is scanned the ordinary way
+    if (state.cachedRows)
+    {
+        if (*state.cachedRows > span.size())
+            return fastest;
+
+        const double incremental = state.weight * m_calibration.sequentialNanosPerRow * static_cast<double>(span.size() - *state.cachedRows);
+
+        return incremental <= std::min(sequential, parallel) ? Plan::eIncremental : fastest;
+    }
+
+    // Building the cache costs a sequential scan. That's free when a sequential scan is the fastest anyway,
+    // and worth paying once a prefix is asked for again, since every call after it only scans what's new.
+    if (fastest == Plan::eSequential || state.prefixCalls > 1)
+        return Plan::eIncremental;
+
+    return fastest;
+}
+
+template<typename Function>
+auto Planner::Execute(Query query, const std::span<const bakery::Transaction>& span, const Function& function)
+{
+    QueryState& state = m_queries[static_cast<std::size_t>(query)];
+
+    const Plan plan = Choose(query, span);
+    QueryStrategies& strategy = plan == Plan::eParallel ? static_cast<QueryStrategies&>(m_parallel)
+                              : plan == Plan::eIncremental ? static_cast<QueryStrategies&>(m_incremental)
+                              : static_cast<QueryStrategies&>(m_sequential);
+
+    // The incremental strategy only scans the rows past its cache
+    const std::size_t rows = plan == Plan::eIncremental ? span.size() - state.cachedRows.value_or(0) : span.size();
+
+    const auto start = std::chrono::steady_clock::now();
+    auto result = function(strategy);
+    const double nanos = NanosSince(start);
+
+    if (plan == Plan::eIncremental)
+        state.cachedRows = span.size();
+
+    if (rows >= kMinLearnRows)
+    {
+        const double measured = plan == Plan::eParallel
+            ? std::max(nanos - m_calibration.parallelOverheadNanos, 0.0) / (rows * m_calibration.parallelNanosPerRow)
+            : nanos / (rows * m_calibration.sequentialNanosPerRow);
+
+        state.weight = std::clamp(state.weight + kLearnRate * (measured - state.weight), 0.1, 1000.0);
+    }
+
+    m_lastPlan = plan;
+
+    return result;
+}
+
+std::optional<std::vector<int>> Planner::IndexableItems(const predicates::Predicate& predicate)
+{
+    if (predicate.Terms().size() != 1)
+        return std::nullopt;
+
+    // A term that only needs items is one whose other tests are all left as they were
+    const predicates::detail::Conjunction& term = predicate.Terms().front();
+    if (std::ranges::any_of(term.anyOf, [](std::uint32_t mask) { return mask != 0; }) ||
+        term.minItems != 0 || term.maxItems != 27 || term.NeedsTotal() ||
+        term.minGratuity != -std::numeric_limits<double>::infinity())
+    {
+        return std::nullopt;
+    }
+
+    std::vector<int> foodIDs;
+    for (std::uint32_t mask = term.allOf; mask != 0; mask &= mask - 1)
+        foodIDs.push_back(std::countr_zero(mask));
+
+    return foodIDs;
+}
+
+void Planner::RunChunks(std::size_t chunkCount, std::size_t chunkRows, const CancellationToken& token, const std::function<void(std::size_t)>& work)
+{
+    // The chunks could be any query's, so they're costed like the calibration's
+    if (chunkCount * chunkRows >= m_calibration.ParallelCrossover())
+    {
+        m_lastPlan = Plan::eParallel;
+        m_parallel.RunChunks(chunkCount, chunkRows, token, work);
+    }
+    else
+    {
+        m_lastPlan = Plan::eSequential;
+        m_sequential.RunChunks(chunkCount, chunkRows, token, work);
+    }
+}
+
+MinMaxFood Planner::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::ePopularItems, span, [&span](QueryStrategies& strategy) { return strategy.GetGreatestAndLeastPopularItems(span); });
+}
+
+std::size_t Planner::GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eOver15, span, [&span](QueryStrategies& strategy) { return strategy.GetNumberOfTransactionsOver15(span); });
+}
+
+std::size_t Planner::GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eLargestPurchase, span, [&span](QueryStrategies& strategy) { return strategy.GetLargestNumberOfPurachasesMade(span); });
+}
+
+Cents Planner::GetRevenue(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eRevenue, span, [&span](QueryStrategies& strategy) { return strategy.GetRevenue(span); });
+}
+
+Cents Planner::GetTotalGratuity(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eGratuity, span, [&span](QueryStrategies& strategy) { return strategy.GetTotalGratuity(span); });
+}
+
+Cents Planner::GetAverageTicket(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eAverageTicket, span, [&span](QueryStrategies& strategy) { return strategy.GetAverageTicket(span); });
+}
+
+std::vector<HeavyHitter> Planner::GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    return Execute(Query::eTopItems, span, [&span, count](QueryStrategies& strategy) { return strategy.GetTopItems(span, count); });
+}
+
+std::vector<HeavyHitter> Planner::GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    return Execute(Query::eTopBaskets, span, [&span, count](QueryStrategies& strategy) { return strategy.GetTopBaskets(span, count); });
+}
+
+CoPurchaseMatrix Planner::GetCoPurchases(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eCoPurchases, span, [&span](QueryStrategies& strategy) { return strategy.GetCoPurchases(span); });
+}
+
+std::size_t Planner::GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
+{
+    // The index answers a span of the database (not just a prefix) with a few bitmap words per block per item,
+    // which is far below what scanning the block costs, so it's taken whenever it can be
+    const bakery::ItemIndex* index = m_database.GetItemIndex();
+    const auto& transactions = m_database.GetTransactions();
+    const bool inDatabase = !span.empty() &&
+                            std::less_equal<>{}(transactions.data(), span.data()) &&
+                            std::less_equal<>{}(span.data() + span.size(), transactions.data() + transactions.size());
+
+    if (index != nullptr && inDatabase)
+    {
+        const auto firstRow = static_cast<std::size_t>(span.data() - transactions.data());
+        const auto foodIDs = IndexableItems(predicate);
+
+        if (foodIDs && firstRow + span.size() <= index->Size())
+        {
+            m_lastPlan = Plan::eIndex;
+            return static_cast<std::size_t>(index->CountAll(*foodIDs, firstRow, firstRow + span.size()));
+        }
+    }
+
+    return Execute(Query::eCountWhere, span, [&span, &predicate](QueryStrategies& strategy) { return strategy.GetNumberOfTransactionsWhere(span, predicate); });
+}
+
+Cents Planner::GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
+{
+    return Execute(Query::eRevenueWhere, span, [&span, &predicate](QueryStrategies& strategy) { return strategy.GetRevenueWhere(span, predicate); });
+}
+
+TicketTotalDistribution Planner::GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eTicketDistribution, span, [&span](QueryStrategies& strategy) { return strategy.GetTicketTotalDistribution(span); });
+}
+
+QuantileSketch Planner::GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eTicketQuantiles, span, [&span](QueryStrategies& strategy) { return strategy.GetTicketTotalQuantiles(span); });
+}
+
+QuantileSketch Planner::GetGratuityQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    return Execute(Query::eGratuityQuantiles, span, [&span](QueryStrategies& strategy) { return strategy.GetGratuityQuantiles(span); });
+}
+} // end queries namespace
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "bakery.h"
+#include "queries.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace queries
+{
+/// <summary>
+/// What the host's strategies cost, measured by running the revenue query (a plain scan, so it's about the
+/// cheapest a row gets) sequentially and on the pool. The parallel cost is a fixed overhead for chunking,
+/// queueing and waiting on the pool, plus a per row cost that's the sequential one divided by however much
+/// speedup the pool's threads actually give on this host.
+/// </summary>
+struct Calibration
+{
+    double sequentialNanosPerRow = 1.0;
+    double parallelNanosPerRow = 1.0;
+    double parallelOverheadNanos = 0.0;
+
+    // Runs the micro-benchmark over generated transactions, which takes a few tens of milliseconds
+    static Calibration Measure(std::size_t threadCount);
+
+    // The span size past which the pool is cheaper than one thread, for a query costing weight times revenue's per row
+    std::size_t ParallelCrossover(double weight = 1.0) const;
+};
+
+/// <summary>
+/// Picks how to run each call, so callers get the best latency at any span size without choosing a
+/// strategy. It estimates what each way of running the call would cost, and takes the cheapest:
+///
+///  - sequential, which costs the rows times the query's per row cost,
+///  - parallel, which costs the pool's overhead plus the rows times its (smaller) per row cost,
+///  - incremental, for a prefix of the database that a query's cache covers part of, which costs only the
+///    rows past the cache,
+///  - the item index, for counting transactions that hold given items, which costs a few bitmap words per
+///    block instead of a scan.
+///
+/// The per row costs start from the calibration and are scaled by a weight per query, which is learned from
+/// how long the query's calls actually take, so a heavy query (co-purchases, say) goes parallel at a smaller
+/// span than revenue does.
+///
+/// Exact queries give the same results whichever way they run. The approximate ones (top baskets and the
+/// quantile sketches) stay within their error bounds, but can differ from call to call as the plan changes.
+/// </summary>
+class Planner : public QueryStrategies
+{
+public:
+    enum class Plan
+    {
+        eSequential,
+        eParallel,
+        eIncremental,
+        eIndex
+    };
+
+    explicit Planner(const bakery::Database& database, std::size_t threadCount = std::thread::hardware_concurrency());
+    Planner(const bakery::Database& database, std::size_t threadCount, const Calibration& calibration);
+
+    const Calibration& GetCalibration() const { return m_calibration; }
+
+    // How the last call ran
+    Plan LastPlan() const { return m_lastPlan; }
+
+    // Runs the chunks sequentially or on the pool, whichever the calibration says is faster for that many rows
+    virtual void RunChunks(std::size_t chunkCount, std::size_t chunkRows, const CancellationToken& token, const std::function<void(std::size_t)>& work) override;
+
+    // Inherited via QueryStrategies
+    virtual MinMaxFood GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span) override;
+    virtual std::size_t GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span) override;
+    virtual std::size_t GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetRevenue(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetTotalGratuity(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetAverageTicket(const std::span<const bakery::Transaction>& span) override;
+    virtual std::vector<HeavyHitter> GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual std::vector<HeavyHitter> GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual CoPurchaseMatrix GetCoPurchases(const std::span<const bakery::Transaction>& span) override;
+    virtual std::size_t GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual Cents GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual TicketTotalDistribution GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetGratuityQuantiles(const std::span<const bakery::Transaction>& span) override;
+
+private:
+    // The queries the planner keeps costs for. The cacheable ones (everything before eCountWhere) are the ones
+    // the incremental strategy caches.
+    enum class Query
+    {
+        ePopularItems,
+        eOver15,
+        eLargestPurchase,
+        eRevenue,
+        eGratuity,
+        eAverageTicket,
+        eTopItems,
+        eTopBaskets,
+        eCoPurchases,
+        eTicketDistribution,
+        eTicketQuantiles,
+        eGratuityQuantiles,
+        eCountWhere,
+        eRevenueWhere,
+        eCount
+    };
+
+    struct QueryState
+    {
+        // The query's per row cost, relative to the calibration's
+        double weight = 1.0;
+
+        // The rows of the database the incremental strategy's cache covers, once it's been run
+        std::optional<std::size_t> cachedRows;
+
+        // Calls over a prefix of the database, which are the ones worth caching
+        std::size_t prefixCalls = 0;
+    };
+
+    static constexpr bool IsCacheable(Query query) { return query < Query::eCountWhere; }
+
+    bool IsDatabasePrefix(const std::span<const bakery::Transaction>& span) const;
+    Plan Choose(Query query, const std::span<const bakery::Transaction>& span);
+
+    // Runs the call the way the plan says, and learns from how long it took
+    template<typename Function>
+    auto Execute(Query query, const std::span<const bakery::Transaction>& span, const Function& function);
+
+    // The items a predicate needs, when it's only that (one term, with nothing but allOf), which the index answers
+    static std::optional<std::vector<int>> IndexableItems(const predicates::Predicate& predicate);
+
+    Sequential m_sequential;
+    SequentialIA m_incremental;
+    MapReduceParallel m_parallel;
+
+    Calibration m_calibration;
+    std::array<QueryState, static_cast<std::size_t>(Query::eCount)> m_queries;
+    Plan m_lastPlan = Plan::eSequential;
+};
+} // end queries namespace
@@ -0,0 +1,170 @@
+#include "predicates.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace queries::predicates
+{
+namespace
+{
+std::uint32_t ToMask(std::initializer_list<int> foodIDs)
+{
+    std::uint32_t mask = 0;
+    for (int foodID : foodIDs)
+    {
+        if (foodID < 0 || foodID >= 27)
+            throw std::out_of_range{ "Food IDs must be in [0, 27)." };
+
+        mask |= std::uint32_t{ 1 } << foodID;
+    }
+
+    return mask;
+}
+} // end unnamed namespace
+
+namespace detail
+{
+bool Conjunction::IsSatisfiable() const
+{
+    return minItems <= maxItems
+        && std::popcount(allOf) <= maxItems
+        && minTotal < maxTotal
+        && minGratuity < std::numeric_limits<double>::infinity();
+}
+
+Conjunction Intersect(const Conjunction& lhs, const Conjunction& rhs)
+{
+    Conjunction result;
+    result.allOf = lhs.allOf | rhs.allOf;
+    result.minItems = std::max(lhs.minItems, rhs.minItems);
+    result.maxItems = std::min(lhs.maxItems, rhs.maxItems);
+    result.minTotal = std::max(lhs.minTotal, rhs.minTotal);
+    result.maxTotal = std::min(lhs.maxTotal, rhs.maxTotal);
+    result.minGratuity = std::max(lhs.minGratuity, rhs.minGratuity);
+
+    std::size_t count = 0;
+    for (const auto* anyOf : { &lhs.anyOf, &rhs.anyOf })
+    {
+        for (std::uint32_t mask : *anyOf)
+        {
+            // An any-of test that a required item already meets is redundant
+            if (mask == 0 || (mask & result.allOf) != 0 || std::ranges::find(result.anyOf, mask) != result.anyOf.end())
+                continue;
+
+            if (count == result.anyOf.size())
+                throw std::length_error{ "Too many ContainsAny tests in a single AND term." };
+
+            result.anyOf[count++] = mask;
+        }
+    }
+
+    return result;
+}
+} // end detail namespace
+
+Predicate::Predicate(std::vector<detail::Conjunction> terms)
+    : m_terms(std::move(terms))
+{
+    std::erase_if(m_terms, [](const detail::Conjunction& term) { return !term.IsSatisfiable(); });
+}
+
+Predicate::Predicate(const detail::Conjunction& term)
+    : Predicate(std::vector<detail::Conjunction>{ term })
+{}
+
+Predicate operator&&(const Predicate& lhs, const Predicate& rhs)
+{
+    std::vector<detail::Conjunction> terms;
+    terms.reserve(lhs.m_terms.size() * rhs.m_terms.size());
+
+    for (const detail::Conjunction& left : lhs.m_terms)
+    {
+        for (const detail::Conjunction& right : rhs.m_terms)
+            terms.push_back(detail::Intersect(left, right));
+    }
+
+    return Predicate{ std::move(terms) };
+}
+
+Predicate operator||(const Predicate& lhs, const Predicate& rhs)
+{
+    std::vector<detail::Conjunction> terms = lhs.m_terms;
+    terms.insert(terms.end(), rhs.m_terms.begin(), rhs.m_terms.end());
+
+    return Predicate{ std::move(terms) };
+}
+
+Predicate ContainsAny(std::initializer_list<int> foodIDs)
+{
+    // With nothing to choose from, nothing can match (ToMask gives 0, which would otherwise mean "no test")
+    if (foodIDs.size() == 0)
+        return Predicate::Nothing();
+
+    detail::Conjunction term;
+    term.anyOf[0] = ToMask(foodIDs);
+
+    return Predicate{ term };
+}
+
+Predicate ContainsAll(std::initializer_list<int> foodIDs)
+{
+    detail::Conjunction term;
+    term.allOf = ToMask(foodIDs);
+
+    return Predicate{ term };
+}
+
+Predicate BasketSizeAtLeast(int items)
+{
+    detail::Conjunction term;
+    term.minItems = items;
+
+    return Predicate{ term };
+}
+
+Predicate BasketSizeAtMost(int items)
+{
+    detail::Conjunction term;
+    term.maxItems = items;
+
+    return Predicate{ term };
+}
+
+Predicate TotalBetween(double min, double max)
+{
+    detail::Conjunction term;
+    term.minTotal = std::llround(min * 100.0);
+    term.maxTotal = std::llround(max * 100.0);
+
+    return Predicate{ term };
+}
+
+Predicate GratuityAbove(double gratuity)
+{
+    detail::Conjunction term;
+    term.minGratuity = gratuity;
+
+    return Predicate{ term };
+}
+
+CompiledPredicate::CompiledPredicate(const bakery::Database& database, const Predicate& predicate)
+    : m_terms(predicate.Terms())
+{
+    m_needsTotal = std::ranges::any_of(m_terms, &detail::Conjunction::NeedsTotal);
+
+    const queries::detail::PriceTable prices = queries::detail::GetPricesInCents(database);
+    for (std::size_t slice = 0; slice < kSlices; ++slice)
+    {
+        for (std::uint32_t bits = 0; bits < m_subtotals[slice].size(); ++bits)
+        {
+            for (std::size_t bit = 0; bit < kSliceBits; ++bit)
+            {
+                const std::size_t foodID = slice * kSliceBits + bit;
+                if (foodID < prices.size() && (bits >> bit) & 1)
+                    m_subtotals[slice][bits] += prices[foodID];
+            }
+        }
+    }
+}
+} // end queries::predicates namespace
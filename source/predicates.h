@@ -0,0 +1,143 @@
+#pragma once
+
+#include "bakery.h"
+#include "money.h"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+
+namespace queries::predicates
+{
+namespace detail
+{
+/// <summary>
+/// One AND term of a predicate, in a fixed shape: every kind of test is always evaluated, and a test that
+/// wasn't asked for is set up so it always passes. So a term is a handful of mask, popcount and compare
+/// operations, with no branches on the row.
+/// </summary>
+struct Conjunction
+{
+    static constexpr std::size_t kMaxAnyOf = 4;
+
+    // Every one of these items, and at least one item from each of the (non-zero) anyOf masks
+    std::uint32_t allOf = 0;
+    std::array<std::uint32_t, kMaxAnyOf> anyOf{};
+
+    // Basket size in [minItems, maxItems], total in [minTotal, maxTotal), gratuity > minGratuity
+    int minItems = 0;
+    int maxItems = 27;
+    Cents minTotal = std::numeric_limits<Cents>::min();
+    Cents maxTotal = std::numeric_limits<Cents>::max();
+    double minGratuity = -std::numeric_limits<double>::infinity();
+
+    bool NeedsTotal() const
+    {
+        return minTotal != std::numeric_limits<Cents>::min() || maxTotal != std::numeric_limits<Cents>::max();
+    }
+
+    bool IsSatisfiable() const;
+
+    bool Matches(std::uint32_t purchases, Cents total, double gratuity) const
+    {
+        bool matches = (purchases & allOf) == allOf;
+        for (std::uint32_t mask : anyOf)
+            matches &= ((purchases & mask) != 0) | (mask == 0);
+
+        const int items = std::popcount(purchases);
+        matches &= (items >= minItems) & (items <= maxItems);
+        matches &= (total >= minTotal) & (total < maxTotal);
+        matches &= gratuity > minGratuity;
+
+        return matches;
+    }
+};
+
+Conjunction Intersect(const Conjunction& lhs, const Conjunction& rhs);
+} // end detail namespace
+
+/// <summary>
+/// A filter over transactions, built from the tests below and combined with && and ||. It's kept in
+/// disjunctive normal form (an OR of AND terms), so AND distributes over the terms of both sides, and terms
+/// that can never match are dropped as they're built.
+///
+/// A default constructed predicate matches everything.
+/// </summary>
+class Predicate
+{
+public:
+    Predicate() : m_terms(1) {}
+
+    static Predicate Nothing() { return Predicate{ std::vector<detail::Conjunction>{} }; }
+
+    const std::vector<detail::Conjunction>& Terms() const { return m_terms; }
+
+    friend Predicate operator&&(const Predicate& lhs, const Predicate& rhs);
+    friend Predicate operator||(const Predicate& lhs, const Predicate& rhs);
+
+private:
+    friend Predicate ContainsAny(std::initializer_list<int> foodIDs);
+    friend Predicate ContainsAll(std::initializer_list<int> foodIDs);
+    friend Predicate BasketSizeAtLeast(int items);
+    friend Predicate BasketSizeAtMost(int items);
+    friend Predicate TotalBetween(double min, double max);
+    friend Predicate GratuityAbove(double gratuity);
+
+    explicit Predicate(std::vector<detail::Conjunction> terms);
+    explicit Predicate(const detail::Conjunction& term);
+
+    std::vector<detail::Conjunction> m_terms;
+};
+
+Predicate ContainsAny(std::initializer_list<int> foodIDs);
+Predicate ContainsAll(std::initializer_list<int> foodIDs);
+Predicate BasketSizeAtLeast(int items);
+Predicate BasketSizeAtMost(int items);
+
+// Ticket total (before gratuity) in [min, max), in dollars. It's compared in whole cents.
+Predicate TotalBetween(double min, double max);
+Predicate GratuityAbove(double gratuity);
+
+/// <summary>
+/// A predicate bound to a database's prices, ready to evaluate in a map step. The subtotal is only worked out
+/// when some term tests it, which is decided once here rather than per row.
+/// </summary>
+class CompiledPredicate
+{
+public:
+    CompiledPredicate(const bakery::Database& database, const Predicate& predicate);
+
+    bool Matches(const bakery::Transaction& transaction) const
+    {
+        const auto purchases = static_cast<std::uint32_t>(transaction.purchases.to_ulong());
+        const Cents total = m_needsTotal ? GetSubtotal(purchases) : 0;
+
+        bool matches = false;
+        for (const detail::Conjunction& term : m_terms)
+            matches |= term.Matches(purchases, total, transaction.gratuity);
+
+        return matches;
+    }
+
+private:
+
+    // The subtotal is four lookups, one per 7 bits of the purchase mask, into tables of every combination's subtotal
+    static constexpr std::size_t kSliceBits = 7;
+    static constexpr std::size_t kSlices = 4;
+
+    Cents GetSubtotal(std::uint32_t purchases) const
+    {
+        constexpr std::uint32_t kSliceMask = (1 << kSliceBits) - 1;
+
+        return m_subtotals[0][purchases & kSliceMask] + m_subtotals[1][(purchases >> kSliceBits) & kSliceMask] +
+               m_subtotals[2][(purchases >> 2 * kSliceBits) & kSliceMask] + m_subtotals[3][purchases >> 3 * kSliceBits];
+    }
+
+    std::vector<detail::Conjunction> m_terms;
+    std::array<std::array<Cents, 1 << kSliceBits>, kSlices> m_subtotals{};
+    bool m_needsTotal = false;
+};
+} // end queries::predicates namespace
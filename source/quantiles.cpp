@@ -0,0 +1,246 @@
+#include "quantiles.h"
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <utility>
+
+namespace queries
+{
+namespace
+{
+struct SketchHeader
+{
+    static constexpr std::uint32_t kMagic = 0x534C4C4B; // "KLLS"
+    static constexpr std::uint32_t kVersion = 1;
+
+    std::uint32_t magic = kMagic;
+    std::uint32_t version = kVersion;
+    std::uint32_t accuracy = 0;
+    std::uint32_t levels = 0;
+    std::int64_t count = 0;
+    double min = 0.0;
+    double max = 0.0;
+    std::uint64_t coin = 0;
+};
+
+// Enough levels for 2^47 * kAccuracy values, so anything past this is a corrupt header
+constexpr std::uint32_t kMaxLevels = 48;
+
+std::uint64_t SplitMix(std::uint64_t state)
+{
+    state += 0x9E3779B97F4A7C15;
+    state = (state ^ (state >> 30)) * 0xBF58476D1CE4E5B9;
+    state = (state ^ (state >> 27)) * 0x94D049BB133111EB;
+
+    return state ^ (state >> 31);
+}
+
+template<typename T>
+bool Read(std::istream& stream, T& value)
+{
+    return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+} // end unnamed namespace
+
+void QuantileSketch::Add(double value)
+{
+    if (m_levels.empty())
+        m_levels.emplace_back();
+
+    m_levels.front().push_back(value);
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    ++m_count;
+
+    // Level 0's capacity only changes when a level is added, so it isn't worked out per value
+    if (m_levels.front().size() >= m_bottomCapacity)
+        Compress();
+}
+
+void QuantileSketch::Merge(const QuantileSketch& other)
+{
+    if (other.m_levels.size() > m_levels.size())
+        m_levels.resize(other.m_levels.size());
+
+    for (std::size_t level = 0; level < other.m_levels.size(); ++level)
+        m_levels[level].insert(m_levels[level].end(), other.m_levels[level].begin(), other.m_levels[level].end());
+
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_coin ^= other.m_coin;
+
+    Compress();
+}
+
+QuantileSketch QuantileSketch::Merge(const QuantileSketch& aggregate, const QuantileSketch& next)
+{
+    QuantileSketch result = aggregate;
+    result.Merge(next);
+
+    return result;
+}
+
+std::size_t QuantileSketch::Retained() const
+{
+    std::size_t retained = 0;
+    for (const auto& level : m_levels)
+        retained += level.size();
+
+    return retained;
+}
+
+std::size_t QuantileSketch::Capacity(std::size_t level) const
+{
+    const auto depth = static_cast<double>(m_levels.size() - 1 - level);
+    return std::max<std::size_t>(2, static_cast<std::size_t>(std::ceil(kAccuracy * std::pow(2.0 / 3.0, depth))));
+}
+
+/// <summary>
+/// Compacts every full level, from the bottom up, so a level that overflows from the one below is dealt with
+/// in the same pass.
+/// </summary>
+void QuantileSketch::Compress()
+{
+    for (std::size_t level = 0; level < m_levels.size(); ++level)
+    {
+        if (m_levels[level].size() >= Capacity(level))
+            Compact(level);
+    }
+
+    m_bottomCapacity = Capacity(0);
+}
+
+void QuantileSketch::Compact(std::size_t level)
+{
+    if (level + 1 == m_levels.size())
+        m_levels.emplace_back();
+
+    std::vector<double>& values = m_levels[level];
+    std::vector<double>& above = m_levels[level + 1];
+
+    std::ranges::sort(values);
+
+    // With an odd number of values, the smallest stays behind, so each promoted value replaces exactly two
+    const std::size_t kept = values.size() % 2;
+
+    m_coin = SplitMix(m_coin);
+    for (std::size_t index = kept + (m_coin & 1); index < values.size(); index += 2)
+        above.push_back(values[index]);
+
+    values.resize(kept);
+}
+
+double QuantileSketch::Quantile(double fraction) const
+{
+    if (m_count == 0)
+        return std::numeric_limits<double>::quiet_NaN();
+
+    if (fraction <= 0.0)
+        return m_min;
+
+    if (fraction >= 1.0)
+        return m_max;
+
+    std::vector<std::pair<double, std::int64_t>> weighted;
+    weighted.reserve(Retained());
+
+    for (std::size_t level = 0; level < m_levels.size(); ++level)
+    {
+        for (double value : m_levels[level])
+            weighted.emplace_back(value, std::int64_t{ 1 } << level);
+    }
+
+    std::ranges::sort(weighted);
+
+    const auto rank = std::max<std::int64_t>(1, static_cast<std::int64_t>(std::ceil(fraction * m_count)));
+
+    std::int64_t cumulative = 0;
+    for (const auto& [value, weight] : weighted)
+    {
+        cumulative += weight;
+        if (cumulative >= rank)
+            return value;
+    }
+
+    return m_max;
+}
+
+double QuantileSketch::Rank(double value) const
+{
+    if (m_count == 0)
+        return 0.0;
+
+    std::int64_t atMost = 0;
+    for (std::size_t level = 0; level < m_levels.size(); ++level)
+        atMost += std::ranges::count_if(m_levels[level], [value](double item) { return item <= value; }) << level;
+
+    return static_cast<double>(atMost) / m_count;
+}
+
+bool QuantileSketch::Save(std::ostream& stream) const
+{
+    const SketchHeader header{
+        .accuracy = kAccuracy,
+        .levels = static_cast<std::uint32_t>(m_levels.size()),
+        .count = m_count,
+        .min = m_min,
+        .max = m_max,
+        .coin = m_coin
+    };
+
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& level : m_levels)
+    {
+        const auto size = static_cast<std::uint32_t>(level.size());
+        stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        stream.write(reinterpret_cast<const char*>(level.data()), level.size() * sizeof(double));
+    }
+
+    return static_cast<bool>(stream);
+}
+
+bool QuantileSketch::Load(std::istream& stream)
+{
+    SketchHeader header;
+    if (!Read(stream, header))
+        return false;
+
+    if (header.magic != SketchHeader::kMagic || header.version != SketchHeader::kVersion ||
+        header.accuracy != kAccuracy || header.levels > kMaxLevels || header.count < 0)
+    {
+        return false;
+    }
+
+    std::vector<std::vector<double>> levels(header.levels);
+    std::int64_t weight = 0;
+
+    for (std::size_t level = 0; level < levels.size(); ++level)
+    {
+        std::uint32_t size = 0;
+        if (!Read(stream, size) || size > (header.count - weight) >> level)
+            return false;
+
+        levels[level].resize(size);
+        if (!stream.read(reinterpret_cast<char*>(levels[level].data()), size * sizeof(double)))
+            return false;
+
+        weight += static_cast<std::int64_t>(size) << level;
+    }
+
+    if (weight != header.count)
+        return false;
+
+    m_levels = std::move(levels);
+    m_count = header.count;
+    m_min = header.min;
+    m_max = header.max;
+    m_coin = header.coin;
+    m_bottomCapacity = m_levels.empty() ? 0 : Capacity(0);
+
+    return true;
+}
+} // end queries namespace
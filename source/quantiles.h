@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <limits>
+#include <vector>
+
+namespace queries
+{
+/// <summary>
+/// A KLL quantile sketch: a mergeable monoid that answers quantile and rank questions about a stream of
+/// values in bounded memory, however long the stream is.
+///
+/// Values are kept in levels, where each value at level h stands for 2^h of the originals. When a level
+/// fills up, it's sorted and every other value (starting from the first or second, alternately chosen by a
+/// deterministic coin) is promoted a level up, which keeps the total weight exact. Levels get smaller by a
+/// factor of 2/3 going down from the top, so a sketch holds roughly 3 * kAccuracy values, and ranks are
+/// within about 1.7 / kAccuracy of the truth (around 1% here) with high probability.
+///
+/// Merging concatenates the levels and compacts them again, so it's commutative, but sketches reduced in
+/// a different order can differ, within the error bound. The minimum, maximum and count are always exact.
+/// </summary>
+class QuantileSketch
+{
+public:
+    static constexpr std::size_t kAccuracy = 200;
+
+    void Add(double value);
+
+    void Merge(const QuantileSketch& other);
+    static QuantileSketch Merge(const QuantileSketch& aggregate, const QuantileSketch& next);
+
+    std::int64_t Count() const { return m_count; }
+    double Min() const { return m_min; }
+    double Max() const { return m_max; }
+
+    // The number of values the sketch holds, which stays bounded however many were added
+    std::size_t Retained() const;
+
+    /// <summary>
+    /// The smallest retained value that at least the given fraction of the values are less than or equal to,
+    /// so 0.5 is the median. 0 and 1 give the exact minimum and maximum, and an empty sketch gives NaN.
+    /// </summary>
+    double Quantile(double fraction) const;
+
+    // The fraction of the values that are less than or equal to the given one
+    double Rank(double value) const;
+
+    /// <summary>
+    /// A small binary format: a header, then each level's size and values. Loading validates the header
+    /// and that the levels add up to the count, and leaves the sketch untouched when they don't.
+    /// </summary>
+    bool Save(std::ostream& stream) const;
+    bool Load(std::istream& stream);
+
+private:
+
+    std::size_t Capacity(std::size_t level) const;
+
+    void Compress();
+    void Compact(std::size_t level);
+
+    std::vector<std::vector<double>> m_levels;
+    std::int64_t m_count = 0;
+    double m_min = std::numeric_limits<double>::infinity();
+    double m_max = -std::numeric_limits<double>::infinity();
+    std::uint64_t m_coin = 0;
+    std::size_t m_bottomCapacity = kAccuracy;
+};
+} // end queries namespace
@@ -1,13 +1,106 @@
 #include "queries.h"
 
+#include <atomic>
+#include <exception>
 #include <execution>
+#include <fstream>
+#include <mutex>
 #include <numeric>
 #include <ranges>
+#include <sstream>
+#include <unordered_map>
 
 namespace queries
 {
+namespace
+{
+std::vector<HeavyHitter> First(std::vector<HeavyHitter> ranked, std::size_t count)
+{
+    ranked.resize(std::min(ranked.size(), count));
+    return ranked;
+}
+
+struct CheckpointHeader
+{
+    static constexpr std::uint64_t kMagic = 0x4B43'4449'4F4E'4F4D; // "MONOIDCK"
+
+    // 2 writes heavy hitter counters field by field, without their padding
+    static constexpr std::uint32_t kVersion = 2;
+
+    std::uint64_t magic = kMagic;
+    std::uint32_t version = kVersion;
+    std::uint32_t entries = 0;
+};
+
+struct CheckpointEntry
+{
+    std::uint32_t id = 0;
+    std::uint32_t reserved = 0;
+    std::uint64_t rows = 0;
+    std::uint64_t fingerprint = 0;
+    std::uint64_t bytes = 0;
+};
+
+/// <summary>
+/// Fingerprints prefixes of the transactions, remembering the ones already worked out, as the caches usually
+/// all cover the same rows.
+/// </summary>
+class PrefixFingerprints
+{
+public:
+    explicit PrefixFingerprints(const bakery::TransactionVector& transactions) : m_transactions(transactions) {}
+
+    std::uint64_t Get(std::size_t rows)
+    {
+        const auto [it, inserted] = m_fingerprints.try_emplace(rows);
+        if (inserted)
+            it->second = bakery::Fingerprint(std::span{ m_transactions }.first(rows));
+
+        return it->second;
+    }
+
+private:
+    const bakery::TransactionVector& m_transactions;
+    std::unordered_map<std::size_t, std::uint64_t> m_fingerprints;
+};
+} // end unnamed namespace
+
+void QueryStrategies::RunChunks(std::size_t chunkCount, std::size_t /*chunkRows*/, const CancellationToken& token, const std::function<void(std::size_t)>& work)
+{
+    for (std::size_t index = 0; index < chunkCount && !token.StopRequested(); ++index)
+        work(index);
+}
+
+const TicketTotalDistribution& QueryStrategies::GetCachedTicketTotalDistribution(const std::span<const bakery::Transaction>& span)
+{
+    const bool sameRows = m_histogramCache && m_histogramCache->span.data() == span.data();
+    const bool hit = sameRows && m_histogramCache->span.size() == span.size();
+
+    metrics::RecordCacheLookup(hit);
+    if (hit)
+        return m_cachedDistribution;
+
+    // The rows past the cached ones are counted however this strategy runs chunks, and merged in
+    if (sameRows && m_histogramCache->span.size() < span.size())
+    {
+        const auto delta = RunCancellable<TicketDistributionQuery>(span.subspan(m_histogramCache->span.size()), {});
+        m_histogramCache->aggregate.Merge(delta.monoid);
+        m_histogramCache->span = span;
+    }
+    else
+    {
+        m_histogramCache.emplace(span, RunCancellable<TicketDistributionQuery>(span, {}).monoid);
+    }
+
+    m_cachedDistribution = TicketTotalDistribution{ m_histogramCache->aggregate };
+
+    return m_cachedDistribution;
+}
+
 MinMaxFood Sequential::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span)
 {
+    metrics::RecordRows(span.size(), span.size_bytes());
+
     std::array<int, 6> counts{};
     for (const auto& transaction : span)
     {
@@ -26,6 +119,8 @@ MinMaxFood Sequential::GetGreatestAndLeastPopularItems(const std::span<const bak
 
 std::size_t Sequential::GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span)
 {
+    metrics::RecordRows(span.size(), span.size_bytes());
+
     std::size_t count = 0;
     for (const auto& transaction : span)
     {
@@ -45,6 +140,8 @@ std::size_t Sequential::GetNumberOfTransactionsOver15(const std::span<const bake
 
 std::size_t Sequential::GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span)
 {
+    metrics::RecordRows(span.size(), span.size_bytes());
+
     std::size_t maxPurchases = 0;
     for (const auto& transaction : span)
         maxPurchases = std::max(maxPurchases, transaction.GetPurchases().size());
@@ -52,6 +149,153 @@ std::size_t Sequential::GetLargestNumberOfPurachasesMade(const std::span<const b
     return maxPurchases;
 }
 
+Cents Sequential::GetRevenue(const std::span<const bakery::Transaction>& span)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const detail::PriceTable prices = detail::GetPricesInCents(m_database);
+
+    Cents revenue = 0;
+    for (const auto& transaction : span)
+        revenue += detail::GetSubtotal(prices, transaction);
+
+    return revenue;
+}
+
+Cents Sequential::GetTotalGratuity(const std::span<const bakery::Transaction>& span)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const detail::PriceTable prices = detail::GetPricesInCents(m_database);
+
+    Cents gratuity = 0;
+    for (const auto& transaction : span)
+        gratuity += detail::GetGratuity(prices, transaction);
+
+    return gratuity;
+}
+
+Cents Sequential::GetAverageTicket(const std::span<const bakery::Transaction>& span)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const detail::PriceTable prices = detail::GetPricesInCents(m_database);
+
+    TicketTotals totals{ .tickets = static_cast<std::int64_t>(span.size()) };
+    for (const auto& transaction : span)
+        totals.subtotal += detail::GetSubtotal(prices, transaction);
+
+    return AverageTicketQuery::Finalize(totals);
+}
+
+std::vector<HeavyHitter> Sequential::GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    TopItemsQuery::Monoid items;
+    for (const auto& transaction : span)
+    {
+        for (int foodID : transaction.GetPurchases())
+            items.Add(foodID);
+    }
+
+    return First(items.Ranked(), count);
+}
+
+std::vector<HeavyHitter> Sequential::GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    TopBasketsQuery::Monoid baskets;
+    for (const auto& transaction : span)
+        baskets.Add(static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+
+    return First(baskets.Ranked(), count);
+}
+
+CoPurchaseMatrix Sequential::GetCoPurchases(const std::span<const bakery::Transaction>& span)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    CoPurchaseMatrix matrix;
+    for (const auto& transaction : span)
+        matrix.Add(static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+
+    return matrix;
+}
+
+std::size_t Sequential::GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const predicates::CompiledPredicate filter{ m_database, predicate };
+
+    std::size_t count = 0;
+    for (const auto& transaction : span)
+    {
+        if (filter.Matches(transaction))
+            ++count;
+    }
+
+    return count;
+}
+
+Cents Sequential::GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const predicates::CompiledPredicate filter{ m_database, predicate };
+    const detail::PriceTable prices = detail::GetPricesInCents(m_database);
+
+    Cents revenue = 0;
+    for (const auto& transaction : span)
+    {
+        if (filter.Matches(transaction))
+            revenue += detail::GetSubtotal(prices, transaction);
+    }
+
+    return revenue;
+}
+
+TicketTotalDistribution Sequential::GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const detail::PriceTable prices = detail::GetPricesInCents(m_database);
+
+    TicketTotalHistogram histogram;
+    for (const auto& transaction : span)
+        histogram.Add(detail::GetSubtotal(prices, transaction));
+
+    return TicketTotalDistribution{ histogram };
+}
+
+QuantileSketch Sequential::GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const detail::PriceTable prices = detail::GetPricesInCents(m_database);
+
+    QuantileSketch sketch;
+    for (const auto& transaction : span)
+        sketch.Add(static_cast<double>(detail::GetSubtotal(prices, transaction)));
+
+    return sketch;
+}
+
+QuantileSketch Sequential::GetGratuityQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    const detail::PriceTable prices = detail::GetPricesInCents(m_database);
+
+    QuantileSketch sketch;
+    for (const auto& transaction : span)
+        sketch.Add(static_cast<double>(detail::GetGratuity(prices, transaction)));
+
+    return sketch;
+}
+
 
 
 MinMaxFood SequentialIA::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span)
@@ -71,15 +315,19 @@ MinMaxFood SequentialIA::GetGreatestAndLeastPopularItems(const std::span<const b
         return counts;
     };
 
+    metrics::RecordCacheLookup(m_query1Cache.has_value());
+
     if (m_query1Cache)
     {
         const auto deltaSpan = span.subspan(m_query1Cache->span.size());
+        metrics::RecordRows(deltaSpan.size(), deltaSpan.size_bytes());
 
         m_query1Cache->aggregate = CountFoodTypes(deltaSpan, m_query1Cache->aggregate);
         m_query1Cache->span = span;
     }
     else
     {
+        metrics::RecordRows(span.size(), span.size_bytes());
         m_query1Cache.emplace(span, CountFoodTypes(span, std::array<int, 6>{}));
     }
 
@@ -110,15 +358,19 @@ std::size_t SequentialIA::GetNumberOfTransactionsOver15(const std::span<const ba
         return count;
     };
 
+    metrics::RecordCacheLookup(m_query2Cache.has_value());
+
     if (m_query2Cache)
     {
         const auto deltaSpan = span.subspan(m_query2Cache->span.size());
+        metrics::RecordRows(deltaSpan.size(), deltaSpan.size_bytes());
 
         m_query2Cache->aggregate = GetNumTransactionsOver15(deltaSpan, m_query2Cache->aggregate);
         m_query2Cache->span = span;
     }
     else
     {
+        metrics::RecordRows(span.size(), span.size_bytes());
         m_query2Cache.emplace(span, GetNumTransactionsOver15(span, 0));
     }
 
@@ -136,225 +388,525 @@ std::size_t SequentialIA::GetLargestNumberOfPurachasesMade(const std::span<const
         return maxPurchases;
     };
 
+    metrics::RecordCacheLookup(m_query3Cache.has_value());
+
     if (m_query3Cache)
     {
         const auto deltaSpan = span.subspan(m_query3Cache->span.size());
+        metrics::RecordRows(deltaSpan.size(), deltaSpan.size_bytes());
 
         m_query3Cache->aggregate = GetMaxPurchasesMade(deltaSpan, m_query3Cache->aggregate);
         m_query3Cache->span = span;
     }
     else
     {
+        metrics::RecordRows(span.size(), span.size_bytes());
         m_query3Cache.emplace(span, GetMaxPurchasesMade(span, 0));
     }
 
     return m_query3Cache->aggregate;
 }
 
+Cents SequentialIA::GetRevenue(const std::span<const bakery::Transaction>& span)
+{
+    return Aggregate<RevenueQuery>(m_revenueCache, span);
+}
+
+Cents SequentialIA::GetTotalGratuity(const std::span<const bakery::Transaction>& span)
+{
+    return Aggregate<GratuityQuery>(m_gratuityCache, span);
+}
+
+Cents SequentialIA::GetAverageTicket(const std::span<const bakery::Transaction>& span)
+{
+    return Aggregate<AverageTicketQuery>(m_ticketCache, span);
+}
+
+std::vector<HeavyHitter> SequentialIA::GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    return First(Aggregate<TopItemsQuery>(m_topItemsCache, span), count);
+}
+
+std::vector<HeavyHitter> SequentialIA::GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    return First(Aggregate<TopBasketsQuery>(m_topBasketsCache, span), count);
+}
+
+CoPurchaseMatrix SequentialIA::GetCoPurchases(const std::span<const bakery::Transaction>& span)
+{
+    return Aggregate<CoPurchaseQuery>(m_coPurchaseCache, span);
+}
+
 /// <summary>
-/// This was implemented to evaluate how chunk size affects throughput in queries. What I was observing in the plots is that
-/// on my machine, the throughput caps at around 2500 transactions per chunk. I wanted to investigate how chunksize affects
-/// the overall computation time / throughput.
+/// The caches are per query, not per predicate, so filtered queries always scan the whole span.
 /// </summary>
-MinMaxFood MapReduceParallel::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span, std::size_t chunkSize)
+std::size_t SequentialIA::GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
 {
-    using Monoid = std::array<int, 6>;
-    const auto Map = [this](const auto& transaction)
-    {
-        Monoid monoid{};
-        for (int foodID : transaction.GetPurchases())
-        {
-            const bakery::FoodItem& food = m_database.GetFood(foodID);
-            ++monoid.at(static_cast<std::size_t>(food.type));
-        }
+    using Query = FilteredQuery<CountQuery>;
+    const Query query{ m_database, predicate };
 
-        return monoid;
-    };
+    metrics::RecordRows(span.size(), span.size_bytes());
+    return Query::Finalize(detail::MapReduce(span, detail::Mapper(query), detail::Reducer<Query>()));
+}
 
-    const auto Reduce = [](const Monoid& aggregate, const Monoid& next)
-    {
-        Monoid result = aggregate;
-        for (std::size_t index = 0; index < result.size(); ++index)
-            result.at(index) += next.at(index);
+Cents SequentialIA::GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
+{
+    using Query = FilteredQuery<RevenueQuery>;
+    const Query query{ m_database, predicate };
 
-        return result;
-    };
+    metrics::RecordRows(span.size(), span.size_bytes());
+    return Query::Finalize(detail::MapReduce(span, detail::Mapper(query), detail::Reducer<Query>()));
+}
 
-    std::vector<std::span<const bakery::Transaction>> chunks;
-    detail::Chunk(span, span.size() / chunkSize, chunks);
+/// <summary>
+/// The histogram is cached like any other aggregate, so a growing span only counts its new rows, and every
+/// threshold, range or percentile asked of it afterwards is a pass over the buckets rather than the rows.
+/// </summary>
+TicketTotalDistribution SequentialIA::GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span)
+{
+    return Aggregate<TicketDistributionQuery>(m_ticketHistogramCache, span);
+}
 
-    std::vector<std::future<Monoid>> futures;
-    for (const auto& chunk : chunks)
-        futures.push_back(m_pool.Run([&]() { return detail::MapReduce(chunk, Map, Reduce); }));
+QuantileSketch SequentialIA::GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    return Aggregate<TicketTotalQuantilesQuery>(m_ticketQuantilesCache, span);
+}
 
-    Monoid result = std::accumulate(std::begin(futures), std::end(futures), Monoid{},
-        [&](const Monoid& aggregate, std::future<Monoid>& next) {
-            return Reduce(aggregate, next.get());
-        });
+QuantileSketch SequentialIA::GetGratuityQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    return Aggregate<GratuityQuantilesQuery>(m_gratuityQuantilesCache, span);
+}
 
-    const auto& [min, max] = std::ranges::minmax_element(result);
+void SequentialIA::Advance(const std::span<const bakery::Transaction>& span)
+{
+    if (m_query1Cache)
+        GetGreatestAndLeastPopularItems(span);
+    if (m_query2Cache)
+        GetNumberOfTransactionsOver15(span);
+    if (m_query3Cache)
+        GetLargestNumberOfPurachasesMade(span);
+    if (m_revenueCache)
+        Aggregate<RevenueQuery>(m_revenueCache, span);
+    if (m_gratuityCache)
+        Aggregate<GratuityQuery>(m_gratuityCache, span);
+    if (m_ticketCache)
+        Aggregate<AverageTicketQuery>(m_ticketCache, span);
+    if (m_topItemsCache)
+        Aggregate<TopItemsQuery>(m_topItemsCache, span);
+    if (m_topBasketsCache)
+        Aggregate<TopBasketsQuery>(m_topBasketsCache, span);
+    if (m_coPurchaseCache)
+        Aggregate<CoPurchaseQuery>(m_coPurchaseCache, span);
+    if (m_ticketHistogramCache)
+        Aggregate<TicketDistributionQuery>(m_ticketHistogramCache, span);
+    if (m_ticketQuantilesCache)
+        Aggregate<TicketTotalQuantilesQuery>(m_ticketQuantilesCache, span);
+    if (m_gratuityQuantilesCache)
+        Aggregate<GratuityQuantilesQuery>(m_gratuityQuantilesCache, span);
+}
 
-    return {static_cast<bakery::FoodType>(std::distance(std::begin(result), min)),
-            static_cast<bakery::FoodType>(std::distance(std::begin(result), max))};
+/// <summary>
+/// The same cache-then-reduce-the-delta pattern as the queries above, for any of the query definitions.
+/// </summary>
+template<typename Query>
+typename Query::Result SequentialIA::Aggregate(std::optional<detail::CacheEntry<typename Query::Monoid>>& cache,
+                                               const std::span<const bakery::Transaction>& span)
+{
+    const Query query{ m_database };
+
+    metrics::RecordCacheLookup(cache.has_value());
+
+    if (cache)
+    {
+        const auto deltaSpan = span.subspan(cache->span.size());
+        metrics::RecordRows(deltaSpan.size(), deltaSpan.size_bytes());
+
+        cache->aggregate = Query::Reduce(cache->aggregate, detail::MapReduce(deltaSpan, detail::Mapper(query), detail::Reducer<Query>()));
+        cache->span = span;
+    }
+    else
+    {
+        metrics::RecordRows(span.size(), span.size_bytes());
+        cache.emplace(span, detail::MapReduce(span, detail::Mapper(query), detail::Reducer<Query>()));
+    }
+
+    return Query::Finalize(cache->aggregate);
 }
 
-MinMaxFood MapReduceParallel::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span)
+template<typename Self, typename Visitor>
+void SequentialIA::ForEachCache(Self& self, Visitor&& visit)
 {
-    using Monoid = std::array<int, 6>;
-    const auto Map = [this](const auto& transaction)
+    // New caches go on the end, so the ones in existing checkpoints keep their IDs
+    visit(self.m_query1Cache);
+    visit(self.m_query2Cache);
+    visit(self.m_query3Cache);
+    visit(self.m_revenueCache);
+    visit(self.m_gratuityCache);
+    visit(self.m_ticketCache);
+    visit(self.m_topItemsCache);
+    visit(self.m_topBasketsCache);
+    visit(self.m_coPurchaseCache);
+    visit(self.m_ticketHistogramCache);
+    visit(self.m_ticketQuantilesCache);
+    visit(self.m_gratuityQuantilesCache);
+}
+
+/// <summary>
+/// Each cache is written as an entry header and its serialized monoid, whose size is in the header so a
+/// reader can skip the entries it can't use. Only caches over a prefix of the database are saved, as those
+/// are the only ones that can be matched up with the database again.
+/// </summary>
+bool SequentialIA::SaveCheckpoint(const std::filesystem::path& file) const
+{
+    const auto& transactions = m_database.GetTransactions();
+    PrefixFingerprints fingerprints{ transactions };
+
+    std::ostringstream entries{ std::ios::binary };
+    CheckpointHeader header;
+    std::uint32_t id = 0;
+
+    ForEachCache(*this, [&](const auto& cache) {
+        const std::uint32_t entryID = id++;
+        if (!cache || cache->span.data() != transactions.data() || cache->span.size() > transactions.size())
+            return;
+
+        std::ostringstream payload{ std::ios::binary };
+        detail::SaveMonoid(payload, cache->aggregate);
+        const std::string bytes = std::move(payload).str();
+
+        const CheckpointEntry entry{
+            .id = entryID,
+            .rows = cache->span.size(),
+            .fingerprint = fingerprints.Get(cache->span.size()),
+            .bytes = bytes.size()
+        };
+
+        entries.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        entries.write(bytes.data(), bytes.size());
+        ++header.entries;
+    });
+
+    std::ofstream stream{ file, std::ios::binary | std::ios::trunc };
+    if (!stream)
+        return false;
+
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream << entries.str();
+
+    return static_cast<bool>(stream);
+}
+
+std::size_t SequentialIA::LoadCheckpoint(const std::filesystem::path& file)
+{
+    std::ifstream stream{ file, std::ios::binary };
+    if (!stream)
+        return 0;
+
+    CheckpointHeader header;
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != CheckpointHeader::kMagic || header.version != CheckpointHeader::kVersion)
     {
-        Monoid monoid{};
-        for (int foodID : transaction.GetPurchases())
-        {
-            const bakery::FoodItem& food = m_database.GetFood(foodID);
-            ++monoid.at(static_cast<std::size_t>(food.type));
-        }
+        return 0;
+    }
 
-        return monoid;
-    };
+    // Read every entry before restoring any, so a file that's cut short restores nothing
+    std::vector<std::pair<CheckpointEntry, std::string>> entries;
+    for (std::uint32_t index = 0; index < header.entries; ++index)
+    {
+        CheckpointEntry entry;
+        if (!stream.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+            return 0;
+
+        std::string bytes(entry.bytes, '\0');
+        if (!stream.read(bytes.data(), bytes.size()))
+            return 0;
 
-    const auto Reduce = [](const Monoid& aggregate, const Monoid& next)
+        entries.emplace_back(entry, std::move(bytes));
+    }
+
+    const auto& transactions = m_database.GetTransactions();
+    PrefixFingerprints fingerprints{ transactions };
+
+    std::size_t restored = 0;
+    for (const auto& [entry, bytes] : entries)
     {
-        Monoid result = aggregate;
-        for (std::size_t index = 0; index < result.size(); ++index)
-            result.at(index) += next.at(index);
+        if (entry.rows > transactions.size() || fingerprints.Get(entry.rows) != entry.fingerprint)
+            continue;
 
-        return result;
-    };
+        std::uint32_t id = 0;
+        ForEachCache(*this, [&](auto& cache) {
+            if (id++ != entry.id)
+                return;
 
-    std::vector<std::span<const bakery::Transaction>> chunks;
-    detail::Chunk(span, m_pool.ThreadCount(), chunks);
+            using Monoid = decltype(std::remove_reference_t<decltype(cache)>::value_type::aggregate);
 
-    std::vector<std::future<Monoid>> futures;
-    for (const auto& chunk : chunks)
-        futures.push_back(m_pool.Run([&]() { return detail::MapReduce(chunk, Map, Reduce); }));
+            Monoid aggregate{};
+            std::istringstream payload{ bytes, std::ios::binary };
+            if (!detail::LoadMonoid(payload, aggregate) || payload.peek() != std::istringstream::traits_type::eof())
+                return;
 
-    Monoid result = std::accumulate(std::begin(futures), std::end(futures), Monoid{},
-        [&](const Monoid& aggregate, std::future<Monoid>& next) {
-            return Reduce(aggregate, next.get());
+            cache.emplace(m_database.GetTransactions(entry.rows), aggregate);
+            ++restored;
         });
+    }
 
-    const auto& [min, max] = std::ranges::minmax_element(result);
-
-    return {static_cast<bakery::FoodType>(std::distance(std::begin(result), min)),
-            static_cast<bakery::FoodType>(std::distance(std::begin(result), max))};
+    return restored;
 }
 
-std::size_t MapReduceParallel::GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span)
+void MapReduceParallel::RunChunks(std::size_t chunkCount, std::size_t /*chunkRows*/, const CancellationToken& token, const std::function<void(std::size_t)>& work)
 {
-    using Monoid = int;
-    const auto Map = [this](const auto& transaction)
+    std::atomic<std::size_t> next = 0;
+
+    std::vector<std::future<void>> futures;
+    for (std::size_t thread = 0; thread < std::min(m_pool.ThreadCount(), chunkCount); ++thread)
     {
-        double total = 0.0;
-        for (int foodID : transaction.GetPurchases())
-        {
-            const bakery::FoodItem& food = m_database.GetFood(foodID);
-            total += food.cost;
-        }
+        futures.push_back(m_pool.Run([&]() {
+            for (std::size_t index = next++; index < chunkCount && !token.StopRequested(); index = next++)
+                work(index);
+        }));
+    }
 
-        return total > 15.0 ? 1 : 0;
-    };
+    // Every thread is waited for before anything's rethrown, since they all reference this frame
+    for (std::future<void>& future : futures)
+        future.wait();
+
+    for (std::future<void>& future : futures)
+        future.get();
+}
+
+/// <summary>
+/// This was implemented to evaluate how chunk size affects throughput in queries. What I was observing in the plots is that
+/// on my machine, the throughput caps at around 2500 transactions per chunk. I wanted to investigate how chunksize affects
+/// the overall computation time / throughput.
+/// </summary>
+MinMaxFood MapReduceParallel::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span, std::size_t chunkSize)
+{
+    using Query = PopularItemsQuery;
+    const Query query{ m_database };
+
+    metrics::RecordRows(span.size(), span.size_bytes());
 
+    const auto chunkStart = metrics::Now();
     std::vector<std::span<const bakery::Transaction>> chunks;
-    detail::Chunk(span, m_pool.ThreadCount(), chunks);
+    detail::Chunk(span, span.size() / chunkSize, chunks);
+    metrics::RecordChunking(chunkStart);
 
-    std::vector<std::future<Monoid>> futures;
-    for (const auto& chunk : chunks)
-        futures.push_back(m_pool.Run([&]() { return detail::MapReduce(chunk, Map, std::plus<int>{}); }));
+    return Query::Finalize(detail::ParallelMapReduce(m_pool, chunks, detail::Mapper(query), detail::Reducer<Query>()));
+}
 
-    return std::accumulate(std::begin(futures), std::end(futures), Monoid{},
-        [&](const Monoid& aggregate, std::future<Monoid>& next) {
-            return aggregate + next.get();
-        });
+MinMaxFood MapReduceParallel::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span)
+{
+    return Run<PopularItemsQuery>(span);
+}
+
+std::size_t MapReduceParallel::GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span)
+{
+    return Run<TransactionsOver15Query>(span);
 }
 
 std::size_t MapReduceParallel::GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span)
 {
-    using Monoid = int;
-    const auto Map = [this](const auto& transaction) {
-        return transaction.GetPurchases().size();
-    };
+    return Run<LargestPurchaseQuery>(span);
+}
 
-    const auto Reduce = [](const Monoid& aggregate, const Monoid& next) {
-        return std::max(aggregate, next);
-    };
+Cents MapReduceParallel::GetRevenue(const std::span<const bakery::Transaction>& span)
+{
+    return Run<RevenueQuery>(span);
+}
 
-    std::vector<std::span<const bakery::Transaction>> chunks;
-    detail::Chunk(span, m_pool.ThreadCount(), chunks);
+Cents MapReduceParallel::GetTotalGratuity(const std::span<const bakery::Transaction>& span)
+{
+    return Run<GratuityQuery>(span);
+}
 
-    std::vector<std::future<Monoid>> futures;
-    for (const auto& chunk : chunks)
-        futures.push_back(m_pool.Run([&]() -> Monoid { return detail::MapReduce(chunk, Map, Reduce); }));
+Cents MapReduceParallel::GetAverageTicket(const std::span<const bakery::Transaction>& span)
+{
+    return Run<AverageTicketQuery>(span);
+}
 
-    return std::accumulate(std::begin(futures), std::end(futures), std::numeric_limits<Monoid>::min(),
-        [&](const Monoid& aggregate, std::future<Monoid>& next) {
-            return Reduce(aggregate, next.get());
-        });
+std::vector<HeavyHitter> MapReduceParallel::GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    return First(Run<TopItemsQuery>(span), count);
 }
 
+std::vector<HeavyHitter> MapReduceParallel::GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    return First(Run<TopBasketsQuery>(span), count);
+}
 
+CoPurchaseMatrix MapReduceParallel::GetCoPurchases(const std::span<const bakery::Transaction>& span)
+{
+    return Run<CoPurchaseQuery>(span);
+}
 
-MinMaxFood MapReduceParallelStd::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span)
+std::size_t MapReduceParallel::GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
 {
-    using Monoid = std::array<int, 6>;
-    const auto Map = [this](const auto& transaction)
-    {
-        Monoid monoid{};
-        for (int foodID : transaction.GetPurchases())
-        {
-            const bakery::FoodItem& food = m_database.GetFood(foodID);
-            ++monoid.at(static_cast<std::size_t>(food.type));
-        }
+    return Run(span, FilteredQuery<CountQuery>{ m_database, predicate });
+}
 
-        return monoid;
-    };
+Cents MapReduceParallel::GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
+{
+    return Run(span, FilteredQuery<RevenueQuery>{ m_database, predicate });
+}
 
-    const auto Reduce = [](const Monoid& aggregate, const Monoid& next)
-    {
-        Monoid result = aggregate;
-        for (std::size_t index = 0; index < result.size(); ++index)
-            result.at(index) += next.at(index);
+TicketTotalDistribution MapReduceParallel::GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span)
+{
+    return Run<TicketDistributionQuery>(span);
+}
 
-        return result;
-    };
+QuantileSketch MapReduceParallel::GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    return Run<TicketTotalQuantilesQuery>(span);
+}
 
-    const auto result = std::transform_reduce(std::execution::par_unseq, span.begin(), span.end(), Monoid{}, Reduce, Map);
+QuantileSketch MapReduceParallel::GetGratuityQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    return Run<GratuityQuantilesQuery>(span);
+}
 
-    const auto& [min, max] = std::ranges::minmax_element(result);
+template<typename Query>
+typename Query::Result MapReduceParallel::Run(const std::span<const bakery::Transaction>& span, const Query& query)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
 
-    return { static_cast<bakery::FoodType>(std::distance(std::begin(result), min)),
-            static_cast<bakery::FoodType>(std::distance(std::begin(result), max)) };
+    const auto chunkStart = metrics::Now();
+    std::vector<std::span<const bakery::Transaction>> chunks;
+    detail::Chunk(span, m_pool.ThreadCount(), chunks);
+    metrics::RecordChunking(chunkStart);
+
+    return Query::Finalize(detail::ParallelMapReduce(m_pool, chunks, detail::Mapper(query), detail::Reducer<Query>()));
 }
 
-std::size_t MapReduceParallelStd::GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span)
+
+
+void MapReduceParallelStd::RunChunks(std::size_t chunkCount, std::size_t /*chunkRows*/, const CancellationToken& token, const std::function<void(std::size_t)>& work)
 {
-    using Monoid = int;
-    const auto Map = [this](const auto& transaction)
-    {
-        double total = 0.0;
-        for (int foodID : transaction.GetPurchases())
+    // A real container, since the parallel algorithms fall back to serial on iterators that aren't random access
+    std::vector<std::size_t> indices(chunkCount);
+    std::iota(indices.begin(), indices.end(), std::size_t{ 0 });
+
+    // An exception escaping a parallel algorithm terminates, so the first one is kept and rethrown here instead
+    std::mutex mutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed = false;
+
+    std::for_each(std::execution::par, indices.begin(), indices.end(), [&](std::size_t index) {
+        if (token.StopRequested() || failed.load(std::memory_order_relaxed))
+            return;
+
+        try
         {
-            const bakery::FoodItem& food = m_database.GetFood(foodID);
-            total += food.cost;
+            work(index);
         }
+        catch (...)
+        {
+            const std::lock_guard lock{ mutex };
+            if (!error)
+                error = std::current_exception();
 
-        return total > 15.0 ? 1 : 0;
-    };
+            failed.store(true, std::memory_order_relaxed);
+        }
+    });
 
-    return std::transform_reduce(std::execution::par_unseq, span.begin(), span.end(), Monoid{}, std::plus<int>{}, Map);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+MinMaxFood MapReduceParallelStd::GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span)
+{
+    return Run<PopularItemsQuery>(span);
+}
+
+std::size_t MapReduceParallelStd::GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span)
+{
+    return Run<TransactionsOver15Query>(span);
 }
 
 std::size_t MapReduceParallelStd::GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span)
 {
-    using Monoid = int;
-    const auto Map = [this](const auto& transaction) {
-        return transaction.GetPurchases().size();
-    };
+    return Run<LargestPurchaseQuery>(span);
+}
 
-    const auto Reduce = [](const Monoid& aggregate, const Monoid& next) {
-        return std::max(aggregate, next);
-    };
+Cents MapReduceParallelStd::GetRevenue(const std::span<const bakery::Transaction>& span)
+{
+    return Run<RevenueQuery>(span);
+}
+
+Cents MapReduceParallelStd::GetTotalGratuity(const std::span<const bakery::Transaction>& span)
+{
+    return Run<GratuityQuery>(span);
+}
+
+Cents MapReduceParallelStd::GetAverageTicket(const std::span<const bakery::Transaction>& span)
+{
+    return Run<AverageTicketQuery>(span);
+}
+
+std::vector<HeavyHitter> MapReduceParallelStd::GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    return First(Run<TopItemsQuery>(span), count);
+}
 
-    return std::transform_reduce(std::execution::par_unseq, span.begin(), span.end(), Monoid{}, Reduce, Map);
+std::vector<HeavyHitter> MapReduceParallelStd::GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count)
+{
+    return First(Run<TopBasketsQuery>(span), count);
+}
+
+CoPurchaseMatrix MapReduceParallelStd::GetCoPurchases(const std::span<const bakery::Transaction>& span)
+{
+    return Run<CoPurchaseQuery>(span);
+}
+
+std::size_t MapReduceParallelStd::GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
+{
+    return Run(span, FilteredQuery<CountQuery>{ m_database, predicate });
+}
+
+Cents MapReduceParallelStd::GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate)
+{
+    return Run(span, FilteredQuery<RevenueQuery>{ m_database, predicate });
+}
+
+TicketTotalDistribution MapReduceParallelStd::GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span)
+{
+    return Run<TicketDistributionQuery>(span);
+}
+
+QuantileSketch MapReduceParallelStd::GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    return Run<TicketTotalQuantilesQuery>(span);
+}
+
+QuantileSketch MapReduceParallelStd::GetGratuityQuantiles(const std::span<const bakery::Transaction>& span)
+{
+    return Run<GratuityQuantilesQuery>(span);
+}
+
+template<typename Query>
+typename Query::Result MapReduceParallelStd::Run(const std::span<const bakery::Transaction>& span, const Query& query)
+{
+    metrics::RecordRows(span.size(), span.size_bytes());
+
+    // Queries that map whole chunks at a time are reduced over fixed size blocks, rather than over every row
+    if constexpr (detail::MapsChunks<Query>)
+    {
+        constexpr std::size_t kBlockSize = 1 << 16;
+
+        std::vector<std::span<const bakery::Transaction>> blocks;
+        for (std::size_t offset = 0; offset < span.size(); offset += kBlockSize)
+            blocks.push_back(span.subspan(offset, std::min(kBlockSize, span.size() - offset)));
+
+        const auto result = std::transform_reduce(std::execution::par_unseq, blocks.begin(), blocks.end(), typename Query::Monoid{},
+                                                  detail::Reducer<Query>(), [&query](const auto& block) { return query.MapChunk(block); });
+
+        return Query::Finalize(result);
+    }
+    else
+    {
+        const auto result = std::transform_reduce(std::execution::par_unseq, span.begin(), span.end(), typename Query::Monoid{},
+                                                  detail::Reducer<Query>(), detail::Mapper(query));
+
+        return Query::Finalize(result);
+    }
 }
 } // end queries namespace
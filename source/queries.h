@@ -1,11 +1,33 @@
 #pragma once
 
 #include "bakery.h"
+#include "cancellation.h"
+#include "compression.h"
+#include "copurchase.h"
+#include "heavyhitters.h"
+#include "metrics.h"
+#include "money.h"
+#include "predicates.h"
+#include "quantiles.h"
+#include "serialization.h"
+#include "ticketdistribution.h"
+#include "trace.h"
 #include "ThreadPool.h"
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
 #include <iterator>
+#include <numeric>
 #include <optional>
+#include <random>
+#include <ranges>
 #include <span>
 #include <stdexcept>
 #include <type_traits>
@@ -58,20 +80,84 @@ void Chunk(const std::span<T>& span, std::size_t numChunks, std::vector<std::spa
 /// The idea behind this method is that it's not necessary to first map all the types to monoids prior
 /// to reduction, due to incremental aggregation and the identity property of monoids. This allows me
 /// to map and reduce at the same time, yielding O(1) space.
+///
+/// Reducers for large monoids (like the heavy hitters summaries) can also provide Accumulate, which reduces
+/// into the aggregate in place, rather than copying it for every value. Mappers that have a faster way to
+/// map a whole span than one value at a time (like the co-purchase matrix) can provide MapChunk.
 /// </summary>
 template<typename T, typename Mapper, typename Reducer, typename Monoid = std::invoke_result_t<Mapper, T>>
     requires std::invocable<Mapper, T> &&
              std::invocable<Reducer, Monoid, Monoid>
 Monoid MapReduce(const std::span<const T>& span, Mapper map, Reducer reducer)
 {
+    if constexpr (requires { { map.MapChunk(span) } -> std::same_as<Monoid>; })
+        return map.MapChunk(span);
+
     Monoid aggregate{};
 
     for (const auto& value : span)
-        aggregate = reducer(aggregate, map(value));
+    {
+        if constexpr (requires { reducer.Accumulate(aggregate, map(value)); })
+            reducer.Accumulate(aggregate, map(value));
+        else
+            aggregate = reducer(aggregate, map(value));
+    }
 
     return aggregate;
 }
 
+/// <summary>
+/// Runs MapReduce over every chunk on the given pool, then reduces the partial results on the calling thread
+/// in chunk order. The parallel strategies all funnel through here, so this is where the hot path is instrumented
+/// (queue wait, per-chunk wall time, future waits and the final reduction) and traced.
+/// </summary>
+template<typename T, typename Mapper, typename Reducer, typename Monoid = std::invoke_result_t<Mapper, T>>
+    requires std::invocable<Mapper, T> &&
+             std::invocable<Reducer, Monoid, Monoid>
+Monoid ParallelMapReduce(ThreadPool& pool, const std::vector<std::span<const T>>& chunks, Mapper map, Reducer reducer,
+                         Monoid identity = {})
+{
+    metrics::ChunkTimes chunkTimes{ chunks.size() };
+
+    std::vector<std::future<Monoid>> futures;
+    futures.reserve(chunks.size());
+
+    for (std::size_t index = 0; index < chunks.size(); ++index)
+    {
+        const auto queued = metrics::Now();
+        futures.push_back(pool.Run([&, index, queued]() -> Monoid {
+            metrics::RecordQueueWait(queued);
+            const trace::ScopedEvent event{ "map_reduce", static_cast<std::int64_t>(index) };
+
+            const auto start = metrics::Now();
+            Monoid partial = MapReduce(chunks[index], map, reducer);
+            chunkTimes.Record(index, start);
+
+            return partial;
+        }));
+    }
+
+    Monoid result = identity;
+    for (std::size_t index = 0; index < futures.size(); ++index)
+    {
+        const auto waitStart = metrics::Now();
+        const Monoid partial = [&]() {
+            const trace::ScopedEvent event{ "future_wait", static_cast<std::int64_t>(index) };
+            return futures[index].get();
+        }();
+        metrics::RecordFutureWait(waitStart);
+
+        const auto reduceStart = metrics::Now();
+        const trace::ScopedEvent event{ "reduce", static_cast<std::int64_t>(index) };
+        result = reducer(result, partial);
+        metrics::RecordReduce(reduceStart);
+    }
+
+    chunkTimes.Commit();
+
+    return result;
+}
+
 /// <summary>
 /// This is a helper type for incremental aggregation queries. It stores the span and the accumulated
 /// result, which can later be pulled out and combined with new monoid reductions.
@@ -90,22 +176,821 @@ struct CacheEntry
 
 using MinMaxFood = std::pair<bakery::FoodType, bakery::FoodType>;
 
+namespace detail
+{
+/// <summary>
+/// Scales a sum over a uniformly random fraction of the rows up to an estimate of the sum over all of them.
+/// The additive queries below offer this as Extrapolate, which is how a progressive query estimates its final
+/// value. Queries without it (maxima, averages, rankings, distributions) are estimated by their partial as is.
+/// </summary>
+template<typename Sum>
+Sum ExtrapolateSum(Sum aggregate, double coverage)
+{
+    if (coverage <= 0.0 || coverage >= 1.0)
+        return aggregate;
+
+    return static_cast<Sum>(std::llround(static_cast<double>(aggregate) / coverage));
+}
+
+template<typename Query>
+concept MapsChunks = requires(const Query& query, std::span<const bakery::Transaction> span)
+{
+    { query.MapChunk(span) } -> std::same_as<typename Query::Monoid>;
+};
+
+template<typename Query>
+concept MapsBlocks = requires(const Query& query, const bakery::CompressedBlockView& block)
+{
+    { query.MapBlock(block) } -> std::same_as<typename Query::Monoid>;
+};
+
+template<typename Query>
+concept AccumulatesInPlace = requires(typename Query::Monoid& aggregate, const typename Query::Monoid& next)
+{
+    Query::Accumulate(aggregate, next);
+};
+
+template<typename Query>
+concept Extrapolates = requires(const typename Query::Monoid& aggregate, double coverage)
+{
+    { Query::Extrapolate(aggregate, coverage) } -> std::same_as<typename Query::Result>;
+};
+} // end detail namespace
+
+/// <summary>
+/// These are the map and reduce halves of each query, along with the monoid they reduce into and how the
+/// final answer is pulled out of it. The parallel strategies (and the kernel benchmarks) share these, rather
+/// than each restating the same lambdas, and callers run them through QueryStrategies::RunCancellable and
+/// RunProgressive to stop a query early or watch its estimate converge.
+///
+/// The queries that only look at what was bought also provide MapBlock, which maps a compressed block from
+/// its distinct baskets, each weighted by how many rows bought it (see CompressedBlockView::CountMasks), so
+/// the block's rows are never built. That's how the out-of-core executor scans a compressed snapshot.
+/// </summary>
+struct PopularItemsQuery
+{
+    using Monoid = std::array<int, 6>;
+    using Result = MinMaxFood;
+
+    const bakery::Database& database;
+
+    Monoid Map(const bakery::Transaction& transaction) const
+    {
+        Monoid monoid{};
+        for (int foodID : transaction.GetPurchases())
+        {
+            const bakery::FoodItem& food = database.GetFood(foodID);
+            ++monoid.at(static_cast<std::size_t>(food.type));
+        }
+
+        return monoid;
+    }
+
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid{};
+        for (const auto& [mask, rows] : block.CountMasks())
+        {
+            const Monoid basket = Map(bakery::Transaction{ .purchases = mask });
+            for (std::size_t index = 0; index < monoid.size(); ++index)
+                monoid[index] += basket[index] * static_cast<int>(rows);
+        }
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next)
+    {
+        Monoid result = aggregate;
+        for (std::size_t index = 0; index < result.size(); ++index)
+            result.at(index) += next.at(index);
+
+        return result;
+    }
+
+    static Result Finalize(const Monoid& aggregate)
+    {
+        const auto& [min, max] = std::ranges::minmax_element(aggregate);
+
+        return {static_cast<bakery::FoodType>(std::distance(std::begin(aggregate), min)),
+                static_cast<bakery::FoodType>(std::distance(std::begin(aggregate), max))};
+    }
+};
+
+struct TransactionsOver15Query
+{
+    using Monoid = std::size_t;
+    using Result = std::size_t;
+
+    const bakery::Database& database;
+
+    Monoid Map(const bakery::Transaction& transaction) const
+    {
+        double total = 0.0;
+        for (int foodID : transaction.GetPurchases())
+        {
+            const bakery::FoodItem& food = database.GetFood(foodID);
+            total += food.cost;
+        }
+
+        return total > 15.0 ? 1 : 0;
+    }
+
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid = 0;
+        for (const auto& [mask, rows] : block.CountMasks())
+            monoid += Map(bakery::Transaction{ .purchases = mask }) * rows;
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return aggregate + next; }
+    static Result Finalize(const Monoid& aggregate) { return aggregate; }
+
+    // What the count over every row would be, from the count over the given fraction of them
+    static Result Extrapolate(const Monoid& aggregate, double coverage) { return detail::ExtrapolateSum(aggregate, coverage); }
+};
+
+struct LargestPurchaseQuery
+{
+    using Monoid = std::size_t;
+    using Result = std::size_t;
+
+    const bakery::Database& database;
+
+    Monoid Map(const bakery::Transaction& transaction) const { return transaction.GetPurchases().size(); }
+
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid = 0;
+        for (const bakery::MaskCount& count : block.CountMasks())
+            monoid = std::max<Monoid>(monoid, std::popcount(count.mask));
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return std::max(aggregate, next); }
+    static Result Finalize(const Monoid& aggregate) { return aggregate; }
+};
+
+struct RevenueQuery
+{
+    using Monoid = Cents;
+    using Result = Cents;
+
+    explicit RevenueQuery(const bakery::Database& database) : prices(detail::GetPricesInCents(database)) {}
+
+    Monoid Map(const bakery::Transaction& transaction) const { return detail::GetSubtotal(prices, transaction); }
+
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid = 0;
+        for (const auto& [mask, rows] : block.CountMasks())
+            monoid += detail::GetSubtotal(prices, mask) * rows;
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return aggregate + next; }
+    static Result Finalize(const Monoid& aggregate) { return aggregate; }
+    static Result Extrapolate(const Monoid& aggregate, double coverage) { return detail::ExtrapolateSum(aggregate, coverage); }
+
+    detail::PriceTable prices;
+};
+
+struct GratuityQuery
+{
+    using Monoid = Cents;
+    using Result = Cents;
+
+    explicit GratuityQuery(const bakery::Database& database) : prices(detail::GetPricesInCents(database)) {}
+
+    Monoid Map(const bakery::Transaction& transaction) const { return detail::GetGratuity(prices, transaction); }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return aggregate + next; }
+    static Result Finalize(const Monoid& aggregate) { return aggregate; }
+    static Result Extrapolate(const Monoid& aggregate, double coverage) { return detail::ExtrapolateSum(aggregate, coverage); }
+
+    detail::PriceTable prices;
+};
+
+struct TicketTotals
+{
+    Cents subtotal = 0;
+    std::int64_t tickets = 0;
+};
+
+/// <summary>
+/// The average subtotal (before gratuity) of a ticket, rounded to the nearest cent.
+/// </summary>
+struct AverageTicketQuery
+{
+    using Monoid = TicketTotals;
+    using Result = Cents;
+
+    explicit AverageTicketQuery(const bakery::Database& database) : prices(detail::GetPricesInCents(database)) {}
+
+    Monoid Map(const bakery::Transaction& transaction) const { return { detail::GetSubtotal(prices, transaction), 1 }; }
+
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid{ 0, static_cast<std::int64_t>(block.Rows()) };
+        for (const auto& [mask, rows] : block.CountMasks())
+            monoid.subtotal += detail::GetSubtotal(prices, mask) * rows;
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next)
+    {
+        return { aggregate.subtotal + next.subtotal, aggregate.tickets + next.tickets };
+    }
+
+    static Result Finalize(const Monoid& aggregate)
+    {
+        if (aggregate.tickets == 0)
+            return 0;
+
+        return (aggregate.subtotal + aggregate.tickets / 2) / aggregate.tickets;
+    }
+
+    detail::PriceTable prices;
+};
+
+/// <summary>
+/// The distribution of ticket subtotals, in cents. Each chunk is counted into one histogram sized for the
+/// largest possible ticket, rather than a histogram per row.
+/// </summary>
+struct TicketDistributionQuery
+{
+    using Monoid = TicketTotalHistogram;
+    using Result = TicketTotalDistribution;
+
+    explicit TicketDistributionQuery(const bakery::Database& database)
+        : prices(detail::GetPricesInCents(database)), maxTotal(std::accumulate(prices.begin(), prices.end(), Cents{ 0 }))
+    {}
+
+    Monoid Map(const bakery::Transaction& transaction) const
+    {
+        Monoid monoid;
+        monoid.Add(detail::GetSubtotal(prices, transaction));
+
+        return monoid;
+    }
+
+    Monoid MapChunk(std::span<const bakery::Transaction> span) const
+    {
+        Monoid monoid{ maxTotal };
+        for (const bakery::Transaction& transaction : span)
+            monoid.Add(detail::GetSubtotal(prices, transaction));
+
+        return monoid;
+    }
+
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid{ maxTotal };
+        for (const auto& [mask, rows] : block.CountMasks())
+            monoid.Add(detail::GetSubtotal(prices, mask), rows);
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return Monoid::Merge(aggregate, next); }
+    static void Accumulate(Monoid& aggregate, const Monoid& next) { aggregate.Merge(next); }
+    static Result Finalize(const Monoid& aggregate) { return Result{ aggregate }; }
+
+    detail::PriceTable prices;
+    Cents maxTotal = 0;
+};
+
+/// <summary>
+/// Quantile sketches of ticket subtotals and of gratuity amounts, both in cents. Each chunk is added to a
+/// single sketch, which is then merged, rather than building a sketch per row.
+/// </summary>
+template<Cents (*Value)(const detail::PriceTable&, const bakery::Transaction&)>
+struct QuantilesQuery
+{
+    using Monoid = QuantileSketch;
+    using Result = QuantileSketch;
+
+    explicit QuantilesQuery(const bakery::Database& database) : prices(detail::GetPricesInCents(database)) {}
+
+    Monoid Map(const bakery::Transaction& transaction) const
+    {
+        Monoid monoid;
+        monoid.Add(static_cast<double>(Value(prices, transaction)));
+
+        return monoid;
+    }
+
+    Monoid MapChunk(std::span<const bakery::Transaction> span) const
+    {
+        Monoid monoid;
+        for (const bakery::Transaction& transaction : span)
+            monoid.Add(static_cast<double>(Value(prices, transaction)));
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return Monoid::Merge(aggregate, next); }
+    static void Accumulate(Monoid& aggregate, const Monoid& next) { aggregate.Merge(next); }
+    static Result Finalize(const Monoid& aggregate) { return aggregate; }
+
+    detail::PriceTable prices;
+};
+
+using TicketTotalQuantilesQuery = QuantilesQuery<&detail::GetSubtotal>;
+using GratuityQuantilesQuery = QuantilesQuery<&detail::GetGratuity>;
+
+/// <summary>
+/// Misra-Gries summaries of the most purchased items, and of the most common baskets (keyed by their purchase
+/// mask). There are only 27 items, so the items summary never has to drop one, and its counts are exact. The
+/// baskets summary holds 128 of the up to 2^27 baskets, so its counts are within Total() / 129 of the truth.
+/// Each chunk is added to a single summary, which is then merged, rather than building a summary per row.
+/// </summary>
+inline constexpr std::size_t kTopItemsCapacity = 32;
+inline constexpr std::size_t kTopBasketsCapacity = 128;
+
+struct TopItemsQuery
+{
+    using Monoid = HeavyHitters<kTopItemsCapacity>;
+    using Result = std::vector<HeavyHitter>;
+
+    const bakery::Database& database;
+
+    Monoid Map(const bakery::Transaction& transaction) const
+    {
+        Monoid monoid;
+        for (auto purchases = static_cast<std::uint32_t>(transaction.purchases.to_ulong()); purchases != 0; purchases &= purchases - 1)
+            monoid.Add(std::countr_zero(purchases));
+
+        return monoid;
+    }
+
+    Monoid MapChunk(std::span<const bakery::Transaction> span) const
+    {
+        // There are fewer items than counters, so this never prunes
+        Monoid monoid;
+        for (const bakery::Transaction& transaction : span)
+        {
+            for (auto purchases = static_cast<std::uint32_t>(transaction.purchases.to_ulong()); purchases != 0; purchases &= purchases - 1)
+                monoid.Add(std::countr_zero(purchases));
+        }
+
+        return monoid;
+    }
+
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid;
+        for (const auto& [mask, rows] : block.CountMasks())
+        {
+            for (std::uint32_t purchases = mask; purchases != 0; purchases &= purchases - 1)
+                monoid.Add(std::countr_zero(purchases), rows);
+        }
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return Monoid::Merge(aggregate, next); }
+    static void Accumulate(Monoid& aggregate, const Monoid& next) { aggregate.Merge(next); }
+    static Result Finalize(const Monoid& aggregate) { return aggregate.Ranked(); }
+};
+
+struct TopBasketsQuery
+{
+    using Monoid = HeavyHitters<kTopBasketsCapacity>;
+    using Result = std::vector<HeavyHitter>;
+
+    const bakery::Database& database;
+
+    Monoid Map(const bakery::Transaction& transaction) const
+    {
+        Monoid monoid;
+        monoid.Add(static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+
+        return monoid;
+    }
+
+    Monoid MapChunk(std::span<const bakery::Transaction> span) const
+    {
+        Monoid monoid;
+        monoid.AddAll(span | std::views::transform([](const bakery::Transaction& transaction) {
+            return static_cast<std::uint32_t>(transaction.purchases.to_ulong());
+        }));
+
+        return monoid;
+    }
+
+    // Each distinct basket is added once with its count, which is a weighted update with the same error bound
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid;
+        for (const auto& [mask, rows] : block.CountMasks())
+            monoid.Add(mask, rows);
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return Monoid::Merge(aggregate, next); }
+    static void Accumulate(Monoid& aggregate, const Monoid& next) { aggregate.Merge(next); }
+    static Result Finalize(const Monoid& aggregate) { return aggregate.Ranked(); }
+};
+
+/// <summary>
+/// Co-purchase counts, via the bit-sliced counter for whole chunks. Map (a matrix per transaction) is only
+/// there for callers that insist on going row by row.
+/// </summary>
+struct CoPurchaseQuery
+{
+    using Monoid = CoPurchaseMatrix;
+    using Result = CoPurchaseMatrix;
+
+    const bakery::Database& database;
+
+    Monoid Map(const bakery::Transaction& transaction) const
+    {
+        Monoid monoid;
+        monoid.Add(static_cast<std::uint32_t>(transaction.purchases.to_ulong()));
+
+        return monoid;
+    }
+
+    Monoid MapChunk(std::span<const bakery::Transaction> span) const { return CoPurchaseCounter::Count(span); }
+
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const
+    {
+        Monoid monoid;
+        for (const auto& [mask, rows] : block.CountMasks())
+            monoid.Add(mask, rows);
+
+        return monoid;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return Monoid::Merge(aggregate, next); }
+    static void Accumulate(Monoid& aggregate, const Monoid& next) { aggregate.Merge(next); }
+    static Result Finalize(const Monoid& aggregate) { return aggregate; }
+};
+
+struct CountQuery
+{
+    using Monoid = std::size_t;
+    using Result = std::size_t;
+
+    const bakery::Database& database;
+
+    Monoid Map(const bakery::Transaction&) const { return 1; }
+    Monoid MapBlock(const bakery::CompressedBlockView& block) const { return block.Rows(); }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return aggregate + next; }
+    static Result Finalize(const Monoid& aggregate) { return aggregate; }
+    static Result Extrapolate(const Monoid& aggregate, double coverage) { return detail::ExtrapolateSum(aggregate, coverage); }
+};
+
+/// <summary>
+/// Any of the queries above, over only the rows the predicate matches. The predicate is evaluated in the map
+/// step, and the rows it rejects map to the identity.
+/// </summary>
+template<typename Query>
+struct FilteredQuery
+{
+    using Monoid = typename Query::Monoid;
+    using Result = typename Query::Result;
+
+    FilteredQuery(const bakery::Database& database, const predicates::Predicate& predicate)
+        : query{ database }, filter(database, predicate)
+    {}
+
+    Monoid Map(const bakery::Transaction& transaction) const
+    {
+        return filter.Matches(transaction) ? query.Map(transaction) : Monoid{};
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return Query::Reduce(aggregate, next); }
+    static Result Finalize(const Monoid& aggregate) { return Query::Finalize(aggregate); }
+
+    static Result Extrapolate(const Monoid& aggregate, double coverage)
+        requires detail::Extrapolates<Query>
+    {
+        return Query::Extrapolate(aggregate, coverage);
+    }
+
+    static void Accumulate(Monoid& aggregate, const Monoid& next)
+        requires detail::AccumulatesInPlace<Query>
+    {
+        Query::Accumulate(aggregate, next);
+    }
+
+    Query query;
+    predicates::CompiledPredicate filter;
+};
+
+namespace detail
+{
+template<typename Query>
+struct QueryMapper
+{
+    const Query& query;
+
+    typename Query::Monoid operator()(const bakery::Transaction& transaction) const { return query.Map(transaction); }
+
+    typename Query::Monoid MapChunk(std::span<const bakery::Transaction> span) const
+        requires MapsChunks<Query>
+    {
+        return query.MapChunk(span);
+    }
+};
+
+template<typename Query>
+struct QueryReducer
+{
+    using Monoid = typename Query::Monoid;
+
+    Monoid operator()(const Monoid& aggregate, const Monoid& next) const { return Query::Reduce(aggregate, next); }
+
+    void Accumulate(Monoid& aggregate, const Monoid& next) const
+        requires AccumulatesInPlace<Query>
+    {
+        Query::Accumulate(aggregate, next);
+    }
+};
+
+/// <summary>
+/// Adapts one of the query definitions above to the mapper / reducer pair MapReduce expects.
+/// </summary>
+template<typename Query>
+auto Mapper(const Query& query)
+{
+    return QueryMapper<Query>{ query };
+}
+
+template<typename Query>
+auto Reducer()
+{
+    return QueryReducer<Query>{};
+}
+} // end detail namespace
+
+/// <summary>
+/// What a query reduced before it was cancelled (or all of it, if it wasn't): the monoid over the chunks
+/// that finished, and how many rows those were. The monoid is a proper partial, so it can be finalized as is,
+/// scaled up by the coverage, or reduced with the rest of the span later.
+/// </summary>
+template<typename Query>
+struct PartialResult
+{
+    typename Query::Monoid monoid{};
+    std::size_t rows = 0;
+    std::size_t totalRows = 0;
+
+    bool Complete() const { return rows == totalRows; }
+    double Coverage() const { return totalRows == 0 ? 1.0 : static_cast<double>(rows) / totalRows; }
+
+    typename Query::Result Finalize() const { return Query::Finalize(monoid); }
+};
+
+/// <summary>
+/// Where a progressive query has got to after a batch of blocks: the partial so far, the final value it
+/// points to (extrapolated, for queries that can be), and for extrapolated numbers, the standard error of
+/// that estimate, from how much the blocks' own values vary. The error shrinks to 0 as the blocks run out.
+/// </summary>
+template<typename Query>
+struct Progress
+{
+    PartialResult<Query> partial;
+    typename Query::Result estimate{};
+    std::optional<double> standardError;
+    std::size_t blocks = 0;
+    std::size_t totalBlocks = 0;
+    std::size_t batches = 0;
+};
+
+struct ProgressiveOptions
+{
+    // Small blocks give a first answer sooner, and a fairer sample of the span, for a bit more overhead
+    std::size_t blockRows = 1 << 14;
+    std::size_t blocksPerBatch = 16;
+
+    // The block order is a shuffle seeded with this, so a run can be repeated
+    std::uint64_t seed = 0x9E37'79B9'7F4A'7C15;
+};
+
 class QueryStrategies
 {
 public:
+    // Cancellable queries check their token between chunks of this many rows
+    static constexpr std::size_t kCancellationChunkRows = 1 << 16;
+
     QueryStrategies(const bakery::Database& database)
         : m_database(database)
     {}
 
     virtual ~QueryStrategies() = default;
 
+    /// <summary>
+    /// Runs any of the query definitions over the span, in chunks of kCancellationChunkRows, until the token
+    /// says to stop. Chunks that have started always finish, so a cancelled query returns within one chunk
+    /// per thread, with the monoid over every chunk that finished (reduced in span order).
+    ///
+    /// Each query is built from the database and the given arguments, like the out-of-core executor's.
+    /// </summary>
+    template<typename Query, typename... Args>
+    PartialResult<Query> RunCancellable(const std::span<const bakery::Transaction>& span, const CancellationToken& token, const Args&... args)
+    {
+        const Query query{ m_database, args... };
+        const std::size_t chunkCount = (span.size() + kCancellationChunkRows - 1) / kCancellationChunkRows;
+
+        const auto GetChunk = [&span](std::size_t index) {
+            const std::size_t offset = index * kCancellationChunkRows;
+            return span.subspan(offset, std::min(kCancellationChunkRows, span.size() - offset));
+        };
+
+        std::vector<std::optional<typename Query::Monoid>> partials(chunkCount);
+        RunChunks(chunkCount, kCancellationChunkRows, token, [&](std::size_t index) {
+            partials[index] = detail::MapReduce(GetChunk(index), detail::Mapper(query), detail::Reducer<Query>());
+        });
+
+        PartialResult<Query> result{ .totalRows = span.size() };
+        for (std::size_t index = 0; index < chunkCount; ++index)
+        {
+            if (partials[index])
+            {
+                result.monoid = Query::Reduce(result.monoid, *partials[index]);
+                result.rows += GetChunk(index).size();
+            }
+        }
+
+        metrics::RecordRows(result.rows, result.rows * sizeof(bakery::Transaction));
+
+        return result;
+    }
+
+    /// <summary>
+    /// Runs any of the query definitions over the span in blocks, in a random order, and publishes where it
+    /// has got to after every batch of blocks. So the first estimate comes from a sample of the whole span
+    /// within a batch's time, and improves with every batch after it, until it's the exact answer. Publishing
+    /// false (once the answer looks stable, say) or the token stop it early, and either way, what it had
+    /// reduced is returned, as RunCancellable's is.
+    ///
+    /// Blocks are reduced in the shuffled order, so approximate monoids can differ slightly from a scan in
+    /// span order, within their usual bounds. Exact ones give the same final answer.
+    /// </summary>
+    template<typename Query, typename... Args>
+    PartialResult<Query> RunProgressive(const std::span<const bakery::Transaction>& span, const std::function<bool(const Progress<Query>&)>& publish,
+                                        const ProgressiveOptions& options = {}, const CancellationToken& token = {}, const Args&... args)
+    {
+        using Monoid = typename Query::Monoid;
+        using Result = typename Query::Result;
+
+        if (options.blockRows == 0 || options.blocksPerBatch == 0)
+            throw std::invalid_argument{ "Blocks and batches must hold at least one row and block." };
+
+        const Query query{ m_database, args... };
+        const std::size_t blockCount = (span.size() + options.blockRows - 1) / options.blockRows;
+
+        const auto GetBlock = [&span, &options](std::size_t index) {
+            const std::size_t offset = index * options.blockRows;
+            return span.subspan(offset, std::min(options.blockRows, span.size() - offset));
+        };
+
+        std::vector<std::size_t> order(blockCount);
+        std::iota(order.begin(), order.end(), std::size_t{ 0 });
+        std::shuffle(order.begin(), order.end(), std::mt19937_64{ options.seed });
+
+        Progress<Query> progress;
+        progress.partial.totalRows = span.size();
+        progress.totalBlocks = blockCount;
+
+        // Each block's value, scaled up to a full block, is one sample of the mean a block contributes
+        constexpr bool kHasError = detail::Extrapolates<Query> && std::is_arithmetic_v<Result>;
+        double sum = 0.0;
+        double sumOfSquares = 0.0;
+
+        std::vector<std::optional<Monoid>> partials(options.blocksPerBatch);
+        for (std::size_t first = 0; first < blockCount && !token.StopRequested(); first += options.blocksPerBatch)
+        {
+            const std::size_t batchBlocks = std::min(options.blocksPerBatch, blockCount - first);
+            RunChunks(batchBlocks, options.blockRows, token, [&](std::size_t index) {
+                partials[index] = detail::MapReduce(GetBlock(order[first + index]), detail::Mapper(query), detail::Reducer<Query>());
+            });
+
+            for (std::size_t index = 0; index < batchBlocks; ++index)
+            {
+                if (!partials[index])
+                    continue;
+
+                const std::size_t rows = GetBlock(order[first + index]).size();
+                if constexpr (kHasError)
+                {
+                    const double value = static_cast<double>(Query::Finalize(*partials[index])) * options.blockRows / rows;
+                    sum += value;
+                    sumOfSquares += value * value;
+                }
+
+                progress.partial.monoid = Query::Reduce(progress.partial.monoid, *partials[index]);
+                progress.partial.rows += rows;
+                ++progress.blocks;
+                partials[index].reset();
+            }
+
+            ++progress.batches;
+
+            if constexpr (detail::Extrapolates<Query>)
+                progress.estimate = Query::Extrapolate(progress.partial.monoid, progress.partial.Coverage());
+            else
+                progress.estimate = Query::Finalize(progress.partial.monoid);
+
+            // Sampling blocks without replacement, so the variance shrinks by the fraction still to come
+            if constexpr (kHasError)
+            {
+                if (progress.blocks > 1)
+                {
+                    const auto blocks = static_cast<double>(progress.blocks);
+                    const double mean = sum / blocks;
+                    const double variance = std::max(sumOfSquares - blocks * mean * mean, 0.0) / (blocks - 1.0);
+                    const double remaining = 1.0 - blocks / blockCount;
+
+                    progress.standardError = blockCount * std::sqrt(variance / blocks * remaining);
+                }
+            }
+
+            if (!publish(progress))
+                break;
+        }
+
+        metrics::RecordRows(progress.partial.rows, progress.partial.rows * sizeof(bakery::Transaction));
+
+        return std::move(progress.partial);
+    }
+
+    /// <summary>
+    /// Runs work for each chunk index below chunkCount, checking the token before starting each one. This is
+    /// how a strategy spreads the cancellable and progressive queries' chunks over its threads, and chunkRows
+    /// (about how many rows each one is) is there to help it decide. By default, they're run in order on the
+    /// calling thread.
+    /// </summary>
+    virtual void RunChunks(std::size_t chunkCount, std::size_t chunkRows, const CancellationToken& token, const std::function<void(std::size_t)>& work);
+
     virtual MinMaxFood GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span, std::size_t chunkSize) { return {}; }  
     virtual MinMaxFood GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span) = 0;
     virtual std::size_t GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span) = 0;
     virtual std::size_t GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span) = 0;
 
+    // These are exact, and identical across strategies and thread counts
+    virtual Cents GetRevenue(const std::span<const bakery::Transaction>& span) = 0;
+    virtual Cents GetTotalGratuity(const std::span<const bakery::Transaction>& span) = 0;
+    virtual Cents GetAverageTicket(const std::span<const bakery::Transaction>& span) = 0;
+
+    // The most purchased items and most common baskets (by purchase mask), most frequent first, at most count of each
+    virtual std::vector<HeavyHitter> GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count) = 0;
+    virtual std::vector<HeavyHitter> GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count) = 0;
+
+    // How often every pair of items is bought together, with support and lift
+    virtual CoPurchaseMatrix GetCoPurchases(const std::span<const bakery::Transaction>& span) = 0;
+
+    // The number of transactions, and the revenue of the transactions, the predicate matches
+    virtual std::size_t GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) = 0;
+    virtual Cents GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) = 0;
+
+    // The distribution of ticket totals (before gratuity), to answer any number of the questions below from one scan
+    virtual TicketTotalDistribution GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span) = 0;
+
+    /// <summary>
+    /// Answers from the distribution, for sweeps over thresholds or percentiles. The distribution is kept for
+    /// the last span asked about, so only the first call over a span scans it, on every strategy, and the rest
+    /// are a lookup or a binary search. A longer span over the same rows (the database after an append) only
+    /// scans the rows past the ones already counted.
+    /// </summary>
+    std::int64_t GetNumberOfTransactionsOver(const std::span<const bakery::Transaction>& span, double threshold)
+    {
+        return GetCachedTicketTotalDistribution(span).CountOver(threshold);
+    }
+
+    std::int64_t GetNumberOfTransactionsBetween(const std::span<const bakery::Transaction>& span, double min, double max)
+    {
+        return GetCachedTicketTotalDistribution(span).CountBetween(min, max);
+    }
+
+    Cents GetTicketTotalPercentile(const std::span<const bakery::Transaction>& span, double fraction)
+    {
+        return GetCachedTicketTotalDistribution(span).Percentile(fraction);
+    }
+
+    // Approximate quantiles of ticket subtotals and gratuity amounts (in cents), in bounded memory
+    virtual QuantileSketch GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span) = 0;
+    virtual QuantileSketch GetGratuityQuantiles(const std::span<const bakery::Transaction>& span) = 0;
+
 protected:
     const bakery::Database& m_database;
+
+private:
+    const TicketTotalDistribution& GetCachedTicketTotalDistribution(const std::span<const bakery::Transaction>& span);
+
+    // The histogram the distribution helpers answer from, with the span it counts, and the distribution built from it
+    std::optional<detail::CacheEntry<TicketTotalHistogram>> m_histogramCache;
+    TicketTotalDistribution m_cachedDistribution;
 };
 
 class Sequential : public QueryStrategies
@@ -117,6 +1002,17 @@ public:
     virtual MinMaxFood GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span) override;
     virtual std::size_t GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span) override;
     virtual std::size_t GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetRevenue(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetTotalGratuity(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetAverageTicket(const std::span<const bakery::Transaction>& span) override;
+    virtual std::vector<HeavyHitter> GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual std::vector<HeavyHitter> GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual CoPurchaseMatrix GetCoPurchases(const std::span<const bakery::Transaction>& span) override;
+    virtual std::size_t GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual Cents GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual TicketTotalDistribution GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetGratuityQuantiles(const std::span<const bakery::Transaction>& span) override;
 };
 
 class SequentialIA : public QueryStrategies
@@ -124,16 +1020,59 @@ class SequentialIA : public QueryStrategies
 public:
     using QueryStrategies::QueryStrategies;
 
+    /// <summary>
+    /// Saves every cache, with the number of rows it covers and a fingerprint of those rows, so a restarted
+    /// process can pick up where this one left off. Loading restores the caches whose rows are still the
+    /// same prefix of the database, and returns how many that was (0 for a missing or corrupt file). The
+    /// others are left to be built by the next query, as usual.
+    /// </summary>
+    bool SaveCheckpoint(const std::filesystem::path& file) const;
+    std::size_t LoadCheckpoint(const std::filesystem::path& file);
+
+    /// <summary>
+    /// Brings every cache a query has already built up to the end of span, a grown version of the span they
+    /// were built over, so the next query is a lookup. Caches no query has asked for yet are left alone.
+    /// </summary>
+    void Advance(const std::span<const bakery::Transaction>& span);
+
     // Inherited via QueryStrategies
     virtual MinMaxFood GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span) override;
     virtual std::size_t GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span) override;
     virtual std::size_t GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetRevenue(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetTotalGratuity(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetAverageTicket(const std::span<const bakery::Transaction>& span) override;
+    virtual std::vector<HeavyHitter> GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual std::vector<HeavyHitter> GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual CoPurchaseMatrix GetCoPurchases(const std::span<const bakery::Transaction>& span) override;
+    virtual std::size_t GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual Cents GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual TicketTotalDistribution GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetGratuityQuantiles(const std::span<const bakery::Transaction>& span) override;
 
 private:
 
+    template<typename Query>
+    typename Query::Result Aggregate(std::optional<detail::CacheEntry<typename Query::Monoid>>& cache,
+                                     const std::span<const bakery::Transaction>& span);
+
+    // Visits every cache in a fixed order, which is what identifies them in a checkpoint
+    template<typename Self, typename Visitor>
+    static void ForEachCache(Self& self, Visitor&& visit);
+
     std::optional<detail::CacheEntry<std::array<int, 6>>> m_query1Cache;
     std::optional<detail::CacheEntry<std::size_t>> m_query2Cache;
     std::optional<detail::CacheEntry<std::size_t>> m_query3Cache;
+    std::optional<detail::CacheEntry<Cents>> m_revenueCache;
+    std::optional<detail::CacheEntry<Cents>> m_gratuityCache;
+    std::optional<detail::CacheEntry<TicketTotals>> m_ticketCache;
+    std::optional<detail::CacheEntry<TopItemsQuery::Monoid>> m_topItemsCache;
+    std::optional<detail::CacheEntry<TopBasketsQuery::Monoid>> m_topBasketsCache;
+    std::optional<detail::CacheEntry<CoPurchaseMatrix>> m_coPurchaseCache;
+    std::optional<detail::CacheEntry<TicketTotalHistogram>> m_ticketHistogramCache;
+    std::optional<detail::CacheEntry<QuantileSketch>> m_ticketQuantilesCache;
+    std::optional<detail::CacheEntry<QuantileSketch>> m_gratuityQuantilesCache;
 };
 
 class MapReduceParallel : public QueryStrategies
@@ -141,14 +1080,42 @@ class MapReduceParallel : public QueryStrategies
 public:
     using QueryStrategies::QueryStrategies;
 
+    /// <summary>
+    /// Runs the queries on a pool of the given size, rather than one thread per hardware thread.
+    /// The work is chunked into one piece per pool thread either way.
+    /// </summary>
+    MapReduceParallel(const bakery::Database& database, std::size_t threadCount)
+        : QueryStrategies(database), m_pool(threadCount)
+    {}
+
+    // Runs the chunks on the pool, with every pool thread taking the next chunk until they're done or it's time to stop
+    virtual void RunChunks(std::size_t chunkCount, std::size_t chunkRows, const CancellationToken& token, const std::function<void(std::size_t)>& work) override;
+
     // Inherited via QueryStrategies
     virtual MinMaxFood GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span, std::size_t chunkSize) override;
     virtual MinMaxFood GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span) override;
     virtual std::size_t GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span) override;
     virtual std::size_t GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetRevenue(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetTotalGratuity(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetAverageTicket(const std::span<const bakery::Transaction>& span) override;
+    virtual std::vector<HeavyHitter> GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual std::vector<HeavyHitter> GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual CoPurchaseMatrix GetCoPurchases(const std::span<const bakery::Transaction>& span) override;
+    virtual std::size_t GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual Cents GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual TicketTotalDistribution GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetGratuityQuantiles(const std::span<const bakery::Transaction>& span) override;
 
 private:
 
+    template<typename Query>
+    typename Query::Result Run(const std::span<const bakery::Transaction>& span) { return Run(span, Query{ m_database }); }
+
+    template<typename Query>
+    typename Query::Result Run(const std::span<const bakery::Transaction>& span, const Query& query);
+
     ThreadPool m_pool;
 };
 
@@ -157,13 +1124,33 @@ class MapReduceParallelStd : public QueryStrategies
 public:
     using QueryStrategies::QueryStrategies;
 
+    // Runs the chunks with the parallel std::for_each, and skips the ones that come up once it's time to stop
+    virtual void RunChunks(std::size_t chunkCount, std::size_t chunkRows, const CancellationToken& token, const std::function<void(std::size_t)>& work) override;
+
     // Inherited via QueryStrategies
     virtual MinMaxFood GetGreatestAndLeastPopularItems(const std::span<const bakery::Transaction>& span) override;
     virtual std::size_t GetNumberOfTransactionsOver15(const std::span<const bakery::Transaction>& span) override;
     virtual std::size_t GetLargestNumberOfPurachasesMade(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetRevenue(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetTotalGratuity(const std::span<const bakery::Transaction>& span) override;
+    virtual Cents GetAverageTicket(const std::span<const bakery::Transaction>& span) override;
+    virtual std::vector<HeavyHitter> GetTopItems(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual std::vector<HeavyHitter> GetTopBaskets(const std::span<const bakery::Transaction>& span, std::size_t count) override;
+    virtual CoPurchaseMatrix GetCoPurchases(const std::span<const bakery::Transaction>& span) override;
+    virtual std::size_t GetNumberOfTransactionsWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual Cents GetRevenueWhere(const std::span<const bakery::Transaction>& span, const predicates::Predicate& predicate) override;
+    virtual TicketTotalDistribution GetTicketTotalDistribution(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetTicketTotalQuantiles(const std::span<const bakery::Transaction>& span) override;
+    virtual QuantileSketch GetGratuityQuantiles(const std::span<const bakery::Transaction>& span) override;
 
 private:
 
+    template<typename Query>
+    typename Query::Result Run(const std::span<const bakery::Transaction>& span) { return Run(span, Query{ m_database }); }
+
+    template<typename Query>
+    typename Query::Result Run(const std::span<const bakery::Transaction>& span, const Query& query);
+
     ThreadPool m_pool;
 };
 } // end queries namespace
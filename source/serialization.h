@@ -0,0 +1,42 @@
+#pragma once
+
+#include <concepts>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+
+namespace queries::detail
+{
+/// <summary>
+/// How monoids are written out, to send them between processes or keep them across restarts. A monoid that
+/// has its own Save and Load uses them, and one that's plain bytes is written as they are. The bytes are in
+/// the host's layout, so they're only meant to be read back on the same kind of machine.
+/// </summary>
+template<typename Monoid>
+concept SavesItself = requires(const Monoid& monoid, Monoid& loaded, std::ostream& out, std::istream& in)
+{
+    { monoid.Save(out) } -> std::convertible_to<bool>;
+    { loaded.Load(in) } -> std::convertible_to<bool>;
+};
+
+template<typename Monoid>
+concept Serializable = SavesItself<Monoid> || std::is_trivially_copyable_v<Monoid>;
+
+template<Serializable Monoid>
+bool SaveMonoid(std::ostream& stream, const Monoid& monoid)
+{
+    if constexpr (SavesItself<Monoid>)
+        return monoid.Save(stream);
+    else
+        return static_cast<bool>(stream.write(reinterpret_cast<const char*>(&monoid), sizeof(Monoid)));
+}
+
+template<Serializable Monoid>
+bool LoadMonoid(std::istream& stream, Monoid& monoid)
+{
+    if constexpr (SavesItself<Monoid>)
+        return monoid.Load(stream);
+    else
+        return static_cast<bool>(stream.read(reinterpret_cast<char*>(&monoid), sizeof(Monoid)));
+}
+} // end queries::detail namespace
@@ -0,0 +1,201 @@
+#include "sharding.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <iomanip>
+#include <system_error>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace queries::sharding
+{
+#if defined(__unix__) || defined(__APPLE__)
+namespace
+{
+struct Worker
+{
+    pid_t pid = -1;
+    int fd = -1;
+};
+
+bool WriteAll(int fd, const std::string& bytes)
+{
+    std::size_t written = 0;
+    while (written < bytes.size())
+    {
+        const ssize_t result = write(fd, bytes.data() + written, bytes.size() - written);
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            return false;
+
+        written += static_cast<std::size_t>(result);
+    }
+
+    return true;
+}
+
+bool ReadAll(int fd, std::string& bytes)
+{
+    char buffer[1 << 16];
+    for (;;)
+    {
+        const ssize_t result = read(fd, buffer, sizeof(buffer));
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result < 0)
+            return false;
+
+        if (result == 0)
+            return true;
+
+        bytes.append(buffer, static_cast<std::size_t>(result));
+    }
+}
+
+// Waits for the worker to exit, and whether it exited cleanly
+bool Reap(const Worker& worker)
+{
+    int status = 0;
+    while (waitpid(worker.pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/// <summary>
+/// The body of a worker process. It only ever leaves through _exit, so none of the parent's atexit handlers or
+/// static destructors (like its thread pools') run in the child. The reply is only written once it's complete,
+/// and the exit status says whether it was.
+/// </summary>
+[[noreturn]] void RunWorker(const std::filesystem::path& shard, const std::function<std::string(const bakery::Database&)>& work, int fd)
+{
+    int status = 1;
+    try
+    {
+        bakery::Database database;
+        if (database.LoadSnapshot(shard))
+            status = WriteAll(fd, work(database)) ? 0 : 1;
+    }
+    catch (...)
+    {
+    }
+
+    _exit(status);
+}
+} // end unnamed namespace
+
+namespace detail
+{
+std::vector<std::string> RunWorkers(const std::vector<std::filesystem::path>& shards,
+                                    const std::function<std::string(const bakery::Database&)>& work)
+{
+    std::vector<Worker> workers;
+    workers.reserve(shards.size());
+
+    const auto Abandon = [&workers]() {
+        for (const Worker& worker : workers)
+        {
+            close(worker.fd);
+            kill(worker.pid, SIGKILL);
+            Reap(worker);
+        }
+    };
+
+    // Anything still buffered would otherwise be written once by every child, too
+    std::fflush(nullptr);
+
+    for (const std::filesystem::path& shard : shards)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            const int error = errno;
+            Abandon();
+            throw std::system_error{ error, std::generic_category(), "Couldn't create a pipe for a worker" };
+        }
+
+        const pid_t pid = fork();
+        if (pid < 0)
+        {
+            const int error = errno;
+            close(fds[0]);
+            close(fds[1]);
+            Abandon();
+            throw std::system_error{ error, std::generic_category(), "Couldn't fork a worker" };
+        }
+
+        if (pid == 0)
+        {
+            close(fds[0]);
+            for (const Worker& worker : workers)
+                close(worker.fd);
+
+            RunWorker(shard, work, fds[1]);
+        }
+
+        close(fds[1]);
+        workers.push_back({ pid, fds[0] });
+    }
+
+    // Reading the pipes in order is fine, a worker that's ahead just blocks until its turn
+    std::vector<std::string> partials(workers.size());
+    std::vector<std::size_t> failed;
+
+    for (std::size_t index = 0; index < workers.size(); ++index)
+    {
+        const bool read = ReadAll(workers[index].fd, partials[index]);
+        close(workers[index].fd);
+
+        if (!Reap(workers[index]) || !read)
+            failed.push_back(index);
+    }
+
+    if (!failed.empty())
+        throw std::runtime_error{ "The worker for shard " + shards[failed.front()].string() + " failed." };
+
+    return partials;
+}
+} // end detail namespace
+#else
+namespace detail
+{
+std::vector<std::string> RunWorkers(const std::vector<std::filesystem::path>&,
+                                    const std::function<std::string(const bakery::Database&)>&)
+{
+    throw std::runtime_error{ "Sharded execution needs POSIX processes." };
+}
+} // end detail namespace
+#endif
+
+std::vector<std::filesystem::path> WriteShards(std::span<const bakery::Transaction> transactions,
+                                               const std::filesystem::path& directory, std::size_t shardCount)
+{
+    std::filesystem::create_directories(directory);
+
+    std::vector<std::span<const bakery::Transaction>> chunks;
+    queries::detail::Chunk(transactions, shardCount, chunks);
+
+    std::vector<std::filesystem::path> shards;
+    for (std::size_t index = 0; index < chunks.size(); ++index)
+    {
+        std::ostringstream name;
+        name << "shard-" << std::setw(4) << std::setfill('0') << index << ".bin";
+
+        shards.push_back(directory / name.str());
+        if (!bakery::SaveSnapshot(chunks[index], shards.back()))
+            throw std::runtime_error{ "Couldn't write " + shards.back().string() };
+    }
+
+    return shards;
+}
+} // end queries::sharding namespace
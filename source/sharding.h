@@ -0,0 +1,102 @@
+#pragma once
+
+#include "bakery.h"
+#include "queries.h"
+#include "serialization.h"
+
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace queries::sharding
+{
+// Workers are forked processes, which needs POSIX
+#if defined(__unix__) || defined(__APPLE__)
+inline constexpr bool kSupported = true;
+#else
+inline constexpr bool kSupported = false;
+#endif
+
+namespace detail
+{
+template<queries::detail::Serializable Monoid>
+std::string SavePartial(const Monoid& monoid)
+{
+    std::ostringstream stream{ std::ios::binary };
+    queries::detail::SaveMonoid(stream, monoid);
+
+    return std::move(stream).str();
+}
+
+template<queries::detail::Serializable Monoid>
+Monoid LoadPartial(const std::string& bytes)
+{
+    Monoid monoid{};
+    std::istringstream stream{ bytes, std::ios::binary };
+
+    // Anything left over means the worker and the coordinator don't agree on the monoid
+    if (!queries::detail::LoadMonoid(stream, monoid) || stream.peek() != std::istringstream::traits_type::eof())
+        throw std::runtime_error{ "A worker sent back a partial that couldn't be read." };
+
+    return monoid;
+}
+
+/// <summary>
+/// Forks one worker per shard. Each loads its shard and hands back whatever work returns for it, over a pipe.
+/// The results come back in shard order, and a worker that fails to load its shard, throws or dies turns
+/// into a runtime_error here.
+/// </summary>
+std::vector<std::string> RunWorkers(const std::vector<std::filesystem::path>& shards,
+                                    const std::function<std::string(const bakery::Database&)>& work);
+} // end detail namespace
+
+/// <summary>
+/// Splits transactions into shardCount snapshot files of (nearly) equal size in the directory, and returns
+/// their paths in order.
+/// </summary>
+std::vector<std::filesystem::path> WriteShards(std::span<const bakery::Transaction> transactions,
+                                               const std::filesystem::path& directory, std::size_t shardCount);
+
+/// <summary>
+/// Runs queries over a set of on-disk shards, each in its own worker process, so the whole data set never has
+/// to fit in one process. Every worker reduces its shard with the ordinary map-reduce, and sends back only
+/// its serialized monoid, which the coordinator reduces in shard order. So the result is the same as running
+/// the query over all of the shards' transactions in one process, for any exact monoid.
+///
+/// Workers are forked per query, and exit once they've replied.
+/// </summary>
+class ShardedExecutor
+{
+public:
+    explicit ShardedExecutor(std::vector<std::filesystem::path> shards) : m_shards(std::move(shards)) {}
+
+    const std::vector<std::filesystem::path>& Shards() const { return m_shards; }
+
+    // Each worker builds the query from its own shard's database and the given arguments
+    template<typename Query, typename... Args>
+        requires queries::detail::Serializable<typename Query::Monoid>
+    typename Query::Result Run(const Args&... args) const
+    {
+        using Monoid = typename Query::Monoid;
+
+        const auto work = [&args...](const bakery::Database& database) {
+            const Query query{ database, args... };
+            return detail::SavePartial(queries::detail::MapReduce(std::span<const bakery::Transaction>(database.GetTransactions()),
+                                                                  queries::detail::Mapper(query), queries::detail::Reducer<Query>()));
+        };
+
+        Monoid aggregate{};
+        for (const std::string& partial : detail::RunWorkers(m_shards, work))
+            aggregate = Query::Reduce(aggregate, detail::LoadPartial<Monoid>(partial));
+
+        return Query::Finalize(aggregate);
+    }
+
+private:
+    std::vector<std::filesystem::path> m_shards;
+};
+} // end queries::sharding namespace
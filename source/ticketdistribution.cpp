@@ -0,0 +1,110 @@
+#include "ticketdistribution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <numeric>
+#include <ostream>
+
+namespace queries
+{
+void TicketTotalHistogram::Merge(const TicketTotalHistogram& other)
+{
+    if (other.m_counts.size() > m_counts.size())
+        m_counts.resize(other.m_counts.size());
+
+    for (std::size_t bucket = 0; bucket < other.m_counts.size(); ++bucket)
+        m_counts[bucket] += other.m_counts[bucket];
+
+    m_transactions += other.m_transactions;
+}
+
+TicketTotalHistogram TicketTotalHistogram::Merge(const TicketTotalHistogram& aggregate, const TicketTotalHistogram& next)
+{
+    TicketTotalHistogram result = aggregate;
+    result.Merge(next);
+
+    return result;
+}
+
+bool TicketTotalHistogram::Save(std::ostream& stream) const
+{
+    const std::uint64_t buckets = m_counts.size();
+    stream.write(reinterpret_cast<const char*>(&buckets), sizeof(buckets));
+    stream.write(reinterpret_cast<const char*>(&m_transactions), sizeof(m_transactions));
+    stream.write(reinterpret_cast<const char*>(m_counts.data()), m_counts.size() * sizeof(std::int64_t));
+
+    return static_cast<bool>(stream);
+}
+
+bool TicketTotalHistogram::Load(std::istream& stream)
+{
+    // Far more cents than any ticket could total, so anything past this is corrupt
+    constexpr std::uint64_t kMaxBuckets = std::uint64_t{ 1 } << 24;
+
+    std::uint64_t buckets = 0;
+    std::int64_t transactions = 0;
+    if (!stream.read(reinterpret_cast<char*>(&buckets), sizeof(buckets)) ||
+        !stream.read(reinterpret_cast<char*>(&transactions), sizeof(transactions)) ||
+        buckets > kMaxBuckets)
+    {
+        return false;
+    }
+
+    std::vector<std::int64_t> counts(buckets);
+    if (!stream.read(reinterpret_cast<char*>(counts.data()), counts.size() * sizeof(std::int64_t)))
+        return false;
+
+    if (std::reduce(counts.begin(), counts.end(), std::int64_t{ 0 }) != transactions)
+        return false;
+
+    m_counts = std::move(counts);
+    m_transactions = transactions;
+
+    return true;
+}
+
+TicketTotalDistribution::TicketTotalDistribution(const TicketTotalHistogram& histogram)
+    : m_atMost(histogram.Counts().size()), m_transactions(histogram.Transactions())
+{
+    std::inclusive_scan(histogram.Counts().begin(), histogram.Counts().end(), m_atMost.begin());
+}
+
+std::int64_t TicketTotalDistribution::CountAtMost(Cents total) const
+{
+    if (total < 0)
+        return 0;
+
+    if (static_cast<std::size_t>(total) >= m_atMost.size())
+        return m_transactions;
+
+    return m_atMost[static_cast<std::size_t>(total)];
+}
+
+std::int64_t TicketTotalDistribution::CountOver(double threshold) const
+{
+    return m_transactions - CountAtMost(std::llround(threshold * 100.0));
+}
+
+std::int64_t TicketTotalDistribution::CountBetween(double min, double max) const
+{
+    const Cents first = std::llround(min * 100.0);
+    const Cents last = std::llround(max * 100.0);
+
+    if (first >= last)
+        return 0;
+
+    return CountAtMost(last - 1) - CountAtMost(first - 1);
+}
+
+Cents TicketTotalDistribution::Percentile(double fraction) const
+{
+    if (m_transactions == 0)
+        return 0;
+
+    const double clamped = std::clamp(fraction, 0.0, 1.0);
+    const auto rank = std::max<std::int64_t>(1, static_cast<std::int64_t>(std::ceil(clamped * m_transactions)));
+
+    return std::ranges::lower_bound(m_atMost, rank) - m_atMost.begin();
+}
+} // end queries namespace
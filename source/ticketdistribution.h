@@ -0,0 +1,84 @@
+#pragma once
+
+#include "money.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <span>
+#include <vector>
+
+namespace queries
+{
+/// <summary>
+/// How many tickets came to each total (before gratuity), with one bucket per cent. Totals are a few
+/// thousand cents at most, so the buckets are dense. It's a monoid under bucket-wise addition, which is exact,
+/// and the buckets grow to fit whatever is added or merged in, so an empty histogram is the identity.
+/// </summary>
+class TicketTotalHistogram
+{
+public:
+    TicketTotalHistogram() = default;
+
+    // Sized up front for totals up to maxTotal, so adding those never resizes
+    explicit TicketTotalHistogram(Cents maxTotal) : m_counts(static_cast<std::size_t>(maxTotal) + 1) {}
+
+    void Add(Cents total, std::int64_t count = 1)
+    {
+        const auto bucket = static_cast<std::size_t>(total);
+        if (bucket >= m_counts.size())
+            m_counts.resize(bucket + 1);
+
+        m_counts[bucket] += count;
+        m_transactions += count;
+    }
+
+    void Merge(const TicketTotalHistogram& other);
+    static TicketTotalHistogram Merge(const TicketTotalHistogram& aggregate, const TicketTotalHistogram& next);
+
+    std::int64_t Transactions() const { return m_transactions; }
+
+    // The count of tickets totalling each number of cents, from 0 up to the largest total seen (or sized for)
+    std::span<const std::int64_t> Counts() const { return m_counts; }
+
+    // The bucket count, the transaction count and the buckets. Loading checks the buckets add up.
+    bool Save(std::ostream& stream) const;
+    bool Load(std::istream& stream);
+
+private:
+    std::vector<std::int64_t> m_counts;
+    std::int64_t m_transactions = 0;
+};
+
+/// <summary>
+/// A ticket total histogram turned into cumulative counts, which answers any threshold or range question
+/// with a lookup or two, and any percentile with a binary search over the buckets. Building it is one pass
+/// over the buckets, so a sweep over many thresholds costs one scan of the transactions in total.
+///
+/// Thresholds are given in dollars and compared in whole cents, like predicates::TotalBetween, so a total
+/// that's exactly on a threshold is never out by a rounding error.
+/// </summary>
+class TicketTotalDistribution
+{
+public:
+    TicketTotalDistribution() = default;
+    explicit TicketTotalDistribution(const TicketTotalHistogram& histogram);
+
+    std::int64_t Transactions() const { return m_transactions; }
+
+    std::int64_t CountAtMost(Cents total) const;
+
+    // Totals strictly over the threshold, and totals in [min, max)
+    std::int64_t CountOver(double threshold) const;
+    std::int64_t CountBetween(double min, double max) const;
+
+    /// <summary>
+    /// The smallest total that at least the given fraction of tickets come to or less (the nearest rank
+    /// percentile), so 0.5 is the median. It's 0 when there are no tickets.
+    /// </summary>
+    Cents Percentile(double fraction) const;
+
+private:
+    std::vector<std::int64_t> m_atMost;
+    std::int64_t m_transactions = 0;
+};
+} // end queries namespace
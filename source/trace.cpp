@@ -0,0 +1,125 @@
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+/// <summary>
+/// Owns every thread's buffer, so that events outlive the threads that recorded them. Registration
+/// happens once per thread, so the lock is never taken on the recording path.
+/// </summary>
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<queries::trace::detail::RingBuffer>> buffers;
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+Registry& GetRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+} // end unnamed namespace
+
+namespace queries::trace
+{
+namespace detail
+{
+std::atomic<bool> g_recording = false;
+
+RingBuffer& LocalBuffer()
+{
+    thread_local RingBuffer* buffer = []() {
+        Registry& registry = GetRegistry();
+        std::scoped_lock lock{ registry.mutex };
+
+        const auto threadIndex = static_cast<std::uint32_t>(registry.buffers.size());
+        return registry.buffers.emplace_back(std::make_unique<RingBuffer>(threadIndex)).get();
+    }();
+
+    return *buffer;
+}
+
+std::uint64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - GetRegistry().epoch).count();
+}
+} // end detail namespace
+
+void Start()
+{
+    // Make sure the epoch is established before the first event is timed
+    GetRegistry();
+    detail::g_recording.store(true, std::memory_order_relaxed);
+}
+
+void Stop()
+{
+    detail::g_recording.store(false, std::memory_order_relaxed);
+}
+
+void Clear()
+{
+    Registry& registry = GetRegistry();
+    std::scoped_lock lock{ registry.mutex };
+
+    for (auto& buffer : registry.buffers)
+        buffer->Clear();
+}
+
+void WriteChromeTrace(std::ostream& stream)
+{
+    Registry& registry = GetRegistry();
+    std::scoped_lock lock{ registry.mutex };
+
+    const std::ios_base::fmtflags flags = stream.flags();
+    const std::streamsize precision = stream.precision();
+
+    // Timestamps are in microseconds, so keep nanosecond resolution
+    stream << std::fixed << std::setprecision(3);
+
+    const char* separator = "\n";
+    stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    for (const auto& buffer : registry.buffers)
+    {
+        const std::uint32_t tid = buffer->ThreadIndex();
+
+        stream << separator << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << tid
+               << R"(,"args":{"name":"thread )" << tid << "\"}}";
+        separator = ",\n";
+
+        buffer->Visit([&](const Event& event) {
+            stream << separator << R"({"name":")" << event.name << R"(","cat":"query","ph":"X","pid":1,"tid":)" << tid
+                   << ",\"ts\":" << event.beginNanos / 1000.0
+                   << ",\"dur\":" << (event.endNanos - event.beginNanos) / 1000.0;
+
+            if (event.arg >= 0)
+                stream << ",\"args\":{\"chunk\":" << event.arg << "}";
+
+            stream << "}";
+        });
+    }
+
+    stream << "\n]}\n";
+
+    stream.flags(flags);
+    stream.precision(precision);
+}
+
+bool WriteChromeTrace(const std::filesystem::path& path)
+{
+    std::ofstream stream{ path };
+    if (!stream)
+        return false;
+
+    WriteChromeTrace(stream);
+    return static_cast<bool>(stream);
+}
+} // end queries::trace namespace
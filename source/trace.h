@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+
+namespace queries::trace
+{
+/// <summary>
+/// Tracing is compiled in only when QUERY_TRACING is defined (see the QUERY_TRACING cmake option). When it's
+/// compiled in, it's still off until Start() is called, and a disabled ScopedEvent costs a single relaxed load.
+/// </summary>
+#if defined(QUERY_TRACING)
+inline constexpr bool kEnabled = true;
+#else
+inline constexpr bool kEnabled = false;
+#endif
+
+/// <summary>
+/// A complete ("ph":"X") event. The name must be a string literal, since only the pointer is recorded.
+/// </summary>
+struct Event
+{
+    const char* name = nullptr;
+    std::uint64_t beginNanos = 0;
+    std::uint64_t endNanos = 0;
+    std::int64_t arg = -1;
+};
+
+namespace detail
+{
+/// <summary>
+/// A fixed size, single producer ring buffer. Only the owning thread ever writes to it, so recording is a plain
+/// store followed by a release store of the head. Once it wraps, the oldest events are overwritten.
+/// </summary>
+class RingBuffer
+{
+public:
+    static constexpr std::size_t kCapacity = 1 << 16;
+
+    explicit RingBuffer(std::uint32_t threadIndex) : m_threadIndex(threadIndex) {}
+
+    void Push(const Event& event)
+    {
+        const std::uint64_t head = m_head.load(std::memory_order_relaxed);
+        m_events[head % kCapacity] = event;
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    template<typename Visitor>
+    void Visit(Visitor visitor) const
+    {
+        const std::uint64_t head = m_head.load(std::memory_order_acquire);
+        const std::uint64_t first = head > kCapacity ? head - kCapacity : 0;
+
+        for (std::uint64_t index = first; index < head; ++index)
+            visitor(m_events[index % kCapacity]);
+    }
+
+    void Clear() { m_head.store(0, std::memory_order_release); }
+
+    std::uint32_t ThreadIndex() const { return m_threadIndex; }
+
+private:
+    std::array<Event, kCapacity> m_events{};
+    std::atomic<std::uint64_t> m_head = 0;
+    std::uint32_t m_threadIndex = 0;
+};
+
+extern std::atomic<bool> g_recording;
+
+RingBuffer& LocalBuffer();
+std::uint64_t Now();
+} // end detail namespace
+
+/// <summary>
+/// Starts and stops recording. Events already in the buffers are kept until Clear() is called.
+/// </summary>
+void Start();
+void Stop();
+void Clear();
+
+inline bool IsRecording()
+{
+    if constexpr (kEnabled)
+        return detail::g_recording.load(std::memory_order_relaxed);
+    else
+        return false;
+}
+
+/// <summary>
+/// Writes every recorded event as Chrome trace JSON, which loads in Perfetto and chrome://tracing. This
+/// should only be called once the traced work has finished, since it reads the other threads' buffers.
+/// </summary>
+void WriteChromeTrace(std::ostream& stream);
+bool WriteChromeTrace(const std::filesystem::path& path);
+
+/// <summary>
+/// Records the lifetime of this object as an event on the calling thread.
+/// </summary>
+class ScopedEvent
+{
+public:
+    explicit ScopedEvent(const char* name, std::int64_t arg = -1)
+    {
+        if (IsRecording())
+        {
+            m_event.name = name;
+            m_event.arg = arg;
+            m_event.beginNanos = detail::Now();
+        }
+    }
+
+    ~ScopedEvent()
+    {
+        if constexpr (kEnabled)
+        {
+            if (m_event.name != nullptr)
+            {
+                m_event.endNanos = detail::Now();
+                detail::LocalBuffer().Push(m_event);
+            }
+        }
+    }
+
+    ScopedEvent(const ScopedEvent&) = delete;
+    ScopedEvent& operator=(const ScopedEvent&) = delete;
+
+private:
+    Event m_event;
+};
+} // end queries::trace namespace
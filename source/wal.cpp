@@ -0,0 +1,493 @@
+#include "wal.h"
+
+#include <array>
+#include <cerrno>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace bakery
+{
+namespace
+{
+struct LogHeader
+{
+    std::uint64_t magic = TransactionLog::kMagic;
+    std::uint32_t version = TransactionLog::kVersion;
+    std::uint32_t recordSize = sizeof(TransactionRecord);
+};
+
+struct FrameHeader
+{
+    std::uint64_t firstRow = 0;
+    std::uint32_t count = 0;
+    std::uint32_t crc = 0;
+};
+
+// Far bigger than any one group commit, so a frame claiming more is corrupt
+constexpr std::uint32_t kMaxFrameRecords = 1 << 24;
+
+constexpr std::array<std::uint32_t, 256> kCrcTable = []() {
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t index = 0; index < table.size(); ++index)
+    {
+        std::uint32_t crc = index;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+
+        table[index] = crc;
+    }
+
+    return table;
+}();
+
+std::uint32_t Crc32(const void* data, std::size_t size, std::uint32_t crc = 0)
+{
+    crc = ~crc;
+    for (const auto byte : std::span{ static_cast<const unsigned char*>(data), size })
+        crc = (crc >> 8) ^ kCrcTable[(crc ^ byte) & 0xFF];
+
+    return ~crc;
+}
+
+std::uint32_t FrameCrc(std::uint64_t firstRow, std::span<const TransactionRecord> records)
+{
+    const auto count = static_cast<std::uint32_t>(records.size());
+
+    std::uint32_t crc = Crc32(&firstRow, sizeof(firstRow));
+    crc = Crc32(&count, sizeof(count), crc);
+
+    return Crc32(records.data(), records.size_bytes(), crc);
+}
+
+TransactionRecord ToRecord(const Transaction& transaction)
+{
+    return {
+        .orderNumber = transaction.orderNumber,
+        .purchases = static_cast<std::uint32_t>(transaction.purchases.to_ulong()),
+        .gratuity = transaction.gratuity
+    };
+}
+
+Transaction FromRecord(const TransactionRecord& record)
+{
+    return { .orderNumber = record.orderNumber, .gratuity = record.gratuity, .purchases = record.purchases };
+}
+
+void Write(std::FILE* file, const void* data, std::size_t size)
+{
+    if (size != 0 && std::fwrite(data, 1, size, file) != size)
+        throw std::system_error{ errno, std::generic_category(), "Couldn't write to the transaction log" };
+}
+
+void WriteFrame(std::FILE* file, std::uint64_t firstRow, std::span<const TransactionRecord> records)
+{
+    const FrameHeader header{ .firstRow = firstRow, .count = static_cast<std::uint32_t>(records.size()), .crc = FrameCrc(firstRow, records) };
+
+    Write(file, &header, sizeof(header));
+    Write(file, records.data(), records.size_bytes());
+}
+
+// Flushes the file's buffer, then has the OS put it on disk
+void Sync(std::FILE* file)
+{
+#if defined(_WIN32)
+    const bool synced = std::fflush(file) == 0 && _commit(_fileno(file)) == 0;
+#else
+    const bool synced = std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+#endif
+
+    if (!synced)
+        throw std::system_error{ errno, std::generic_category(), "Couldn't sync the transaction log" };
+}
+
+bool ReadHeader(std::istream& stream)
+{
+    LogHeader header;
+
+    return stream.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+           header.magic == TransactionLog::kMagic &&
+           header.version == TransactionLog::kVersion &&
+           header.recordSize == sizeof(TransactionRecord);
+}
+
+enum class FrameStatus
+{
+    eRead,
+    eIncomplete,
+    eCorrupt
+};
+
+// A frame that runs off the end of the file is incomplete, as it may still be being written
+FrameStatus ReadFrame(std::istream& stream, FrameHeader& frame, std::vector<TransactionRecord>& records)
+{
+    if (!stream.read(reinterpret_cast<char*>(&frame), sizeof(frame)))
+        return FrameStatus::eIncomplete;
+
+    if (frame.count > kMaxFrameRecords)
+        return FrameStatus::eCorrupt;
+
+    records.resize(frame.count);
+    if (!stream.read(reinterpret_cast<char*>(records.data()), frame.count * sizeof(TransactionRecord)))
+        return FrameStatus::eIncomplete;
+
+    return FrameCrc(frame.firstRow, records) == frame.crc ? FrameStatus::eRead : FrameStatus::eCorrupt;
+}
+
+std::uintmax_t FrameSize(const FrameHeader& frame)
+{
+    return sizeof(FrameHeader) + frame.count * sizeof(TransactionRecord);
+}
+
+/// <summary>
+/// Hands each intact frame to visit, in order, until one is torn or corrupt or visit returns false. Returns
+/// the length of the file up to the end of the last frame visited, or nothing if it isn't a log at all.
+/// </summary>
+std::optional<std::uintmax_t> ReadFrames(const std::filesystem::path& file,
+                                         const std::function<bool(std::uint64_t, std::span<const TransactionRecord>)>& visit)
+{
+    std::ifstream stream{ file, std::ios::binary };
+    if (!ReadHeader(stream))
+        return std::nullopt;
+
+    std::uintmax_t valid = sizeof(LogHeader);
+    std::vector<TransactionRecord> records;
+
+    FrameHeader frame;
+    while (ReadFrame(stream, frame, records) == FrameStatus::eRead && visit(frame.firstRow, records))
+        valid += FrameSize(frame);
+
+    return valid;
+}
+} // end unnamed namespace
+
+bool SyncFile(const std::filesystem::path& file)
+{
+    std::FILE* stream = std::fopen(file.string().c_str(), "rb+");
+    if (stream == nullptr)
+        return false;
+
+    bool synced = true;
+    try
+    {
+        Sync(stream);
+    }
+    catch (const std::system_error&)
+    {
+        synced = false;
+    }
+
+    return std::fclose(stream) == 0 && synced;
+}
+
+bool SyncDirectory(const std::filesystem::path& directory)
+{
+#if defined(_WIN32)
+    // Windows can't sync a directory, and NTFS journals its entries, so there's nothing to do
+    return std::filesystem::is_directory(directory.empty() ? "." : directory);
+#else
+    const int descriptor = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (descriptor < 0)
+        return false;
+
+    const bool synced = fsync(descriptor) == 0;
+
+    return close(descriptor) == 0 && synced;
+#endif
+}
+
+TransactionLog::TransactionLog(const std::filesystem::path& file, std::size_t firstRow)
+    : m_path(file), m_nextRow(firstRow)
+{
+    if (std::filesystem::exists(m_path))
+    {
+        std::uint64_t lastRow = 0;
+        const auto valid = ReadFrames(m_path, [&lastRow](std::uint64_t row, std::span<const TransactionRecord> records) {
+            lastRow = row + records.size();
+            return true;
+        });
+
+        if (!valid)
+            throw std::runtime_error{ m_path.string() + " isn't a transaction log." };
+
+        if (lastRow > firstRow)
+            throw std::logic_error{ "The transaction log holds rows the database doesn't have, so it wasn't recovered." };
+
+        if (*valid < std::filesystem::file_size(m_path))
+            std::filesystem::resize_file(m_path, *valid);
+
+        Open("ab");
+    }
+    else
+    {
+        Open("wb");
+
+        const LogHeader header;
+        Write(m_file, &header, sizeof(header));
+        Sync(m_file);
+
+        if (!SyncDirectory(m_path.parent_path()))
+            throw std::system_error{ errno, std::generic_category(), "Couldn't sync the directory of " + m_path.string() };
+    }
+
+    m_committer = std::thread{ &TransactionLog::Commit, this };
+}
+
+TransactionLog::~TransactionLog()
+{
+    {
+        std::lock_guard lock{ m_mutex };
+        m_stopping = true;
+    }
+
+    m_condition.notify_all();
+    m_committer.join();
+
+    std::fclose(m_file);
+}
+
+void TransactionLog::Open(const char* mode)
+{
+    m_file = std::fopen(m_path.string().c_str(), mode);
+    if (m_file == nullptr)
+        throw std::system_error{ errno, std::generic_category(), "Couldn't open " + m_path.string() };
+}
+
+std::future<void> TransactionLog::Append(std::span<const Transaction> transactions)
+{
+    std::promise<void> promise;
+    std::future<void> future = promise.get_future();
+
+    {
+        std::lock_guard lock{ m_mutex };
+        if (m_stopping)
+            throw std::logic_error{ "The transaction log is closing." };
+
+        for (const Transaction& transaction : transactions)
+            m_pending.push_back(ToRecord(transaction));
+
+        m_nextRow += transactions.size();
+        m_waiting.push_back(std::move(promise));
+    }
+
+    m_condition.notify_all();
+    return future;
+}
+
+void TransactionLog::Flush()
+{
+    // An empty append is committed after everything before it, so waiting on it waits for them all
+    Append({}).get();
+}
+
+std::size_t TransactionLog::NextRow() const
+{
+    std::lock_guard lock{ m_mutex };
+    return m_nextRow;
+}
+
+/// <summary>
+/// The committer thread. Each time round, it takes everything appended so far, writes it as one frame, syncs
+/// once, and completes every append that was in it.
+/// </summary>
+void TransactionLog::Commit()
+{
+    for (;;)
+    {
+        std::vector<TransactionRecord> records;
+        std::vector<std::promise<void>> waiting;
+        std::size_t firstRow = 0;
+        std::exception_ptr error;
+
+        {
+            std::unique_lock lock{ m_mutex };
+            m_condition.wait(lock, [this]() { return m_stopping || !m_waiting.empty(); });
+
+            if (m_waiting.empty())
+                return;
+
+            records.swap(m_pending);
+            waiting.swap(m_waiting);
+            firstRow = m_nextRow - records.size();
+            error = m_error;
+        }
+
+        if (!error && !records.empty())
+        {
+            try
+            {
+                std::lock_guard fileLock{ m_fileMutex };
+                WriteFrame(m_file, firstRow, records);
+                Sync(m_file);
+
+                m_commits.fetch_add(1, std::memory_order_relaxed);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+
+                std::lock_guard lock{ m_mutex };
+                m_error = error;
+            }
+        }
+
+        for (std::promise<void>& promise : waiting)
+        {
+            if (error)
+                promise.set_exception(error);
+            else
+                promise.set_value();
+        }
+    }
+}
+
+void TransactionLog::Compact(std::size_t snapshotRows)
+{
+    Flush();
+
+    std::lock_guard fileLock{ m_fileMutex };
+
+    std::vector<TransactionRecord> kept;
+    std::uint64_t keptRow = snapshotRows;
+
+    ReadFrames(m_path, [&](std::uint64_t row, std::span<const TransactionRecord> records) {
+        for (const TransactionRecord& record : records)
+        {
+            if (row++ >= snapshotRows)
+                kept.push_back(record);
+        }
+
+        return true;
+    });
+
+    if (kept.empty())
+        keptRow = 0;
+
+    const std::filesystem::path temporary = m_path.string() + ".tmp";
+    std::FILE* file = std::fopen(temporary.string().c_str(), "wb");
+    if (file == nullptr)
+        throw std::system_error{ errno, std::generic_category(), "Couldn't create " + temporary.string() };
+
+    try
+    {
+        const LogHeader header;
+        Write(file, &header, sizeof(header));
+
+        if (!kept.empty())
+            WriteFrame(file, keptRow, kept);
+
+        Sync(file);
+    }
+    catch (...)
+    {
+        std::fclose(file);
+        std::filesystem::remove(temporary);
+        throw;
+    }
+
+    std::fclose(file);
+    std::fclose(m_file);
+    m_file = nullptr;
+
+    std::filesystem::rename(temporary, m_path);
+    Open("ab");
+
+    if (!SyncDirectory(m_path.parent_path()))
+        throw std::system_error{ errno, std::generic_category(), "Couldn't sync the directory of " + m_path.string() };
+}
+
+std::optional<std::size_t> TransactionLog::Replay(const std::filesystem::path& file, TransactionVector& transactions)
+{
+    if (!std::filesystem::exists(file))
+        return 0;
+
+    const std::size_t start = transactions.size();
+    bool gap = false;
+
+    ReadFrames(file, [&transactions, &gap](std::uint64_t row, std::span<const TransactionRecord> records) {
+        // A gap means the rows in between are gone, and nothing after them can be placed
+        if (row > transactions.size())
+        {
+            gap = true;
+            return false;
+        }
+
+        for (const TransactionRecord& record : records.subspan(std::min<std::size_t>(records.size(), transactions.size() - row)))
+            transactions.push_back(FromRecord(record));
+
+        return true;
+    });
+
+    if (gap)
+        return std::nullopt;
+
+    return transactions.size() - start;
+}
+
+std::size_t TransactionLogReader::Read(std::vector<Transaction>& transactions)
+{
+    // Not there yet, or still being created
+    if (!std::filesystem::exists(m_path) || std::filesystem::file_size(m_path) < sizeof(LogHeader))
+        return 0;
+
+    // Shorter than where this left off means it's been compacted
+    if (std::filesystem::file_size(m_path) < m_offset)
+        m_offset = 0;
+
+    const std::size_t start = transactions.size();
+
+    for (bool fromTheTop = m_offset == 0;; fromTheTop = true)
+    {
+        std::ifstream stream{ m_path, std::ios::binary };
+        if (m_offset == 0)
+        {
+            if (!ReadHeader(stream))
+                throw std::runtime_error{ m_path.string() + " isn't a transaction log." };
+
+            m_offset = sizeof(LogHeader);
+        }
+        else
+        {
+            stream.seekg(static_cast<std::streamoff>(m_offset));
+        }
+
+        FrameHeader frame;
+        FrameStatus status;
+        while ((status = ReadFrame(stream, frame, m_records)) == FrameStatus::eRead && frame.firstRow <= m_nextRow)
+        {
+            const std::size_t skipped = std::min<std::size_t>(m_records.size(), m_nextRow - frame.firstRow);
+            for (const TransactionRecord& record : std::span{ m_records }.subspan(skipped))
+                transactions.push_back(FromRecord(record));
+
+            m_nextRow += m_records.size() - skipped;
+            m_offset += FrameSize(frame);
+        }
+
+        if (status == FrameStatus::eIncomplete)
+            break;
+
+        // A bad or out of order frame where this left off is most likely a compacted log that's grown past
+        // the old length again, so that's read from the top. From the top, it's a real problem.
+        if (fromTheTop)
+        {
+            throw std::runtime_error{ status == FrameStatus::eCorrupt ?
+                m_path.string() + " is corrupt." :
+                m_path.string() + " was compacted past rows that were never read from it." };
+        }
+
+        m_offset = 0;
+    }
+
+    return transactions.size() - start;
+}
+} // end bakery namespace
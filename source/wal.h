@@ -0,0 +1,131 @@
+#pragma once
+
+#include "bakery.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace bakery
+{
+// Has the OS put a file that's already been written and closed on disk
+bool SyncFile(const std::filesystem::path& file);
+
+// Has the OS put a directory's entries on disk, so a file created or renamed in it survives a power loss
+bool SyncDirectory(const std::filesystem::path& directory);
+
+/// <summary>
+/// An append-only write-ahead log of new transactions, so they're durable as soon as they're ingested rather
+/// than at the next full save.
+///
+/// The file is a header followed by frames. A frame is a header (the row of its first transaction, how many
+/// transactions it holds, and a CRC32 of both and of the records) followed by the records, in the snapshot's
+/// record format. Rows are positions in the database, so replaying only has to skip the rows the database
+/// already has, which makes replaying after a compaction that was cut short harmless.
+///
+/// Appends are group committed: a committer thread writes everything appended while the previous fsync was
+/// in flight as one frame, with one fsync, and then completes all of their futures. So the fsync cost is
+/// shared by however many appends arrive during one, and throughput grows with the number of appenders.
+/// </summary>
+class TransactionLog
+{
+public:
+    static constexpr std::uint64_t kMagic = 0x4C57'4449'4F4E'4F4D; // "MONOIDWL"
+    static constexpr std::uint32_t kVersion = 1;
+
+    /// <summary>
+    /// Opens the log, creating it if needed, to continue from the given row (the size of the database it's
+    /// logging for, once that's been recovered). A torn frame at the end, from a crash mid-write, is cut off.
+    /// Throws if the file isn't a log, or holds rows past firstRow the database doesn't have.
+    /// </summary>
+    TransactionLog(const std::filesystem::path& file, std::size_t firstRow);
+
+    // Commits everything already appended
+    ~TransactionLog();
+
+    TransactionLog(const TransactionLog&) = delete;
+    TransactionLog& operator=(const TransactionLog&) = delete;
+
+    // The future is ready once the transactions are on disk (or holds the error if writing them failed)
+    std::future<void> Append(std::span<const Transaction> transactions);
+
+    // Waits until everything appended so far is on disk
+    void Flush();
+
+    /// <summary>
+    /// Drops the rows below snapshotRows from the log, once they've been written to a snapshot. The log is
+    /// rewritten to a new file, which then replaces the old one, so a crash part way leaves one or the other.
+    /// The snapshot's rename has to be on disk (see SyncDirectory) before this is called.
+    /// </summary>
+    void Compact(std::size_t snapshotRows);
+
+    // The row the next appended transaction will be, and how many fsyncs the appends have taken
+    std::size_t NextRow() const;
+    std::uint64_t Commits() const { return m_commits.load(std::memory_order_relaxed); }
+
+    /// <summary>
+    /// Appends the logged rows from transactions.size() onwards to transactions, stopping at the first frame
+    /// that's torn or corrupt. Returns how many were appended (0 when there's no log), or nothing if a frame
+    /// leaves a gap, as the rows in the gap are lost and the ones after it can't be placed.
+    /// </summary>
+    static std::optional<std::size_t> Replay(const std::filesystem::path& file, TransactionVector& transactions);
+
+private:
+    void Commit();
+    void Open(const char* mode);
+
+    std::filesystem::path m_path;
+    std::FILE* m_file = nullptr;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<TransactionRecord> m_pending;
+    std::vector<std::promise<void>> m_waiting;
+    std::size_t m_nextRow = 0;
+    bool m_stopping = false;
+
+    // Once a commit fails, the file can't be trusted past it, so every later append fails too
+    std::exception_ptr m_error;
+
+    // Held while the file is written, so a compaction never swaps it out from under a commit
+    std::mutex m_fileMutex;
+
+    std::atomic<std::uint64_t> m_commits = 0;
+    std::thread m_committer;
+};
+
+/// <summary>
+/// Reads a transaction log while another process writes it, picking up only the frames committed since the
+/// last read. A frame that's still being written is left for the next read. A log that's been compacted
+/// (replaced by a shorter file) is read again from the top, skipping the rows already read.
+/// </summary>
+class TransactionLogReader
+{
+public:
+    // Reads on from the given row, so rows below it (already in the database) are skipped
+    TransactionLogReader(std::filesystem::path file, std::size_t nextRow) : m_path(std::move(file)), m_nextRow(nextRow) {}
+
+    /// <summary>
+    /// Appends the rows committed since the last read to transactions, and returns how many that was. Throws
+    /// if the log isn't one, or is corrupt, or a compaction dropped rows this never read.
+    /// </summary>
+    std::size_t Read(std::vector<Transaction>& transactions);
+
+    std::size_t NextRow() const { return m_nextRow; }
+
+private:
+    std::filesystem::path m_path;
+    std::uintmax_t m_offset = 0;
+    std::size_t m_nextRow = 0;
+    std::vector<TransactionRecord> m_records;
+};
+} // end bakery namespace
@@ -1,9 +1,36 @@
+#include "async.h"
 #include "bakery.h"
+#include "batching.h"
+#include "compression.h"
+#include "groupby.h"
+#include "ingest.h"
+#include "metrics.h"
+#include "outofcore.h"
+#include "planner.h"
+#include "predicates.h"
 #include "queries.h"
+#include "sharding.h"
+#include "trace.h"
+#include "wal.h"
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <concepts>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
 #include <ranges>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 #include <gtest/gtest.h>
 
@@ -46,6 +73,17 @@ void CompareDatabaseEquality(const bakery::Database& a, const bakery::Database&
             ASSERT_EQ(foodID1, foodID2);
     }
 }
+// One of each strategy, with the thread pool's given the thread count
+std::vector<std::unique_ptr<queries::QueryStrategies>> AllStrategies(const bakery::Database& database, std::size_t threadCount = 3)
+{
+    std::vector<std::unique_ptr<queries::QueryStrategies>> strategies;
+    strategies.push_back(std::make_unique<queries::Sequential>(database));
+    strategies.push_back(std::make_unique<queries::SequentialIA>(database));
+    strategies.push_back(std::make_unique<queries::MapReduceParallelStd>(database));
+    strategies.push_back(std::make_unique<queries::MapReduceParallel>(database, threadCount));
+
+    return strategies;
+}
 }
 
 TEST_F(DatabaseTests, Generation)
@@ -86,6 +124,306 @@ TEST_F(DatabaseTests, Serialization)
     utility::CompareDatabaseEquality(database1, database2);
 }
 
+TEST_F(DatabaseTests, SnapshotSerialization)
+{
+    const std::filesystem::path snapshot = "./transactions.bin";
+
+    bakery::Database database1{7};
+    ASSERT_TRUE(database1.SaveSnapshot(snapshot));
+
+    bakery::Database database2;
+    ASSERT_TRUE(database2.LoadSnapshot(snapshot));
+
+    bakery::Database prefix;
+    ASSERT_TRUE(prefix.LoadSnapshot(snapshot, 3));
+    std::filesystem::remove(snapshot);
+
+    utility::CompareDatabaseEquality(database1, database2);
+
+    ASSERT_EQ(prefix.Size(), 3);
+    ASSERT_TRUE(std::ranges::equal(prefix.GetTransactions(), database1.GetTransactions(3)));
+}
+
+TEST_F(DatabaseTests, CompressedSnapshot)
+{
+    const std::filesystem::path directory = "./compressed";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+
+    const bakery::Database database{ 200'000, true };
+    database.Save(directory);
+    ASSERT_TRUE(database.SaveSnapshot(directory / "transactions.bin"));
+
+    const auto csvBytes = std::filesystem::file_size(directory / "transactions.csv") +
+                          std::filesystem::file_size(directory / "purchaseMappings.csv");
+    const auto snapshotBytes = std::filesystem::file_size(directory / "transactions.bin");
+
+    // Exact by default, and an order of magnitude smaller than the CSV files once gratuity can be quantized
+    ASSERT_TRUE(bakery::SaveCompressed(database.GetTransactions(), directory / "exact.bbk"));
+    ASSERT_LT(std::filesystem::file_size(directory / "exact.bbk"), snapshotBytes);
+
+    constexpr double kStep = 1e-4;
+    ASSERT_TRUE(bakery::SaveCompressed(database.GetTransactions(), directory / "quantized.bbk", { .gratuityStep = kStep }));
+    ASSERT_LT(std::filesystem::file_size(directory / "quantized.bbk") * 10, csvBytes);
+
+    bakery::Database exact;
+    ASSERT_TRUE(exact.LoadCompressed(directory / "exact.bbk"));
+    ASSERT_TRUE(std::ranges::equal(exact.GetTransactions(), database.GetTransactions()));
+
+    bakery::Database quantized;
+    ASSERT_TRUE(quantized.LoadCompressed(directory / "quantized.bbk"));
+    ASSERT_EQ(quantized.Size(), database.Size());
+
+    for (const auto& [original, decoded] : utility::Zip(database.GetTransactions(), quantized.GetTransactions()))
+    {
+        ASSERT_EQ(decoded.orderNumber, original.orderNumber);
+        ASSERT_EQ(decoded.purchases, original.purchases);
+        ASSERT_NEAR(decoded.gratuity, original.gratuity, kStep / 2 + 1e-12);
+    }
+
+    // Order numbers that jump about, a handful of gratuities (a dictionary) and a short last block
+    std::vector<bakery::Transaction> irregular;
+    for (int row = 0; row < 1'000; ++row)
+        irregular.push_back({ .orderNumber = (row % 7) * 100'003 - row * 3, .gratuity = 0.05 * (row % 4), .purchases = static_cast<unsigned long>(row * 2'654'435'761u) & 0x7FF'FFFF });
+
+    ASSERT_TRUE(bakery::SaveCompressed(irregular, directory / "irregular.bbk", { .blockRows = 300 }));
+
+    bakery::Database reloaded;
+    ASSERT_TRUE(reloaded.LoadCompressed(directory / "irregular.bbk"));
+    ASSERT_TRUE(std::ranges::equal(reloaded.GetTransactions(), irregular));
+
+    // A view reads the same columns without the rows: the dictionary coded masks of real baskets, and the
+    // packed masks of the irregular ones, both counted into each distinct mask and its rows
+    for (const std::span<const bakery::Transaction> rows : { std::span<const bakery::Transaction>(database.GetTransactions()).first(50'000),
+                                                             std::span<const bakery::Transaction>(irregular) })
+    {
+        std::vector<std::byte> block;
+        bakery::EncodeBlock(rows, {}, block);
+
+        const bakery::CompressedBlockView view{ block };
+        ASSERT_EQ(view.Rows(), rows.size());
+        ASSERT_EQ(view.MaskDictionary().empty(), rows.size() == irregular.size());
+
+        std::map<std::uint32_t, std::uint32_t> expected;
+        for (const bakery::Transaction& transaction : rows)
+            ++expected[static_cast<std::uint32_t>(transaction.purchases.to_ulong())];
+
+        std::map<std::uint32_t, std::uint32_t> counted;
+        for (const auto& [mask, count] : view.CountMasks())
+            counted[mask] += count;
+
+        ASSERT_EQ(counted, expected);
+
+        std::vector<bakery::Transaction> decoded(rows.size());
+        view.Decode(decoded);
+        ASSERT_TRUE(std::ranges::equal(decoded, rows));
+
+        // The mapped columns agree with the mapped rows
+        const queries::TicketDistributionQuery distribution{ database };
+        ASSERT_TRUE(std::ranges::equal(distribution.MapBlock(view).Counts(), distribution.MapChunk(rows).Counts()));
+
+        const queries::CoPurchaseQuery copurchase{ database };
+        ASSERT_EQ(copurchase.MapBlock(view), copurchase.MapChunk(rows));
+    }
+
+    // Neither a raw snapshot nor a damaged file loads
+    ASSERT_FALSE(reloaded.LoadCompressed(directory / "transactions.bin"));
+    std::filesystem::resize_file(directory / "irregular.bbk", std::filesystem::file_size(directory / "irregular.bbk") - 1);
+    ASSERT_FALSE(reloaded.LoadCompressed(directory / "irregular.bbk"));
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(DatabaseTests, ItemIndex)
+{
+    bakery::Database database{ 200'000, true };
+    ASSERT_EQ(database.GetItemIndex(), nullptr);
+
+    database.BuildItemIndex();
+
+    // Appending carries on from the partly filled last block, into new ones
+    const bakery::Database more{ 100'000, true };
+    database.Append(more.GetTransactions());
+
+    const bakery::ItemIndex* index = database.GetItemIndex();
+    ASSERT_NE(index, nullptr);
+    ASSERT_EQ(index->Size(), database.Size());
+
+    const auto& transactions = database.GetTransactions();
+    const auto Scan = [&transactions](const std::vector<int>& foodIDs, std::size_t first, std::size_t last) {
+        return std::count_if(transactions.begin() + first, transactions.begin() + last, [&foodIDs](const bakery::Transaction& transaction) {
+            return std::ranges::all_of(foodIDs, [&transaction](int foodID) { return transaction.purchases.test(foodID); });
+        });
+    };
+
+    const std::vector<std::vector<int>> lookups = { {}, { 0 }, { 26 }, { 0, 1 }, { 10, 20 }, { 18, 19, 20 }, { 3, 3 } };
+    const std::vector<std::pair<std::size_t, std::size_t>> ranges = {
+        { 0, transactions.size() }, { 1, 65'536 }, { 65'000, 140'000 }, { 199'999, 200'001 }, { 250'000, 250'000 }
+    };
+
+    for (const auto& foodIDs : lookups)
+    {
+        for (const auto& [first, last] : ranges)
+            ASSERT_EQ(index->CountAll(foodIDs, first, last), Scan(foodIDs, first, last));
+    }
+
+    ASSERT_EQ(index->Count(5), Scan({ 5 }, 0, transactions.size()));
+    ASSERT_EQ(index->Contains(7, 12'345), transactions[12'345].purchases.test(7));
+    ASSERT_LT(index->MemoryUsage(), transactions.size() * sizeof(bakery::Transaction));
+}
+
+TEST_F(DatabaseTests, HugePageStorage)
+{
+    const bakery::HugePages original = bakery::GetHugePages();
+
+    for (const bakery::HugePages mode : { bakery::HugePages::eNone, bakery::HugePages::eTransparent, bakery::HugePages::eExplicit })
+    {
+        bakery::SetHugePages(mode);
+
+        // Big enough to be mapped, which is always huge page aligned, and built with a single allocation
+        const bakery::Database database{ 200'000, true };
+        const auto& transactions = database.GetTransactions();
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(transactions.data()) % bakery::kHugePageSize, 0);
+        ASSERT_EQ(transactions.capacity(), transactions.size());
+
+        const bakery::TransactionVector sequential = bakery::GenerateTransactionsSequential(transactions.size());
+        ASSERT_EQ(sequential.capacity(), sequential.size());
+        ASSERT_TRUE(std::ranges::equal(sequential, transactions));
+    }
+
+    bakery::SetHugePages(original);
+
+    // An arena backed mapping holds the same entries as an ordinary one
+    const auto transactions = bakery::GenerateTransactionsSequential(10'000);
+    std::pmr::monotonic_buffer_resource arena{ bakery::GetHugePageResource() };
+
+    const auto mapping = bakery::GeneratePurchaseMapping(transactions);
+    const auto arenaMapping = bakery::GeneratePurchaseMapping(transactions, &arena);
+    ASSERT_EQ(arenaMapping.size(), mapping.size());
+
+    for (const auto& [orderNumber, item] : mapping)
+    {
+        const auto [begin, end] = arenaMapping.equal_range(orderNumber);
+        ASSERT_TRUE(std::any_of(begin, end, [&item](const auto& pair) { return pair.second == item; }));
+    }
+}
+
+TEST_F(DatabaseTests, TransactionLog)
+{
+    const std::filesystem::path directory = "./durable";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+
+    const bakery::Database source{ 40'000, true };
+    const auto& transactions = source.GetTransactions();
+
+    bakery::Database database;
+    ASSERT_TRUE(database.Recover(directory));
+    ASSERT_EQ(database.Size(), 0);
+
+    {
+        bakery::TransactionLog log{ directory / bakery::Database::kLogFile, database.Size() };
+
+        // Appends from several threads at once share fsyncs. One thread appends at a time, in row order.
+        constexpr std::size_t kAppends = 400;
+        const std::size_t batch = transactions.size() / 2 / kAppends;
+
+        std::mutex mutex;
+        std::vector<std::future<void>> commits;
+        std::vector<std::thread> appenders;
+
+        for (int thread = 0; thread < 4; ++thread)
+        {
+            appenders.emplace_back([&]() {
+                for (;;)
+                {
+                    std::lock_guard lock{ mutex };
+                    if (database.Size() == kAppends * batch)
+                        return;
+
+                    const auto next = std::span{ transactions }.subspan(database.Size(), batch);
+                    database.Append(next);
+                    commits.push_back(log.Append(next));
+                }
+            });
+        }
+
+        for (std::thread& appender : appenders)
+            appender.join();
+
+        for (std::future<void>& commit : commits)
+            commit.get();
+
+        ASSERT_LT(log.Commits(), kAppends);
+        ASSERT_EQ(log.NextRow(), database.Size());
+
+        // Compacting moves what's logged into the snapshot, and the log carries on from there
+        ASSERT_TRUE(database.Compact(directory, log));
+
+        const auto rest = std::span{ transactions }.subspan(database.Size());
+        database.Append(rest);
+        log.Append(rest).get();
+    }
+
+    bakery::Database recovered;
+    ASSERT_TRUE(recovered.Recover(directory));
+    utility::CompareDatabaseEquality(source, recovered);
+
+    // A frame torn by a crash is ignored on recovery, and cut off when the log is reopened
+    const std::filesystem::path logPath = directory / bakery::Database::kLogFile;
+    const auto logSize = std::filesystem::file_size(logPath);
+    {
+        std::ofstream stream{ logPath, std::ios::binary | std::ios::app };
+        stream << "a frame that was never finished";
+    }
+
+    bakery::Database torn;
+    ASSERT_TRUE(torn.Recover(directory));
+    ASSERT_EQ(torn.Size(), source.Size());
+
+    {
+        bakery::TransactionLog log{ logPath, torn.Size() };
+        ASSERT_EQ(std::filesystem::file_size(logPath), logSize);
+
+        // Rows the database doesn't have mean it wasn't recovered first
+        ASSERT_THROW(bakery::TransactionLog(logPath, torn.Size() - 1), std::logic_error);
+    }
+
+    // With only a log, an indexed database's rows start over, and its index is rebuilt over the replayed ones
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+    {
+        bakery::TransactionLog log{ logPath, 0 };
+        log.Append(std::span{ transactions }.first(10'000)).get();
+    }
+
+    bakery::Database indexed{ 5'000, true };
+    indexed.BuildItemIndex();
+    ASSERT_TRUE(indexed.Recover(directory));
+    ASSERT_EQ(indexed.Size(), 10'000);
+    ASSERT_NE(indexed.GetItemIndex(), nullptr);
+    ASSERT_EQ(indexed.GetItemIndex()->Size(), indexed.Size());
+
+    const auto withBagel = std::ranges::count_if(indexed.GetTransactions(), [](const bakery::Transaction& transaction) {
+        return transaction.purchases.test(0);
+    });
+    ASSERT_EQ(indexed.GetItemIndex()->Count(0), withBagel);
+
+    // A log that starts past the snapshot (one whose rename was lost after the log was compacted) fails to
+    // recover, rather than stopping short at the gap
+    std::filesystem::remove(logPath);
+    {
+        bakery::TransactionLog log{ logPath, 5'000 };
+        log.Append(std::span{ transactions }.first(1'000)).get();
+    }
+
+    bakery::Database gap;
+    ASSERT_FALSE(gap.Recover(directory));
+    ASSERT_EQ(gap.Size(), 0);
+
+    std::filesystem::remove_all(directory);
+}
+
 TEST_F(QueryTests, GreatestAndLeastPopularItems)
 {
     const bakery::Database database{ 100'000, true };
@@ -121,6 +459,145 @@ TEST_F(QueryTests, NumberOfTransactionsOver15)
     ASSERT_TRUE(num1 == num2 && num2 == num3 && num3 == num4);
 }
 
+TEST_F(QueryTests, TicketTotalDistribution)
+{
+    const bakery::Database database{ 100'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    std::vector<queries::Cents> totals;
+    for (const bakery::Transaction& transaction : transactions)
+    {
+        queries::Cents total = 0;
+        for (int foodID : transaction.GetPurchases())
+            total += std::llround(database.GetFood(foodID).cost * 100.0);
+
+        totals.push_back(total);
+    }
+
+    std::vector<queries::Cents> sorted = totals;
+    std::ranges::sort(sorted);
+
+    const auto strategies = utility::AllStrategies(database);
+    queries::Sequential sequential{ database };
+
+    for (const auto& strategy : strategies)
+    {
+        // A prefix first, so the incremental strategy has to extend its histogram
+        strategy->GetTicketTotalDistribution(transactions.first(12'345));
+        const queries::TicketTotalDistribution distribution = strategy->GetTicketTotalDistribution(transactions);
+
+        ASSERT_EQ(distribution.Transactions(), transactions.size());
+
+        for (double threshold : { -1.0, 0.0, 1.5, 4.99, 15.0, 15.01, 22.37, 1000.0 })
+        {
+            const auto cents = std::llround(threshold * 100.0);
+            ASSERT_EQ(distribution.CountOver(threshold), std::ranges::count_if(totals, [cents](queries::Cents total) { return total > cents; }));
+            ASSERT_EQ(distribution.CountBetween(threshold, threshold + 3.5),
+                      std::ranges::count_if(totals, [cents](queries::Cents total) { return total >= cents && total < cents + 350; }));
+        }
+
+        for (double fraction : { 0.0, 0.01, 0.5, 0.95, 0.99, 1.0 })
+        {
+            const auto rank = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(fraction * sorted.size())));
+            ASSERT_EQ(distribution.Percentile(fraction), sorted[rank - 1]);
+        }
+
+        ASSERT_EQ(strategy->GetNumberOfTransactionsOver(transactions, 15.0), distribution.CountOver(15.0));
+        ASSERT_EQ(strategy->GetTicketTotalPercentile(transactions, 0.5), distribution.Percentile(0.5));
+
+        // The helpers keep the distribution for their span, extend it as the span grows over the same rows, and
+        // start over for any other span
+        for (const auto span : { transactions.first(20'000), transactions.first(20'000), transactions.first(65'432),
+                                 transactions.subspan(5'000, 30'000), transactions.first(40'000), transactions })
+        {
+            const queries::TicketTotalDistribution expected = sequential.GetTicketTotalDistribution(span);
+
+            for (double threshold : { 4.99, 15.0, 22.37 })
+            {
+                ASSERT_EQ(strategy->GetNumberOfTransactionsOver(span, threshold), expected.CountOver(threshold));
+                ASSERT_EQ(strategy->GetNumberOfTransactionsBetween(span, threshold, threshold + 3.5), expected.CountBetween(threshold, threshold + 3.5));
+            }
+
+            ASSERT_EQ(strategy->GetTicketTotalPercentile(span, 0.9), expected.Percentile(0.9));
+        }
+    }
+
+    ASSERT_EQ(queries::TicketTotalDistribution{}.Percentile(0.5), 0);
+}
+
+TEST_F(QueryTests, Quantiles)
+{
+    const bakery::Database database{ 100'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    std::vector<double> totals;
+    std::vector<double> gratuities;
+    for (const bakery::Transaction& transaction : transactions)
+    {
+        queries::Cents total = 0;
+        for (int foodID : transaction.GetPurchases())
+            total += std::llround(database.GetFood(foodID).cost * 100.0);
+
+        totals.push_back(static_cast<double>(total));
+        gratuities.push_back(static_cast<double>(std::llround(total * transaction.gratuity)));
+    }
+
+    std::ranges::sort(totals);
+    std::ranges::sort(gratuities);
+
+    // The answer's rank among the exact values (a range, as values repeat) must be close to the one asked for
+    const auto ExpectRankWithin = [](const queries::QuantileSketch& sketch, const std::vector<double>& sorted, double tolerance) {
+        EXPECT_EQ(sketch.Count(), sorted.size());
+        EXPECT_EQ(sketch.Min(), sorted.front());
+        EXPECT_EQ(sketch.Max(), sorted.back());
+        EXPECT_LT(sketch.Retained(), 5 * queries::QuantileSketch::kAccuracy);
+
+        for (double fraction : { 0.01, 0.25, 0.5, 0.95, 0.99 })
+        {
+            const double value = sketch.Quantile(fraction);
+            const double below = static_cast<double>(std::ranges::lower_bound(sorted, value) - sorted.begin()) / sorted.size();
+            const double atMost = static_cast<double>(std::ranges::upper_bound(sorted, value) - sorted.begin()) / sorted.size();
+
+            EXPECT_LE(below - tolerance, fraction);
+            EXPECT_GE(atMost + tolerance, fraction);
+        }
+    };
+
+    const auto strategies = utility::AllStrategies(database);
+
+    for (const auto& strategy : strategies)
+    {
+        strategy->GetTicketTotalQuantiles(transactions.first(12'345));
+        strategy->GetGratuityQuantiles(transactions.first(12'345));
+
+        ExpectRankWithin(strategy->GetTicketTotalQuantiles(transactions), totals, 0.02);
+        ExpectRankWithin(strategy->GetGratuityQuantiles(transactions), gratuities, 0.02);
+    }
+
+    // Saving and loading gives back the same sketch, and anything cut short or from another format is refused
+    const queries::QuantileSketch sketch = strategies.front()->GetTicketTotalQuantiles(transactions);
+
+    std::stringstream stream;
+    ASSERT_TRUE(sketch.Save(stream));
+    const std::string bytes = stream.str();
+
+    queries::QuantileSketch loaded;
+    ASSERT_TRUE(loaded.Load(stream));
+    ASSERT_EQ(loaded.Count(), sketch.Count());
+    ASSERT_EQ(loaded.Retained(), sketch.Retained());
+
+    for (double fraction : { 0.0, 0.5, 0.99, 1.0 })
+        ASSERT_EQ(loaded.Quantile(fraction), sketch.Quantile(fraction));
+
+    std::stringstream truncated{ bytes.substr(0, bytes.size() - 1) };
+    std::stringstream garbage{ "not a sketch, but long enough to be read as a header" };
+    ASSERT_FALSE(loaded.Load(truncated));
+    ASSERT_FALSE(loaded.Load(garbage));
+    ASSERT_EQ(loaded.Count(), sketch.Count());
+
+    ASSERT_TRUE(std::isnan(queries::QuantileSketch{}.Quantile(0.5)));
+}
+
 TEST_F(QueryTests, LargestNumberOfPurachasesMade)
 {
     const bakery::Database database{ 100'000, true };
@@ -137,3 +614,876 @@ TEST_F(QueryTests, LargestNumberOfPurachasesMade)
 
     ASSERT_TRUE(count1 == count2 && count2 == count3 && count3 == count4);
 }
+
+TEST_F(QueryTests, Metrics)
+{
+    if constexpr (!queries::metrics::kEnabled)
+        GTEST_SKIP() << "Built without QUERY_METRICS";
+
+    const bakery::Database database{ 100'000, true };
+    const auto span = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    queries::MapReduceParallel parallel{ database };
+    queries::SequentialIA incremental{ database };
+
+    queries::metrics::Reset();
+    parallel.GetNumberOfTransactionsOver15(span);
+
+    const queries::metrics::Snapshot parallelSnapshot = queries::metrics::TakeSnapshot();
+    ASSERT_EQ(parallelSnapshot.rowsScanned, span.size());
+    ASSERT_EQ(parallelSnapshot.bytesTouched, span.size_bytes());
+    ASSERT_GT(parallelSnapshot.chunks, 0);
+    ASSERT_EQ(parallelSnapshot.parallelQueries, 1);
+    ASSERT_GE(parallelSnapshot.imbalance, 1.0);
+
+    queries::metrics::Reset();
+    incremental.GetLargestNumberOfPurachasesMade(span.first(50'000));
+    incremental.GetLargestNumberOfPurachasesMade(span);
+
+    const queries::metrics::Snapshot incrementalSnapshot = queries::metrics::TakeSnapshot();
+    ASSERT_EQ(incrementalSnapshot.rowsScanned, span.size());
+    ASSERT_EQ(incrementalSnapshot.cacheMisses, 1);
+    ASSERT_EQ(incrementalSnapshot.cacheHits, 1);
+}
+
+TEST_F(QueryTests, ChromeTrace)
+{
+    if constexpr (!queries::trace::kEnabled)
+        GTEST_SKIP() << "Built without QUERY_TRACING";
+
+    const bakery::Database database{ 10'000, true };
+    queries::MapReduceParallel strat{ database };
+
+    queries::trace::Clear();
+    queries::trace::Start();
+    strat.GetLargestNumberOfPurachasesMade(database.GetTransactions());
+    queries::trace::Stop();
+
+    // Nothing should be recorded once tracing has stopped
+    strat.GetLargestNumberOfPurachasesMade(database.GetTransactions());
+
+    std::ostringstream stream;
+    queries::trace::WriteChromeTrace(stream);
+    queries::trace::Clear();
+
+    const std::string json = stream.str();
+
+    std::size_t mapReduceEvents = 0;
+    for (auto pos = json.find("\"map_reduce\""); pos != std::string::npos; pos = json.find("\"map_reduce\"", pos + 1))
+        ++mapReduceEvents;
+
+    ASSERT_EQ(json.front(), '{');
+    ASSERT_NE(json.find("\"reduce\""), std::string::npos);
+    ASSERT_EQ(mapReduceEvents, std::thread::hardware_concurrency());
+}
+
+TEST_F(QueryTests, AsyncQueries)
+{
+    const bakery::Database database{ 100'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    ThreadPool pool;
+    queries::async::AsyncQueries async{ database, pool, 500 };
+    queries::Sequential sequential{ database };
+
+    // Keep a few hundred queries in flight at once, over differently sized spans
+    std::vector<queries::async::Task<std::size_t>> over15;
+    std::vector<queries::async::Task<std::size_t>> largest;
+    std::vector<queries::async::Task<queries::MinMaxFood>> popular;
+
+    for (std::size_t count = 0; count < 100; ++count)
+    {
+        const auto span = transactions.first(count * 200);
+        over15.push_back(async.GetNumberOfTransactionsOver15(span));
+        largest.push_back(async.GetLargestNumberOfPurachasesMade(span));
+        popular.push_back(async.GetGreatestAndLeastPopularItems(span));
+    }
+
+    const std::vector<std::size_t> over15Results = queries::async::SyncWait(queries::async::WhenAll(std::move(over15)));
+    const std::vector<std::size_t> largestResults = queries::async::SyncWait(queries::async::WhenAll(std::move(largest)));
+    const std::vector<queries::MinMaxFood> popularResults = queries::async::SyncWait(queries::async::WhenAll(std::move(popular)));
+
+    for (std::size_t count = 0; count < 100; ++count)
+    {
+        const auto span = transactions.first(count * 200);
+        ASSERT_EQ(over15Results[count], sequential.GetNumberOfTransactionsOver15(span));
+        ASSERT_EQ(largestResults[count], sequential.GetLargestNumberOfPurachasesMade(span));
+        ASSERT_EQ(popularResults[count], sequential.GetGreatestAndLeastPopularItems(span));
+    }
+}
+
+TEST_F(QueryTests, SharedScanBatching)
+{
+    const bakery::Database database{ 100'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    queries::Sequential sequential{ database };
+
+    std::vector<std::span<const bakery::Transaction>> spans;
+    std::vector<std::future<std::size_t>> over15;
+    std::vector<std::future<std::size_t>> largest;
+    std::vector<std::future<queries::MinMaxFood>> popular;
+
+    {
+        // A long window, so that every query below lands in the same batch
+        queries::batching::SharedScanBatcher batcher{ database, std::chrono::milliseconds{ 200 }, 1000 };
+
+        // Two clusters of overlapping ranges, with a gap between them, plus an empty range
+        for (std::size_t offset = 0; offset < 10; ++offset)
+        {
+            spans.push_back(transactions.subspan(offset * 1'500, 20'000 + offset * 333));
+            spans.push_back(transactions.subspan(60'000 + offset * 2'000, 10'000));
+        }
+
+        spans.push_back(transactions.subspan(50'000, 0));
+
+        for (const auto& span : spans)
+        {
+            over15.push_back(batcher.GetNumberOfTransactionsOver15(span));
+            largest.push_back(batcher.GetLargestNumberOfPurachasesMade(span));
+            popular.push_back(batcher.GetGreatestAndLeastPopularItems(span));
+        }
+
+        for (std::size_t index = 0; index < spans.size(); ++index)
+        {
+            ASSERT_EQ(over15[index].get(), sequential.GetNumberOfTransactionsOver15(spans[index]));
+            ASSERT_EQ(largest[index].get(), sequential.GetLargestNumberOfPurachasesMade(spans[index]));
+            ASSERT_EQ(popular[index].get(), sequential.GetGreatestAndLeastPopularItems(spans[index]));
+        }
+
+        ASSERT_EQ(batcher.QueriesServed(), spans.size() * 3);
+        ASSERT_LT(batcher.ScansPerformed(), spans.size());
+    }
+}
+
+TEST_F(QueryTests, ExactRevenue)
+{
+    const bakery::Database database{ 100'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    // The same sums, straight from the menu, one ticket at a time
+    queries::Cents revenue = 0;
+    queries::Cents gratuity = 0;
+    for (const bakery::Transaction& transaction : transactions)
+    {
+        queries::Cents subtotal = 0;
+        for (int foodID : transaction.GetPurchases())
+            subtotal += std::llround(database.GetFood(foodID).cost * 100.0);
+
+        revenue += subtotal;
+        gratuity += std::llround(subtotal * transaction.gratuity);
+    }
+
+    const auto tickets = static_cast<queries::Cents>(database.Size());
+    const queries::Cents averageTicket = (revenue + tickets / 2) / tickets;
+
+    auto strategies = utility::AllStrategies(database);
+    for (std::size_t threadCount : { 1, 2, 7, 16 })
+        strategies.push_back(std::make_unique<queries::MapReduceParallel>(database, threadCount));
+
+    for (const auto& strategy : strategies)
+    {
+        ASSERT_EQ(strategy->GetRevenue(transactions), revenue);
+        ASSERT_EQ(strategy->GetTotalGratuity(transactions), gratuity);
+        ASSERT_EQ(strategy->GetAverageTicket(transactions), averageTicket);
+    }
+
+    // The incremental aggregation caches carry over as the span grows
+    queries::SequentialIA incremental{ database };
+    queries::Sequential sequential{ database };
+
+    for (std::size_t count = 10'000; count <= transactions.size(); count += 30'000)
+    {
+        const auto span = transactions.first(count);
+        ASSERT_EQ(incremental.GetRevenue(span), sequential.GetRevenue(span));
+        ASSERT_EQ(incremental.GetTotalGratuity(span), sequential.GetTotalGratuity(span));
+        ASSERT_EQ(incremental.GetAverageTicket(span), sequential.GetAverageTicket(span));
+    }
+}
+
+TEST_F(QueryTests, Checkpoint)
+{
+    const bakery::Database database{ 50'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+    const auto prefix = transactions.first(30'000);
+    const std::filesystem::path checkpoint = "./checkpoint.bin";
+
+    const auto RunAll = [](queries::QueryStrategies& strategy, std::span<const bakery::Transaction> span) {
+        return std::make_tuple(strategy.GetGreatestAndLeastPopularItems(span), strategy.GetNumberOfTransactionsOver15(span),
+                               strategy.GetLargestNumberOfPurachasesMade(span), strategy.GetRevenue(span), strategy.GetTotalGratuity(span),
+                               strategy.GetAverageTicket(span), strategy.GetTopItems(span, 5), strategy.GetTopBaskets(span, 5),
+                               strategy.GetCoPurchases(span), strategy.GetTicketTotalDistribution(span).Percentile(0.9),
+                               strategy.GetTicketTotalQuantiles(span).Count(), strategy.GetGratuityQuantiles(span).Max());
+    };
+
+    queries::SequentialIA before{ database };
+    RunAll(before, prefix);
+    ASSERT_TRUE(before.SaveCheckpoint(checkpoint));
+
+    // A restarted strategy picks up every cache, and carries on from them exactly as the original would have
+    queries::SequentialIA after{ database };
+    ASSERT_EQ(after.LoadCheckpoint(checkpoint), 12);
+    ASSERT_EQ(RunAll(after, transactions), RunAll(before, transactions));
+
+    // Nothing is restored over a database whose prefix has changed, or is too short, or from a damaged file
+    std::vector<bakery::Transaction> edited{ transactions.begin(), transactions.end() };
+    edited[12'345].gratuity += 0.01;
+
+    bakery::Database changed;
+    changed.Append(edited);
+
+    bakery::Database shorter;
+    shorter.Append(transactions.first(20'000));
+
+    ASSERT_EQ(queries::SequentialIA{ changed }.LoadCheckpoint(checkpoint), 0);
+    ASSERT_EQ(queries::SequentialIA{ shorter }.LoadCheckpoint(checkpoint), 0);
+
+    std::filesystem::resize_file(checkpoint, std::filesystem::file_size(checkpoint) - 1);
+    ASSERT_EQ(queries::SequentialIA{ database }.LoadCheckpoint(checkpoint), 0);
+
+    std::filesystem::remove(checkpoint);
+}
+
+TEST_F(QueryTests, ShardedExecution)
+{
+    if constexpr (!queries::sharding::kSupported)
+        GTEST_SKIP() << "Sharded execution needs POSIX processes";
+
+    using namespace queries;
+
+    const bakery::Database database{ 30'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+    const std::filesystem::path directory = "./shards";
+
+    const queries::sharding::ShardedExecutor executor{ queries::sharding::WriteShards(transactions, directory, 3) };
+    ASSERT_EQ(executor.Shards().size(), 3);
+
+    queries::Sequential sequential{ database };
+    const auto predicate = queries::predicates::ContainsAny({ 17, 18, 19 }) && queries::predicates::GratuityAbove(0.15);
+
+    ASSERT_EQ(executor.Run<PopularItemsQuery>(), sequential.GetGreatestAndLeastPopularItems(transactions));
+    ASSERT_EQ(executor.Run<LargestPurchaseQuery>(), sequential.GetLargestNumberOfPurachasesMade(transactions));
+    ASSERT_EQ(executor.Run<RevenueQuery>(), sequential.GetRevenue(transactions));
+    ASSERT_EQ(executor.Run<AverageTicketQuery>(), sequential.GetAverageTicket(transactions));
+    ASSERT_EQ(executor.Run<CoPurchaseQuery>(), sequential.GetCoPurchases(transactions));
+    ASSERT_EQ(executor.Run<FilteredQuery<CountQuery>>(predicate), sequential.GetNumberOfTransactionsWhere(transactions, predicate));
+    ASSERT_EQ(executor.Run<TicketDistributionQuery>().Percentile(0.9), sequential.GetTicketTotalPercentile(transactions, 0.9));
+    ASSERT_EQ(executor.Run<TicketTotalQuantilesQuery>().Count(), transactions.size());
+
+    // A shard that can't be read fails the whole query
+    std::filesystem::remove(executor.Shards().back());
+    ASSERT_THROW(executor.Run<RevenueQuery>(), std::runtime_error);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(QueryTests, StreamingIngestion)
+{
+    const std::filesystem::path directory = "./streaming";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+
+    const bakery::Database source{ 60'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(source.GetTransactions());
+
+    // The upstream process, which logs and compacts as it goes
+    bakery::Database upstream;
+    bakery::TransactionLog log{ directory / bakery::Database::kLogFile, 0 };
+    const auto Ingest = [&](std::size_t count) {
+        const auto next = transactions.subspan(upstream.Size(), count);
+        upstream.Append(next);
+        log.Append(next).get();
+    };
+
+    bakery::Database database;
+    queries::SequentialIA strategy{ database };
+    strategy.GetRevenue(database.GetTransactions());
+    strategy.GetTicketTotalDistribution(database.GetTransactions());
+
+    bakery::LogFollower follower{ database, directory / bakery::Database::kLogFile };
+
+    std::size_t notified = 0;
+    follower.Subscribe([&](std::span<const bakery::Transaction> all, std::size_t newRows) {
+        notified += newRows;
+        strategy.Advance(all);
+    });
+
+    ASSERT_EQ(follower.Poll(), 0);
+
+    Ingest(10'000);
+    Ingest(5'000);
+    ASSERT_EQ(follower.Poll(), 15'000);
+    ASSERT_EQ(follower.Poll(), 0);
+
+    // A compaction replaces the log with a shorter one, which is read from the top without repeating rows
+    ASSERT_TRUE(upstream.Compact(directory, log));
+    Ingest(1'000);
+    ASSERT_EQ(follower.Poll(), 1'000);
+
+    follower.Start(std::chrono::milliseconds{ 1 });
+    while (upstream.Size() < transactions.size())
+        Ingest(4'000);
+
+    for (;;)
+    {
+        const auto lock = follower.Lock();
+        if (database.Size() == transactions.size())
+            break;
+    }
+
+    follower.Stop();
+    ASSERT_EQ(notified, transactions.size());
+    ASSERT_TRUE(std::ranges::equal(database.GetTransactions(), source.GetTransactions()));
+
+    queries::Sequential sequential{ source };
+    ASSERT_EQ(strategy.GetRevenue(database.GetTransactions()), sequential.GetRevenue(transactions));
+    ASSERT_EQ(strategy.GetTicketTotalDistribution(database.GetTransactions()).Percentile(0.9),
+              sequential.GetTicketTotalDistribution(transactions).Percentile(0.9));
+
+    // A follower that fell behind a compaction can't carry on from the log alone
+    bakery::Database behind;
+    bakery::LogFollower stale{ behind, directory / bakery::Database::kLogFile };
+    ASSERT_THROW(stale.Poll(), std::runtime_error);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(QueryTests, OutOfCoreExecution)
+{
+    using namespace queries;
+    using queries::outofcore::OutOfCoreExecutor;
+
+    const bakery::Database database{ 150'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    const std::filesystem::path snapshot = "./outofcore.bin";
+    ASSERT_TRUE(database.SaveSnapshot(snapshot));
+
+    // Small enough a budget to take several blocks, and one that can't hold any
+    constexpr std::size_t kBudget = std::size_t{ 1 } << 20;
+    ASSERT_THROW(OutOfCoreExecutor(snapshot, OutOfCoreExecutor::kBytesPerRow), std::invalid_argument);
+
+    OutOfCoreExecutor executor{ snapshot, kBudget };
+    ASSERT_EQ(executor.Size(), transactions.size());
+    ASSERT_LE(executor.MemoryUsage(), kBudget);
+    ASSERT_GT(executor.Size() / executor.BlockRows(), 4);
+
+    queries::Sequential sequential{ database };
+    const auto predicate = queries::predicates::ContainsAny({ 17, 18, 19 }) && queries::predicates::GratuityAbove(0.15);
+
+    ASSERT_EQ(executor.Run<PopularItemsQuery>(), sequential.GetGreatestAndLeastPopularItems(transactions));
+    ASSERT_EQ(executor.Run<RevenueQuery>(), sequential.GetRevenue(transactions));
+    ASSERT_EQ(executor.Run<TicketDistributionQuery>().Percentile(0.99), sequential.GetTicketTotalDistribution(transactions).Percentile(0.99));
+    ASSERT_EQ(executor.Run<FilteredQuery<CountQuery>>(predicate), sequential.GetNumberOfTransactionsWhere(transactions, predicate));
+
+    // A compressed snapshot streams the same way, a compressed block at a time
+    const std::filesystem::path compressed = "./outofcore.bbk";
+    ASSERT_TRUE(bakery::SaveCompressed(transactions, compressed, { .blockRows = 20'000 }));
+
+    OutOfCoreExecutor compressedExecutor{ compressed, kBudget };
+    ASSERT_LE(compressedExecutor.MemoryUsage(), kBudget);
+    ASSERT_EQ(compressedExecutor.Run<PopularItemsQuery>(), sequential.GetGreatestAndLeastPopularItems(transactions));
+    ASSERT_EQ(compressedExecutor.Run<GratuityQuery>(), sequential.GetTotalGratuity(transactions));
+
+    // Those that only need the purchases map each block's columns, and the rest decode its rows
+    static_assert(queries::detail::MapsBlocks<TransactionsOver15Query> && !queries::detail::MapsBlocks<GratuityQuery>);
+    ASSERT_EQ(compressedExecutor.Run<TransactionsOver15Query>(), sequential.GetNumberOfTransactionsOver15(transactions));
+    ASSERT_EQ(compressedExecutor.Run<RevenueQuery>(), sequential.GetRevenue(transactions));
+    ASSERT_EQ(compressedExecutor.Run<LargestPurchaseQuery>(), sequential.GetLargestNumberOfPurachasesMade(transactions));
+    ASSERT_EQ(compressedExecutor.Run<TicketDistributionQuery>().Percentile(0.99), sequential.GetTicketTotalDistribution(transactions).Percentile(0.99));
+    ASSERT_EQ(compressedExecutor.Run<CountQuery>(), transactions.size());
+    std::filesystem::remove(compressed);
+
+    // A snapshot cut short is an error, not a quietly partial answer
+    std::filesystem::resize_file(snapshot, std::filesystem::file_size(snapshot) - sizeof(bakery::TransactionRecord));
+    OutOfCoreExecutor truncated{ snapshot, kBudget };
+    ASSERT_THROW(truncated.Run<RevenueQuery>(), std::runtime_error);
+
+    std::filesystem::remove(snapshot);
+}
+
+TEST_F(QueryTests, Planner)
+{
+    using Plan = queries::Planner::Plan;
+
+    bakery::Database database{ 200'000, true };
+    database.BuildItemIndex();
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    // Measuring gives a model where the pool is never slower per row than one thread
+    const queries::Calibration measured = queries::Calibration::Measure(4);
+    ASSERT_GT(measured.sequentialNanosPerRow, 0.0);
+    ASSERT_LE(measured.parallelNanosPerRow, measured.sequentialNanosPerRow);
+    ASSERT_GE(measured.parallelOverheadNanos, 0.0);
+
+    // A fixed calibration, so the plans don't depend on the host: the pool pays off past about 27K rows
+    const queries::Calibration calibration{ .sequentialNanosPerRow = 1.0, .parallelNanosPerRow = 0.25, .parallelOverheadNanos = 20'000.0 };
+    ASSERT_EQ(calibration.ParallelCrossover(), 26'667);
+
+    queries::Planner planner{ database, 4, calibration };
+    queries::Sequential sequential{ database };
+
+    // Spans that aren't a prefix of the database go sequential or parallel by size
+    const auto small = transactions.subspan(1, 1'000);
+    const auto large = transactions.subspan(1);
+    ASSERT_EQ(planner.GetTotalGratuity(small), sequential.GetTotalGratuity(small));
+    ASSERT_EQ(planner.LastPlan(), Plan::eSequential);
+    ASSERT_EQ(planner.GetTotalGratuity(large), sequential.GetTotalGratuity(large));
+    ASSERT_EQ(planner.LastPlan(), Plan::eParallel);
+
+    // A growing prefix builds the cache the second time it's asked for, and then only scans what's new
+    ASSERT_EQ(planner.GetRevenue(transactions.first(150'000)), sequential.GetRevenue(transactions.first(150'000)));
+    ASSERT_EQ(planner.LastPlan(), Plan::eParallel);
+    ASSERT_EQ(planner.GetRevenue(transactions.first(160'000)), sequential.GetRevenue(transactions.first(160'000)));
+    ASSERT_EQ(planner.LastPlan(), Plan::eIncremental);
+    ASSERT_EQ(planner.GetRevenue(transactions.first(161'000)), sequential.GetRevenue(transactions.first(161'000)));
+    ASSERT_EQ(planner.LastPlan(), Plan::eIncremental);
+
+    // A shorter prefix than the cache covers can't use it
+    ASSERT_EQ(planner.GetRevenue(transactions.first(100'000)), sequential.GetRevenue(transactions.first(100'000)));
+    ASSERT_NE(planner.LastPlan(), Plan::eIncremental);
+
+    // Counting baskets that hold given items is an index lookup, anywhere in the database
+    const auto middle = transactions.subspan(10'000, 100'000);
+    const auto items = queries::predicates::ContainsAll({ 3, 5 });
+    ASSERT_EQ(planner.GetNumberOfTransactionsWhere(middle, items), sequential.GetNumberOfTransactionsWhere(middle, items));
+    ASSERT_EQ(planner.LastPlan(), Plan::eIndex);
+
+    const auto generous = items && queries::predicates::GratuityAbove(0.15);
+    ASSERT_EQ(planner.GetNumberOfTransactionsWhere(middle, generous), sequential.GetNumberOfTransactionsWhere(middle, generous));
+    ASSERT_NE(planner.LastPlan(), Plan::eIndex);
+
+    // Whatever it picks, the exact queries agree with the sequential strategy, call after call
+    for (const std::size_t rows : std::vector<std::size_t>{ 500, 50'000, 200'000, 200'000 })
+    {
+        const auto span = transactions.first(rows);
+        ASSERT_EQ(planner.GetGreatestAndLeastPopularItems(span), sequential.GetGreatestAndLeastPopularItems(span));
+        ASSERT_EQ(planner.GetNumberOfTransactionsOver15(span), sequential.GetNumberOfTransactionsOver15(span));
+        ASSERT_EQ(planner.GetLargestNumberOfPurachasesMade(span), sequential.GetLargestNumberOfPurachasesMade(span));
+        ASSERT_EQ(planner.GetAverageTicket(span), sequential.GetAverageTicket(span));
+        ASSERT_EQ(planner.GetTopItems(span, 5), sequential.GetTopItems(span, 5));
+        ASSERT_EQ(planner.GetCoPurchases(span), sequential.GetCoPurchases(span));
+        ASSERT_EQ(planner.GetRevenueWhere(span, generous), sequential.GetRevenueWhere(span, generous));
+        ASSERT_EQ(planner.GetTicketTotalDistribution(span).Percentile(0.9), sequential.GetTicketTotalDistribution(span).Percentile(0.9));
+    }
+}
+
+namespace utility
+{
+// Counts rows, and cancels the source once it's mapped a given number of them
+struct CancellingCountQuery
+{
+    using Monoid = std::size_t;
+    using Result = std::size_t;
+
+    CancellingCountQuery(const bakery::Database&, queries::CancellationSource* source, std::size_t cancelAfter)
+        : source(source), cancelAfter(cancelAfter)
+    {}
+
+    Monoid Map(const bakery::Transaction&) const
+    {
+        if (mapped->fetch_add(1) + 1 == cancelAfter)
+            source->Cancel();
+
+        return 1;
+    }
+
+    static Monoid Reduce(const Monoid& aggregate, const Monoid& next) { return aggregate + next; }
+    static Result Finalize(const Monoid& aggregate) { return aggregate; }
+
+    queries::CancellationSource* source;
+    std::size_t cancelAfter;
+    std::shared_ptr<std::atomic<std::size_t>> mapped = std::make_shared<std::atomic<std::size_t>>(0);
+};
+} // end utility namespace
+
+TEST_F(QueryTests, Cancellation)
+{
+    using namespace queries;
+    using utility::CancellingCountQuery;
+    constexpr std::size_t kChunkRows = queries::QueryStrategies::kCancellationChunkRows;
+
+    const bakery::Database database{ 500'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    const queries::Calibration calibration{ .sequentialNanosPerRow = 1.0, .parallelNanosPerRow = 0.25, .parallelOverheadNanos = 20'000.0 };
+
+    auto strategies = utility::AllStrategies(database, 4);
+    strategies.push_back(std::make_unique<queries::Planner>(database, 4, calibration));
+
+    queries::Sequential sequential{ database };
+    const auto predicate = queries::predicates::ContainsAny({ 17, 18, 19 });
+
+    for (const auto& strategy : strategies)
+    {
+        // With nothing to stop it, it's the whole answer
+        const auto revenue = strategy->RunCancellable<RevenueQuery>(transactions, {});
+        ASSERT_TRUE(revenue.Complete());
+        ASSERT_EQ(revenue.Coverage(), 1.0);
+        ASSERT_EQ(revenue.Finalize(), sequential.GetRevenue(transactions));
+
+        const auto filtered = strategy->RunCancellable<FilteredQuery<CountQuery>>(transactions, {}, predicate);
+        ASSERT_EQ(filtered.Finalize(), sequential.GetNumberOfTransactionsWhere(transactions, predicate));
+
+        // Cancelled or out of time before it starts, it does nothing
+        queries::CancellationSource cancelled;
+        cancelled.Cancel();
+
+        const auto none = strategy->RunCancellable<RevenueQuery>(transactions, cancelled.Token());
+        ASSERT_EQ(none.rows, 0);
+        ASSERT_EQ(none.Coverage(), 0.0);
+        ASSERT_EQ(none.Finalize(), 0);
+
+        const auto late = queries::CancellationToken::After(std::chrono::seconds{ -1 });
+        ASSERT_EQ(strategy->RunCancellable<RevenueQuery>(transactions, late).rows, 0);
+
+        // Cancelled part way, the chunks already started finish, and the partial covers exactly those
+        queries::CancellationSource source;
+        const auto partial = strategy->RunCancellable<CancellingCountQuery>(transactions, source.Token(), &source, kChunkRows + 1);
+        ASSERT_TRUE(source.IsCancelled());
+        ASSERT_FALSE(partial.Complete());
+        ASSERT_GE(partial.rows, kChunkRows + 1);
+        ASSERT_EQ(partial.Finalize(), partial.rows);
+    }
+
+    // On one thread, that's the chunk it was cancelled in and the ones before it
+    queries::CancellationSource source;
+    const auto partial = sequential.RunCancellable<CancellingCountQuery>(transactions, source.Token(), &source, kChunkRows + 1);
+    ASSERT_EQ(partial.rows, 2 * kChunkRows);
+    ASSERT_DOUBLE_EQ(partial.Coverage(), 2.0 * kChunkRows / transactions.size());
+
+    // The std strategy's chunks run on more than one thread, and a chunk that throws is rethrown, not a terminate
+    queries::MapReduceParallelStd parallelStd{ database };
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    parallelStd.RunChunks(64, kChunkRows, {}, [&](std::size_t) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+        const std::lock_guard lock{ mutex };
+        threads.insert(std::this_thread::get_id());
+    });
+
+    if (std::thread::hardware_concurrency() > 1)
+    {
+        ASSERT_GT(threads.size(), 1);
+    }
+
+    const auto Throw = [](std::size_t index) {
+        if (index == 3)
+            throw std::runtime_error{ "chunk failed" };
+    };
+    ASSERT_THROW(parallelStd.RunChunks(16, kChunkRows, {}, Throw), std::runtime_error);
+
+    // A deadline on a cancellable token stops it too, and the sooner of two deadlines wins
+    const queries::CancellationToken token = queries::CancellationSource{}.Token()
+        .WithDeadline(queries::CancellationToken::Clock::now() + std::chrono::hours{ 1 })
+        .WithDeadline(queries::CancellationToken::Clock::now() - std::chrono::seconds{ 1 });
+    ASSERT_TRUE(token.StopRequested());
+}
+
+TEST_F(QueryTests, ProgressiveExecution)
+{
+    using namespace queries;
+
+    const bakery::Database database{ 500'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    queries::Sequential sequential{ database };
+    queries::MapReduceParallel parallel{ database, 4 };
+
+    const queries::ProgressiveOptions options{ .blockRows = 4096, .blocksPerBatch = 8 };
+    const std::size_t blockCount = (transactions.size() + options.blockRows - 1) / options.blockRows;
+    const queries::Cents revenue = sequential.GetRevenue(transactions);
+
+    // Run to the end, every batch covers more, and the last one is exact with no error left
+    std::vector<queries::Progress<RevenueQuery>> updates;
+    const auto complete = parallel.RunProgressive<RevenueQuery>(transactions, [&updates](const auto& progress) {
+        updates.push_back(progress);
+        return true;
+    }, options);
+
+    ASSERT_TRUE(complete.Complete());
+    ASSERT_EQ(complete.Finalize(), revenue);
+    ASSERT_EQ(updates.size(), (blockCount + options.blocksPerBatch - 1) / options.blocksPerBatch);
+
+    for (std::size_t index = 1; index < updates.size(); ++index)
+    {
+        ASSERT_GT(updates[index].partial.rows, updates[index - 1].partial.rows);
+        ASSERT_EQ(updates[index].batches, index + 1);
+    }
+
+    ASSERT_EQ(updates.back().estimate, revenue);
+    ASSERT_EQ(updates.back().blocks, blockCount);
+    ASSERT_DOUBLE_EQ(updates.back().standardError.value(), 0.0);
+
+    // The first batch is a sample of the whole span, not its first rows, and already close to the answer
+    const auto& first = updates.front();
+    ASSERT_EQ(first.partial.rows, options.blocksPerBatch * options.blockRows);
+    ASSERT_NE(first.partial.monoid, sequential.GetRevenue(transactions.first(first.partial.rows)));
+    ASSERT_NEAR(static_cast<double>(first.estimate), static_cast<double>(revenue), 0.02 * revenue);
+    ASSERT_NEAR(static_cast<double>(first.estimate), static_cast<double>(revenue), 5.0 * first.standardError.value());
+
+    // Stopping once the answer is stable returns what was reduced by then
+    const auto stopped = sequential.RunProgressive<RevenueQuery>(transactions, [](const auto& progress) {
+        return progress.batches < 2;
+    }, options);
+    ASSERT_EQ(stopped.rows, 2 * options.blocksPerBatch * options.blockRows);
+    ASSERT_FALSE(stopped.Complete());
+
+    // Filtered counts extrapolate too, and queries that can't be extrapolated estimate by their partial as is
+    const auto predicate = queries::predicates::ContainsAny({ 17, 18, 19 });
+    const auto count = sequential.RunProgressive<FilteredQuery<CountQuery>>(transactions, [](const auto&) { return true; }, options, {}, predicate);
+    ASSERT_EQ(count.Finalize(), sequential.GetNumberOfTransactionsWhere(transactions, predicate));
+
+    const auto average = sequential.RunProgressive<AverageTicketQuery>(transactions, [](const auto& progress) {
+        EXPECT_EQ(progress.estimate, progress.partial.Finalize());
+        EXPECT_FALSE(progress.standardError.has_value());
+        return true;
+    }, options);
+    ASSERT_EQ(average.Finalize(), sequential.GetAverageTicket(transactions));
+
+    // A cancelled token stops it before the first batch
+    queries::CancellationSource source;
+    source.Cancel();
+    const auto cancelled = sequential.RunProgressive<RevenueQuery>(transactions, [](const auto&) { return true; }, options, source.Token());
+    ASSERT_EQ(cancelled.rows, 0);
+}
+
+TEST_F(QueryTests, GroupBy)
+{
+    const bakery::Database database{ 100'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    ThreadPool pool{ 3 };
+    queries::Sequential sequential{ database };
+
+    const queries::groupby::Count count;
+    const queries::groupby::Revenue revenue{ database };
+
+    // EXPECT rather than ASSERT, since this returns a value
+    const auto Check = [&](const auto& selector) {
+        const auto counts = queries::groupby::GroupBy(transactions, selector, count);
+        const auto revenues = queries::groupby::GroupBy(transactions, selector, revenue);
+
+        EXPECT_EQ(counts.size(), selector.KeyCount());
+        EXPECT_EQ(queries::groupby::GroupBy(pool, transactions, selector, count), counts);
+        EXPECT_EQ(queries::groupby::GroupBy(pool, transactions, selector, revenue), revenues);
+
+        // However the purchases are grouped, the revenue adds up to the same total
+        EXPECT_EQ(std::accumulate(revenues.begin(), revenues.end(), queries::Cents{}), sequential.GetRevenue(transactions));
+        return counts;
+    };
+
+    const auto typeCounts = Check(queries::groupby::ByFoodType{ database });
+    const auto& [min, max] = std::ranges::minmax_element(typeCounts);
+    ASSERT_EQ(std::make_pair(static_cast<bakery::FoodType>(std::distance(typeCounts.begin(), min)),
+                             static_cast<bakery::FoodType>(std::distance(typeCounts.begin(), max))),
+              sequential.GetGreatestAndLeastPopularItems(transactions));
+
+    const auto itemCounts = Check(queries::groupby::ByFoodID{});
+    ASSERT_EQ(std::accumulate(itemCounts.begin(), itemCounts.end(), std::int64_t{}),
+              std::accumulate(typeCounts.begin(), typeCounts.end(), std::int64_t{}));
+
+    const auto basketCounts = Check(queries::groupby::ByBasketSize{});
+    ASSERT_EQ(basketCounts[0], 0);
+    ASSERT_EQ(std::accumulate(basketCounts.begin(), basketCounts.end(), std::int64_t{}), transactions.size());
+    const auto largest = std::find_if(basketCounts.rbegin(), basketCounts.rend(), [](auto count) { return count != 0; });
+    ASSERT_EQ(std::distance(largest, basketCounts.rend()) - 1, sequential.GetLargestNumberOfPurachasesMade(transactions));
+
+    const auto bucketCounts = Check(queries::groupby::ByOrderBucket{ 30'000, 3 });
+    ASSERT_EQ(bucketCounts, (std::vector<std::int64_t>{ 30'000, 30'000, 40'000 }));
+}
+
+TEST_F(QueryTests, HeavyHitters)
+{
+    const bakery::Database database{ 100'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+    const auto total = static_cast<std::int64_t>(transactions.size());
+
+    std::unordered_map<std::uint32_t, std::int64_t> baskets;
+    for (const bakery::Transaction& transaction : transactions)
+        ++baskets[static_cast<std::uint32_t>(transaction.purchases.to_ulong())];
+
+    // The items summary never runs out of counters, so it's exact
+    const auto itemCounts = queries::groupby::GroupBy(transactions, queries::groupby::ByFoodID{}, queries::groupby::Count{});
+
+    const auto strategies = utility::AllStrategies(database);
+
+    for (const auto& strategy : strategies)
+    {
+        const std::vector<queries::HeavyHitter> topItems = strategy->GetTopItems(transactions, 5);
+        ASSERT_EQ(topItems.size(), 5);
+
+        for (std::size_t rank = 0; rank < topItems.size(); ++rank)
+        {
+            ASSERT_EQ(topItems[rank].count, itemCounts[topItems[rank].key]);
+            ASSERT_EQ(topItems[rank].maxCount, topItems[rank].count);
+            ASSERT_EQ(std::ranges::count_if(itemCounts, [&](auto count) { return count > topItems[rank].count; }), rank);
+        }
+
+        // Every reported basket count is within the bound, and every basket over the guarantee is reported
+        const std::vector<queries::HeavyHitter> topBaskets = strategy->GetTopBaskets(transactions, queries::kTopBasketsCapacity);
+        const std::int64_t guarantee = total / (queries::kTopBasketsCapacity + 1);
+
+        for (const queries::HeavyHitter& basket : topBaskets)
+        {
+            ASSERT_LE(basket.count, baskets.at(basket.key));
+            ASSERT_GE(basket.maxCount, baskets.at(basket.key));
+            ASSERT_LE(basket.maxCount - basket.count, guarantee);
+        }
+
+        for (const auto& [basket, count] : baskets)
+        {
+            if (count > guarantee)
+            {
+                ASSERT_TRUE(std::ranges::any_of(topBaskets, [&](const auto& hitter) { return hitter.key == basket; }));
+            }
+        }
+    }
+
+    // Saved summaries hold only the counters' fields, so equal summaries save to the same bytes and load back equal
+    const auto Save = [](const queries::HeavyHitters<8>& summary) {
+        std::ostringstream stream{ std::ios::binary };
+        EXPECT_TRUE(summary.Save(stream));
+        return std::move(stream).str();
+    };
+
+    queries::HeavyHitters<8> first;
+    queries::HeavyHitters<8> second;
+    for (std::uint32_t key : { 3u, 1u, 3u, 7u })
+    {
+        first.Add(key);
+        second.Add(key);
+    }
+
+    const std::string saved = Save(first);
+    ASSERT_EQ(saved, Save(second));
+    ASSERT_EQ(saved.size(), 2 * sizeof(std::int64_t) + 3 * (sizeof(std::uint32_t) + sizeof(std::int64_t)));
+
+    queries::HeavyHitters<8> loaded;
+    std::istringstream stream{ saved, std::ios::binary };
+    ASSERT_TRUE(loaded.Load(stream));
+    ASSERT_EQ(loaded.Ranked(), first.Ranked());
+
+    // A loaded summary finds the keys it holds, rather than tracking them twice
+    loaded.Add(3);
+    ASSERT_EQ(loaded.Size(), first.Size());
+    ASSERT_EQ(loaded.Ranked().front().count, 3);
+}
+
+TEST_F(QueryTests, CoPurchases)
+{
+    const bakery::Database database{ 200'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    // The naive nested loop over every pair in every basket
+    std::array<std::array<std::int64_t, 27>, 27> counts{};
+    for (const bakery::Transaction& transaction : transactions)
+    {
+        for (int first : transaction.GetPurchases())
+        {
+            for (int second : transaction.GetPurchases())
+                ++counts[first][second];
+        }
+    }
+
+    const auto strategies = utility::AllStrategies(database);
+
+    for (const auto& strategy : strategies)
+    {
+        const queries::CoPurchaseMatrix matrix = strategy->GetCoPurchases(transactions);
+        ASSERT_EQ(matrix.Transactions(), transactions.size());
+
+        for (int first = 0; first < 27; ++first)
+        {
+            for (int second = 0; second < 27; ++second)
+                ASSERT_EQ(matrix.Count(first, second), counts[first][second]);
+        }
+    }
+
+    const queries::CoPurchaseMatrix matrix = queries::CoPurchaseCounter::Count(transactions);
+    const double n = static_cast<double>(transactions.size());
+
+    ASSERT_DOUBLE_EQ(matrix.Support(0, 26), counts[0][26] / n);
+    ASSERT_DOUBLE_EQ(matrix.Lift(0, 26), (counts[0][26] / n) / ((counts[0][0] / n) * (counts[26][26] / n)));
+
+    // Far more distinct baskets than the counter's table holds, so it has to flush part way through
+    queries::CoPurchaseCounter counter;
+    queries::CoPurchaseMatrix expected;
+    for (std::uint32_t basket = 0; basket < 20'000; ++basket)
+    {
+        const std::uint32_t purchases = (basket * 2'654'435'761u) >> 5;
+        counter.Add(purchases);
+        expected.Add(purchases);
+    }
+
+    ASSERT_EQ(counter.Finish(), expected);
+
+    // The incremental variant carries its matrix over as the span grows
+    queries::SequentialIA incremental{ database };
+    for (std::size_t count = 1'000; count <= transactions.size(); count += 66'333)
+        ASSERT_EQ(incremental.GetCoPurchases(transactions.first(count)), queries::CoPurchaseCounter::Count(transactions.first(count)));
+}
+
+TEST_F(QueryTests, Predicates)
+{
+    using namespace queries::predicates;
+
+    const bakery::Database database{ 100'000, true };
+    const auto transactions = std::span<const bakery::Transaction>(database.GetTransactions());
+
+    const auto Total = [&](const bakery::Transaction& transaction) {
+        queries::Cents total = 0;
+        for (int foodID : transaction.GetPurchases())
+            total += std::llround(database.GetFood(foodID).cost * 100.0);
+
+        return total;
+    };
+
+    const auto Has = [](const bakery::Transaction& transaction, int foodID) { return transaction.purchases.test(foodID); };
+
+    // Each predicate, alongside the same test written out by hand
+    const std::vector<std::pair<Predicate, std::function<bool(const bakery::Transaction&)>>> cases = {
+        { Predicate{}, [](const auto&) { return true; } },
+        { ContainsAny({}), [](const auto&) { return false; } },
+        { ContainsAny({ 0, 1, 2 }), [&](const auto& t) { return Has(t, 0) || Has(t, 1) || Has(t, 2); } },
+        { ContainsAll({ 10, 20 }), [&](const auto& t) { return Has(t, 10) && Has(t, 20); } },
+        { BasketSizeAtLeast(3), [](const auto& t) { return t.purchases.count() >= 3; } },
+        { TotalBetween(5.0, 9.5), [&](const auto& t) { return Total(t) >= 500 && Total(t) < 950; } },
+        { GratuityAbove(0.2), [](const auto& t) { return t.gratuity > 0.2; } },
+        { (ContainsAny({ 17, 18, 19 }) && GratuityAbove(0.15)) || (BasketSizeAtLeast(2) && BasketSizeAtMost(2) && TotalBetween(0.0, 3.0)),
+          [&](const auto& t) {
+              return ((Has(t, 17) || Has(t, 18) || Has(t, 19)) && t.gratuity > 0.15) ||
+                     (t.purchases.count() == 2 && Total(t) < 300);
+          } },
+        { (ContainsAny({ 0, 1 }) || ContainsAll({ 25, 26 })) && (ContainsAny({ 20, 21 }) || TotalBetween(4.0, 100.0)),
+          [&](const auto& t) {
+              return (Has(t, 0) || Has(t, 1) || (Has(t, 25) && Has(t, 26))) && (Has(t, 20) || Has(t, 21) || Total(t) >= 400);
+          } },
+        { BasketSizeAtLeast(4) && BasketSizeAtMost(3), [](const auto&) { return false; } },
+    };
+
+    const auto strategies = utility::AllStrategies(database);
+
+    for (const auto& [predicate, test] : cases)
+    {
+        std::size_t count = 0;
+        queries::Cents revenue = 0;
+
+        for (const bakery::Transaction& transaction : transactions)
+        {
+            if (test(transaction))
+            {
+                ++count;
+                revenue += Total(transaction);
+            }
+        }
+
+        for (const auto& strategy : strategies)
+        {
+            ASSERT_EQ(strategy->GetNumberOfTransactionsWhere(transactions, predicate), count);
+            ASSERT_EQ(strategy->GetRevenueWhere(transactions, predicate), revenue);
+        }
+    }
+
+    ASSERT_TRUE((BasketSizeAtLeast(4) && BasketSizeAtMost(3)).Terms().empty());
+}